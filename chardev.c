@@ -5,19 +5,99 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/fs.h>
+#include <linux/atomic.h>
+#include <linux/bitops.h>
 #include <linux/cdev.h>
+#include <linux/capability.h>
+#include <linux/crc32.h>
+#include <linux/debugfs.h>
 #include <linux/device.h>
+#include <linux/gfp.h>
+#include <linux/jump_label.h>
+#include <linux/kobject.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/lz4.h>
+#include <linux/mm.h>
+#include <linux/moduleparam.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
 #include <linux/uaccess.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include "chardev_uapi.h"
+
+#define CREATE_TRACE_POINTS
+#include "chardev_trace.h"
+
 #define DEVICE_NAME "chardev"
 #define CLASS_NAME  "chardev_class"
-#define BUFFER_SIZE 1024
-/* IOCTL commands */
-#define IOCTL_RESET     _IO('c', 1)
-#define IOCTL_GET_SIZE  _IOR('c', 2, int)
-#define IOCTL_SET_FLAG  _IOW('c', 3, int)
-#define IOCTL_GET_FLAG  _IOR('c', 4, int)
+#define BUFFER_SIZE CHARDEV_BUFFER_SIZE
+#define MAX_DEVICES 64
+
+/* Write/read time stamps, one pair per block of the buffer */
+#define STAMP_BLOCK  CHARDEV_STAMP_BLOCK
+#define STAMP_BLOCKS (BUFFER_SIZE / STAMP_BLOCK)
+
+/* Log2 histogram buckets: bucket i counts values below 2^i ns */
+#define HIST_BUCKETS CHARDEV_HIST_BUCKETS
+
+/* Latency SLO watchdog: reasons for a breach, as a bit mask */
+#define SLO_P99     CHARDEV_SLO_P99
+#define SLO_FILL    CHARDEV_SLO_FILL
+#define SLO_BLOCKED CHARDEV_SLO_BLOCKED
+
+/* Self-benchmark limits */
+#define SELFTEST_DEFAULT_ITERATIONS 100000
+#define SELFTEST_MAX_ITERATIONS     1000000
+#define SELFTEST_RESCHED_INTERVAL   1024    /* iterations between cond_resched() */
+
+struct chardev_hist {
+    u64 buckets[HIST_BUCKETS];
+    u64 count;
+    u64 sum;
+    u64 max;
+};
+
+/* What took data->lock, for the lock statistics */
+enum chardev_lock_op {
+    LOCK_OP_READ = CHARDEV_LOCK_READ,
+    LOCK_OP_WRITE = CHARDEV_LOCK_WRITE,
+    LOCK_OP_IOCTL = CHARDEV_LOCK_IOCTL,
+    LOCK_OPS = CHARDEV_LOCK_OPS,
+};
+
+struct chardev_lock_stats {
+    struct chardev_hist wait[LOCK_OPS];     /* asking for the lock to getting it */
+    struct chardev_hist hold[LOCK_OPS];     /* getting it to letting go */
+};
+
+/*
+ * Counters and histograms of one instance on one CPU. Written with
+ * data->lock held and preemption off, inside the seqcount, so that
+ * readers can take a consistent copy of each CPU without the lock.
+ */
+struct chardev_pcpu_stats {
+    seqcount_t seq;
+    u64 reads;
+    u64 writes;
+    u64 ioctls;
+    u64 bytes_read;
+    u64 bytes_written;
+    struct chardev_hist queue_delay;    /* write to first read, per block */
+    struct chardev_lock_stats lock_stats;
+};
+
 /* Device data structure */
 struct chardev_data {
     struct cdev cdev;
@@ -25,11 +105,124 @@ struct chardev_data {
     size_t buffer_size;
     int flag;
     struct mutex lock;
+    struct chardev_pcpu_stats __percpu *stats;
+    struct chardev_ring_ctrl *ring;     /* control page, then ring data; NULL if off */
+    char *ring_data;                    /* the data area after the control page */
+    u32 ring_size;                      /* its bytes, a power of two */
+    u64 ring_head;                      /* end of the newest record */
+    u64 ring_dropped;                   /* records lost because the ring was full */
+    u64 ring_seq;                       /* sequence number of the next record */
+    u64 enqueue_ns[STAMP_BLOCKS];       /* last write to each block */
+    u64 dequeue_ns[STAMP_BLOCKS];       /* first read after it, 0 if unread */
+    struct dentry *debugfs;
+    struct device *device;
+    struct chardev_hist slo_window;     /* op latency since the last watchdog pass */
+    atomic_t waiting_readers;           /* readers waiting for data->lock */
+    unsigned int slo_breached;          /* SLO_* reasons last reported */
+    struct chardev_snapshot_instance restore;   /* its entry in the snapshot loaded */
+    loff_t restore_pos;                 /* its data there while not read in yet, else 0 */
+    struct chardev_mirror *mirror;      /* replication to a standby; NULL if off */
+    struct chardev_data *mirror_of;     /* on a standby: the primary it follows */
+    u64 tee_sinks;                      /* instances its writes fan out to, by minor */
+    u64 tee_failed;                     /* sinks left out after a failed copy */
+    u64 tee_errors;                     /* failed copies to sinks */
+};
+
+/*
+ * Instance locks are all one lockdep class. Where several are held they
+ * nest in this order, each at its own subclass: the instance written
+ * to, a tee sink it fans out to, then a standby either of them mirrors
+ * to. The links that could take them any other way are refused.
+ */
+enum chardev_lock_subclass {
+    CHARDEV_LOCK_SOURCE,
+    CHARDEV_LOCK_SINK,
+    CHARDEV_LOCK_STANDBY,
+};
+
+/*
+ * Per open file: what this descriptor has done, for /proc/<pid>/fdinfo.
+ * Updated with data->lock held.
+ */
+struct chardev_file {
+    struct chardev_data *data;
+    u64 reads;
+    u64 writes;
+    u64 ioctls;
+    u64 bytes_read;
+    u64 bytes_written;
+    u64 blocked_ns;                     /* waiting for data->lock */
 };
 
+/* Number of device instances: /dev/chardev, /dev/chardev1, ... */
+static unsigned int num_devices = 1;
+module_param(num_devices, uint, 0444);
+MODULE_PARM_DESC(num_devices, "Number of device instances (1-" __stringify(MAX_DEVICES) ", default 1)");
+
+/* Record ring exported through mmap(), in pages of data per instance */
+static unsigned int ring_pages;
+module_param(ring_pages, uint, 0444);
+MODULE_PARM_DESC(ring_pages, "Pages of mmap()able write-record ring per instance (power of two up to " __stringify(CHARDEV_RING_MAX_PAGES) ", default 0 = off)");
+
+/*
+ * Latency SLO watchdog. Every slo_interval_ms it checks each instance
+ * against the thresholds below (0 disables one) and sends a KOBJ_CHANGE
+ * uevent when the set of breached thresholds changes.
+ */
+static unsigned int slo_interval_ms;
+module_param(slo_interval_ms, uint, 0444);
+MODULE_PARM_DESC(slo_interval_ms, "Latency SLO watchdog period in ms (default 0 = off)");
+
+static unsigned int slo_p99_us;
+module_param(slo_p99_us, uint, 0644);
+MODULE_PARM_DESC(slo_p99_us, "Alert when p99 read/write/ioctl latency exceeds this many us (0 = off)");
+
+static unsigned int slo_fill_pct;
+module_param(slo_fill_pct, uint, 0644);
+MODULE_PARM_DESC(slo_fill_pct, "Alert when the buffer is at least this many percent full (0 = off)");
+
+static unsigned int slo_blocked_readers;
+module_param(slo_blocked_readers, uint, 0644);
+MODULE_PARM_DESC(slo_blocked_readers, "Alert when this many readers wait for the device (0 = off)");
+
+/*
+ * Write-ahead log: when set, every change is appended to this file and
+ * on disk before the call that made it returns, and the log is replayed
+ * into the instances on load
+ */
+static char *wal_path;
+module_param(wal_path, charp, 0444);
+MODULE_PARM_DESC(wal_path, "Write-ahead log file that makes the contents survive a reload (default none)");
+
+/*
+ * Snapshot file: restored on init if it exists, written on exit. Without
+ * a write-ahead log each instance is read in on its first use, and the
+ * prefetcher reads in the rest, busiest first.
+ */
+static char *snapshot_path;
+module_param(snapshot_path, charp, 0444);
+MODULE_PARM_DESC(snapshot_path, "Snapshot file to restore on load and save on unload (default none)");
+
+static bool snapshot_prefetch = true;
+module_param(snapshot_prefetch, bool, 0444);
+MODULE_PARM_DESC(snapshot_prefetch, "Read in restored instances in the background before first use (default Y)");
+
+/* Changes an asynchronous standby may fall behind by before it is resynced instead */
+static unsigned int mirror_queue_max = 4096;
+module_param(mirror_queue_max, uint, 0644);
+MODULE_PARM_DESC(mirror_queue_max, "Changes queued for an asynchronous mirror before it falls back to a full copy (default 4096)");
+
 static dev_t dev_number;
 static struct class *chardev_class = NULL;
 static struct chardev_data *device_data = NULL;
+static struct dentry *chardev_debugfs;
+
+/* Lock statistics are off until enabled in debugfs; then they cost two clock reads */
+static DEFINE_STATIC_KEY_FALSE(chardev_lock_stats_key);
+
+/* On while the SLO watchdog runs: operations are timed for it */
+static DEFINE_STATIC_KEY_FALSE(chardev_slo_key);
+static struct delayed_work chardev_slo_work;
 
 /*
  * Device open function
@@ -37,8 +230,16 @@ static struct chardev_data *device_data = NULL;
 static int chardev_open(struct inode *inode, struct file *file)
 {
     struct chardev_data *data = container_of(inode->i_cdev, struct chardev_data, cdev);
-    file->private_data = data;
+    struct chardev_file *cf;
+
+    cf = kzalloc(sizeof(*cf), GFP_KERNEL);
+    if (!cf)
+        return -ENOMEM;
+
+    cf->data = data;
+    file->private_data = cf;
     
+    trace_chardev_open(file, iminor(inode));
     pr_info("chardev: Device opened\n");
     return 0;
 }
@@ -48,88 +249,2172 @@ static int chardev_open(struct inode *inode, struct file *file)
  */
 static int chardev_release(struct inode *inode, struct file *file)
 {
+    trace_chardev_release(file, iminor(inode));
+    kfree(file->private_data);
     pr_info("chardev: Device closed\n");
     return 0;
 }
 
 /*
- * Device read function
+ * Offset math shared by read and write (caller holds data->lock)
  */
-static ssize_t chardev_read(struct file *file, char __user *user_buffer, 
-                           size_t count, loff_t *offset)
+
+/* Bytes a read of @count at @pos returns; 0 at or past the end of data */
+static size_t chardev_read_len(const struct chardev_data *data, loff_t pos, size_t count)
+{
+    if (pos >= data->buffer_size)
+        return 0;
+
+    return min(count, data->buffer_size - (size_t)pos);
+}
+
+/* Bytes a write of @count at @pos stores, or -ENOSPC when the buffer is full */
+static ssize_t chardev_write_len(loff_t pos, size_t count)
+{
+    if (pos >= BUFFER_SIZE)
+        return -ENOSPC;
+
+    return min(count, BUFFER_SIZE - (size_t)pos);
+}
+
+/* Grow the data size if a write ended beyond it */
+static void chardev_extend(struct chardev_data *data, loff_t end)
+{
+    if (end > data->buffer_size)
+        WRITE_ONCE(data->buffer_size, end);
+}
+
+/*
+ * Replace the contents and flag of an instance (caller holds data->lock,
+ * or the instance is not live yet). Whatever the snapshot still held for
+ * it is superseded.
+ */
+static void chardev_set_contents(struct chardev_data *data, const void *buf, size_t size,
+                                 int flag)
+{
+    memcpy(data->buffer, buf, size);
+    memset(data->buffer + size, 0, BUFFER_SIZE - size);
+    WRITE_ONCE(data->buffer_size, size);
+    WRITE_ONCE(data->flag, flag);
+    memset(data->enqueue_ns, 0, sizeof(data->enqueue_ns));
+    memset(data->dequeue_ns, 0, sizeof(data->dequeue_ns));
+    WRITE_ONCE(data->restore_pos, 0);
+}
+
+/*
+ * Histograms
+ */
+static void chardev_hist_add(struct chardev_hist *h, u64 ns)
+{
+    h->buckets[min_t(unsigned int, fls64(ns), HIST_BUCKETS - 1)]++;
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+/* Upper bound of the bucket holding the @pct percentile; 0 if empty */
+static u64 chardev_hist_percentile(const struct chardev_hist *h, unsigned int pct)
+{
+    u64 rank, seen = 0;
+    unsigned int i;
+
+    if (!h->count)
+        return 0;
+
+    rank = div64_u64(h->count * pct + 99, 100);
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            break;
+    }
+    return i < 63 ? 1ULL << i : U64_MAX;
+}
+
+static void chardev_hist_show(struct seq_file *m, const struct chardev_hist *h)
+{
+    unsigned int i;
+
+    seq_printf(m, "count: %llu\n", h->count);
+    seq_printf(m, "mean_ns: %llu\n", h->count ? div64_u64(h->sum, h->count) : 0);
+    seq_printf(m, "max_ns: %llu\n", h->max);
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        if (h->buckets[i])
+            seq_printf(m, "< %llu ns: %llu\n", 1ULL << i, h->buckets[i]);
+    }
+}
+
+static void chardev_hist_export(struct chardev_stats_hist *dst, const struct chardev_hist *src)
+{
+    dst->count = src->count;
+    dst->sum = src->sum;
+    dst->max = src->max;
+    memcpy(dst->buckets, src->buckets, sizeof(dst->buckets));
+}
+
+static void chardev_hist_merge(struct chardev_hist *dst, const struct chardev_hist *src)
+{
+    unsigned int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    dst->max = max(dst->max, src->max);
+}
+
+/*
+ * Per-CPU statistics
+ *
+ * Updates go between chardev_stats_begin() and chardev_stats_end(), with
+ * data->lock held. chardev_stats_sum() folds every CPU's copy, each one
+ * consistent in itself, without taking the lock, so monitoring never
+ * holds up the data path.
+ */
+static int chardev_stats_alloc(struct chardev_data *data)
+{
+    int cpu;
+
+    data->stats = alloc_percpu(struct chardev_pcpu_stats);
+    if (!data->stats)
+        return -ENOMEM;
+
+    for_each_possible_cpu(cpu)
+        seqcount_init(&per_cpu_ptr(data->stats, cpu)->seq);
+    return 0;
+}
+
+static void chardev_stats_free(struct chardev_data *data)
+{
+    free_percpu(data->stats);
+    data->stats = NULL;
+}
+
+static struct chardev_pcpu_stats *chardev_stats_begin(struct chardev_data *data)
+{
+    struct chardev_pcpu_stats *s = get_cpu_ptr(data->stats);
+
+    write_seqcount_begin(&s->seq);
+    return s;
+}
+
+static void chardev_stats_end(struct chardev_data *data, struct chardev_pcpu_stats *s)
+{
+    write_seqcount_end(&s->seq);
+    put_cpu_ptr(data->stats);
+}
+
+/* @sum is filled in; @tmp is scratch space for one CPU's copy */
+static void chardev_stats_sum(struct chardev_data *data, struct chardev_pcpu_stats *sum,
+                              struct chardev_pcpu_stats *tmp)
+{
+    const struct chardev_pcpu_stats *s;
+    unsigned int start, op;
+    int cpu;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu) {
+        s = per_cpu_ptr(data->stats, cpu);
+        do {
+            start = read_seqcount_begin(&s->seq);
+            memcpy(tmp, s, sizeof(*tmp));
+        } while (read_seqcount_retry(&s->seq, start));
+
+        sum->reads += tmp->reads;
+        sum->writes += tmp->writes;
+        sum->ioctls += tmp->ioctls;
+        sum->bytes_read += tmp->bytes_read;
+        sum->bytes_written += tmp->bytes_written;
+        chardev_hist_merge(&sum->queue_delay, &tmp->queue_delay);
+        for (op = 0; op < LOCK_OPS; op++) {
+            chardev_hist_merge(&sum->lock_stats.wait[op], &tmp->lock_stats.wait[op]);
+            chardev_hist_merge(&sum->lock_stats.hold[op], &tmp->lock_stats.hold[op]);
+        }
+    }
+}
+
+/* chardev_stats_sum() into a kmalloc'd copy, to be kfree'd; NULL if out of memory */
+static struct chardev_pcpu_stats *chardev_stats_get(struct chardev_data *data)
+{
+    struct chardev_pcpu_stats *sum;
+
+    /* Too big for the stack: the sum and scratch space for one CPU */
+    sum = kmalloc_array(2, sizeof(*sum), GFP_KERNEL);
+    if (sum)
+        chardev_stats_sum(data, sum, sum + 1);
+    return sum;
+}
+
+/*
+ * data->lock with optional wait and hold time statistics
+ *
+ * chardev_lock() returns what mutex_lock_interruptible() does and hands
+ * back the acquisition time for chardev_unlock(), 0 when statistics are
+ * off. Time spent waiting is added to *blocked; with statistics off the
+ * clock is only read when the lock is contended. The histograms are only
+ * touched with the lock held.
+ */
+static int chardev_lock(struct chardev_data *data, enum chardev_lock_op op,
+                        u64 *acquired, u64 *blocked)
+{
+    struct chardev_pcpu_stats *s;
+    u64 t0;
+
+    *acquired = 0;
+    if (!static_branch_unlikely(&chardev_lock_stats_key)) {
+        if (mutex_trylock(&data->lock))
+            return 0;
+
+        t0 = ktime_get_ns();
+        if (mutex_lock_interruptible(&data->lock))
+            return -ERESTARTSYS;
+        *blocked += ktime_get_ns() - t0;
+        return 0;
+    }
+
+    t0 = ktime_get_ns();
+    if (mutex_lock_interruptible(&data->lock))
+        return -ERESTARTSYS;
+
+    *acquired = ktime_get_ns();
+    *blocked += *acquired - t0;
+    s = chardev_stats_begin(data);
+    chardev_hist_add(&s->lock_stats.wait[op], *acquired - t0);
+    chardev_stats_end(data, s);
+    return 0;
+}
+
+static void chardev_unlock(struct chardev_data *data, enum chardev_lock_op op, u64 acquired)
+{
+    struct chardev_pcpu_stats *s;
+
+    /* acquired is 0 if statistics were switched on while we held the lock */
+    if (static_branch_unlikely(&chardev_lock_stats_key) && acquired) {
+        s = chardev_stats_begin(data);
+        chardev_hist_add(&s->lock_stats.hold[op], ktime_get_ns() - acquired);
+        chardev_stats_end(data, s);
+    }
+
+    mutex_unlock(&data->lock);
+}
+
+/*
+ * Operation latency for the SLO watchdog: chardev_slo_start() before
+ * taking the lock, chardev_slo_end() with it still held
+ */
+static u64 chardev_slo_start(void)
+{
+    return static_branch_unlikely(&chardev_slo_key) ? ktime_get_ns() : 0;
+}
+
+static void chardev_slo_end(struct chardev_data *data, u64 start)
+{
+    if (start)
+        chardev_hist_add(&data->slo_window, ktime_get_ns() - start);
+}
+
+/*
+ * Queueing delay (caller holds data->lock)
+ *
+ * Each write stamps the blocks it touches; the first read of a block after
+ * that records how long the data sat in the device.
+ */
+static void chardev_stamp_write(struct chardev_data *data, loff_t pos, size_t len)
+{
+    u64 now = ktime_get_ns();
+    size_t i;
+
+    if (len == 0)
+        return;
+
+    for (i = pos / STAMP_BLOCK; i <= (pos + len - 1) / STAMP_BLOCK; i++) {
+        data->enqueue_ns[i] = now;
+        data->dequeue_ns[i] = 0;
+    }
+}
+
+static void chardev_stamp_read(struct chardev_data *data, loff_t pos, size_t len)
+{
+    struct chardev_pcpu_stats *s;
+    u64 now = ktime_get_ns();
+    size_t i;
+
+    if (len == 0)
+        return;
+
+    s = chardev_stats_begin(data);
+    for (i = pos / STAMP_BLOCK; i <= (pos + len - 1) / STAMP_BLOCK; i++) {
+        if (data->enqueue_ns[i] && !data->dequeue_ns[i]) {
+            data->dequeue_ns[i] = now;
+            chardev_hist_add(&s->queue_delay, now - data->enqueue_ns[i]);
+        }
+    }
+    chardev_stats_end(data, s);
+}
+
+/*
+ * Record ring
+ *
+ * Layout and protocol are described in chardev_uapi.h. Producers hold
+ * data->lock; the only other party is the consumer in userspace, which
+ * owns ctrl->tail. The release store of head publishes the record bytes,
+ * the acquire load of tail makes sure the consumer is done with the space
+ * it gave back before it is overwritten.
+ *
+ * The control page is mapped writable, so the geometry, head and drop
+ * count are kept in chardev_data and only ever stored to the page, never
+ * read back from it. tail is the one value taken from there.
+ */
+static int chardev_ring_alloc(struct chardev_data *data, unsigned int pages)
+{
+    struct chardev_ring_ctrl *ctrl;
+
+    ctrl = vmalloc_user(PAGE_SIZE + (size_t)pages * PAGE_SIZE);
+    if (!ctrl)
+        return -ENOMEM;
+
+    ctrl->version = CHARDEV_RING_VERSION;
+    ctrl->ctrl_size = PAGE_SIZE;
+    ctrl->data_size = pages * PAGE_SIZE;
+    data->ring = ctrl;
+    data->ring_data = (char *)ctrl + PAGE_SIZE;
+    data->ring_size = pages * PAGE_SIZE;
+    data->ring_head = 0;
+    WRITE_ONCE(data->ring_dropped, 0);
+    return 0;
+}
+
+static void chardev_ring_free(struct chardev_data *data)
+{
+    vfree(data->ring);
+    data->ring = NULL;
+    data->ring_data = NULL;
+}
+
+/* Copy @len bytes to ring position @pos, wrapping at the end of the data area */
+static void chardev_ring_copy(struct chardev_data *data, u64 pos,
+                              const void *src, size_t len)
+{
+    size_t off = pos & (data->ring_size - 1);
+    size_t first = min_t(size_t, len, data->ring_size - off);
+
+    memcpy(data->ring_data + off, src, first);
+    memcpy(data->ring_data, (const char *)src + first, len - first);
+}
+
+/*
+ * Append one record (caller holds data->lock); false if it was dropped.
+ * Dropped records still take a sequence number so readers see the gap.
+ */
+static bool chardev_ring_append(struct chardev_data *data, u16 type, u16 flags,
+                                const void *payload, u32 len)
+{
+    struct chardev_ring_ctrl *ctrl = data->ring;
+    struct chardev_ring_record rec;
+    u64 head, tail, used, size;
+
+    if (!ctrl)
+        return false;
+
+    rec.len = len;
+    rec.type = type;
+    rec.flags = flags;
+    rec.ktime_ns = ktime_get_ns();
+    rec.seq = data->ring_seq;
+    WRITE_ONCE(data->ring_seq, rec.seq + 1);
+
+    head = data->ring_head;
+    tail = smp_load_acquire(&ctrl->tail);
+    used = head - tail;
+    size = CHARDEV_RING_RECORD_SIZE(len);
+
+    /* A tail from the future means a confused consumer: drop, do not trust it */
+    if (used > data->ring_size || size > data->ring_size - used) {
+        WRITE_ONCE(data->ring_dropped, data->ring_dropped + 1);
+        WRITE_ONCE(ctrl->dropped, data->ring_dropped);
+        return false;
+    }
+
+    chardev_ring_copy(data, head, &rec, sizeof(rec));
+    chardev_ring_copy(data, head + sizeof(rec), payload, len);
+    data->ring_head = head + size;
+    smp_store_release(&ctrl->head, data->ring_head);
+    return true;
+}
+
+/*
+ * Write-ahead log
+ *
+ * Every change is appended as one record with data->lock held, so each
+ * instance's records follow the order its changes were applied in. The
+ * writer then lets go of the lock and waits in chardev_wal_sync() for its
+ * record to reach the disk. The first one there fsyncs all that has been
+ * appended so far; those queued behind it on sync_lock find their records
+ * already covered and return, so a burst of concurrent writers shares one
+ * fsync rather than paying for one each.
+ *
+ * After a failed write or fsync the log takes no more records and every
+ * change fails with that error: it is in memory but will not survive a
+ * reload. Records whole in the log before a failed write are still synced
+ * for the changes they belong to.
+ */
+#define WAL_MAGIC 0x4c415743    /* "CWAL", host byte order */
+
+enum chardev_wal_type {
+    WAL_WRITE = 1,              /* payload stored at offset arg */
+    WAL_RESET,
+    WAL_FLAG,                   /* flag set to arg */
+    WAL_IMAGE,                  /* contents replaced by the payload, flag set to arg */
+};
+
+/* Record header, followed by len bytes of payload */
+struct chardev_wal_record {
+    u32 magic;
+    u32 crc;                    /* crc32 of the rest of the header and the payload */
+    u32 len;
+    u16 minor;
+    u16 type;
+    u64 arg;
+};
+
+struct chardev_wal {
+    struct file *file;          /* NULL if off */
+    struct mutex lock;          /* appends: pos, error, buf, records, bytes */
+    struct mutex sync_lock;     /* one fsync at a time */
+    loff_t pos;                 /* end of the log */
+    loff_t synced;              /* all before this is on disk */
+    loff_t intact;              /* after a failed append: records before it are whole */
+    int error;
+    char *buf;                  /* the record being appended */
+    u64 records;
+    u64 bytes;
+    u64 syncs;
+    u64 replayed;
+};
+
+static struct chardev_wal chardev_wal;
+
+static u32 chardev_wal_crc(const struct chardev_wal_record *rec, const void *payload)
+{
+    u32 crc;
+
+    crc = crc32_le(~0, (const u8 *)&rec->len,
+                   sizeof(*rec) - offsetof(struct chardev_wal_record, len));
+    return crc32_le(crc, payload, rec->len);
+}
+
+/*
+ * Append one record (caller holds data->lock). Returns the log position
+ * to hand to chardev_wal_sync() once the lock is dropped, 0 if the log is
+ * off, or an error.
+ */
+static loff_t chardev_wal_append(struct chardev_data *data, u16 type, u64 arg,
+                                 const void *payload, u32 len)
+{
+    struct chardev_wal *wal = &chardev_wal;
+    struct chardev_wal_record *rec;
+    size_t size = sizeof(*rec) + len;
+    ssize_t n;
+    loff_t ret;
+
+    if (!wal->file)
+        return 0;
+
+    mutex_lock(&wal->lock);
+    if (wal->error) {
+        ret = wal->error;
+        goto out;
+    }
+
+    rec = (struct chardev_wal_record *)wal->buf;
+    rec->magic = WAL_MAGIC;
+    rec->len = len;
+    rec->minor = data - device_data;
+    rec->type = type;
+    rec->arg = arg;
+    if (len)
+        memcpy(rec + 1, payload, len);
+    rec->crc = chardev_wal_crc(rec, rec + 1);
+
+    /* A short write leaves a torn record behind, where replay will stop */
+    ret = wal->pos;
+    n = kernel_write(wal->file, wal->buf, size, &wal->pos);
+    if (n != size) {
+        wal->intact = ret;
+        wal->error = n < 0 ? n : -EIO;
+        ret = wal->error;
+        goto out;
+    }
+
+    wal->records++;
+    wal->bytes += size;
+    ret = wal->pos;
+out:
+    mutex_unlock(&wal->lock);
+    return ret;
+}
+
+/*
+ * Wait until the log is on disk up to @lsn from chardev_wal_append(),
+ * without data->lock held. 0 and errors from the append pass through.
+ */
+static int chardev_wal_sync(loff_t lsn)
+{
+    struct chardev_wal *wal = &chardev_wal;
+    loff_t end;
+    int ret = 0;
+
+    if (lsn <= 0)
+        return lsn;
+    if (READ_ONCE(wal->synced) >= lsn)
+        return 0;
+
+    mutex_lock(&wal->sync_lock);
+
+    /* The fsync we queued behind may have covered us */
+    if (wal->synced < lsn) {
+        mutex_lock(&wal->lock);
+        end = wal->pos;
+        ret = wal->error;
+        /* Records appended before a failed one can still be made durable */
+        if (ret && lsn <= wal->intact) {
+            end = wal->intact;
+            ret = 0;
+        }
+        mutex_unlock(&wal->lock);
+
+        if (!ret)
+            ret = vfs_fsync(wal->file, 1);
+        if (ret) {
+            mutex_lock(&wal->lock);
+            if (!wal->error)
+                wal->error = ret;
+            wal->intact = 0;
+            mutex_unlock(&wal->lock);
+        } else {
+            WRITE_ONCE(wal->synced, end);
+            WRITE_ONCE(wal->syncs, wal->syncs + 1);
+        }
+    }
+
+    mutex_unlock(&wal->sync_lock);
+    return ret;
+}
+
+/* Redo one logged or mirrored change; -EINVAL if the record makes no sense */
+static int chardev_wal_apply(struct chardev_data *data, const struct chardev_wal_record *rec,
+                             const void *payload)
+{
+    switch (rec->type) {
+        case WAL_WRITE:
+            if (rec->arg >= BUFFER_SIZE || rec->len > BUFFER_SIZE - rec->arg)
+                return -EINVAL;
+            memcpy(data->buffer + rec->arg, payload, rec->len);
+            chardev_extend(data, rec->arg + rec->len);
+            return 0;
+
+        case WAL_RESET:
+            memset(data->buffer, 0, BUFFER_SIZE);
+            WRITE_ONCE(data->buffer_size, 0);
+            WRITE_ONCE(data->flag, 0);
+            return 0;
+
+        case WAL_FLAG:
+            WRITE_ONCE(data->flag, (int)(u32)rec->arg);
+            return 0;
+
+        case WAL_IMAGE:
+            chardev_set_contents(data, payload, rec->len, (int)(u32)rec->arg);
+            return 0;
+
+        default:
+            return -EINVAL;
+    }
+}
+
+/*
+ * Replay the log into device_data before the instances go live. Stops at
+ * the end of the file or at the first torn or corrupt record, and cuts
+ * the log off there so new records follow the last good one. Records for
+ * instances beyond num_devices are kept but not applied.
+ */
+static int chardev_wal_replay(struct chardev_wal *wal)
+{
+    struct chardev_wal_record *rec = (struct chardev_wal_record *)wal->buf;
+    bool damaged = false;
+    loff_t pos = 0, next;
+    ssize_t n;
+    int ret;
+
+    for (;;) {
+        next = pos;
+        n = kernel_read(wal->file, rec, sizeof(*rec), &next);
+        if (n <= 0)
+            break;
+
+        damaged = true;
+        if (n != sizeof(*rec) || rec->magic != WAL_MAGIC || rec->len > BUFFER_SIZE)
+            break;
+
+        n = kernel_read(wal->file, rec + 1, rec->len, &next);
+        if (n < 0)
+            break;
+        if (n != rec->len || chardev_wal_crc(rec, rec + 1) != rec->crc)
+            break;
+
+        if (rec->minor < num_devices &&
+            chardev_wal_apply(&device_data[rec->minor], rec, rec + 1))
+            break;
+
+        damaged = false;
+        wal->replayed++;
+        pos = next;
+    }
+    if (n < 0)
+        return n;
+
+    if (damaged) {
+        pr_warn("chardev: Write-ahead log damaged at %lld, dropping the rest\n",
+                (long long)pos);
+        ret = vfs_truncate(&wal->file->f_path, pos);
+        if (!ret)
+            ret = vfs_fsync(wal->file, 1);
+        if (ret)
+            return ret;
+    }
+
+    wal->pos = pos;
+    wal->synced = pos;
+    return 0;
+}
+
+/*
+ * The snapshot just saved at unload holds every logged change, so the
+ * log starts over and the next load does not replay history the snapshot
+ * already has. A crash before the truncate only means replaying the log
+ * over that snapshot, which redoes changes it already holds, in order.
+ */
+static void chardev_wal_checkpoint(void)
+{
+    struct chardev_wal *wal = &chardev_wal;
+    int ret;
+
+    if (!wal->file)
+        return;
+
+    mutex_lock(&wal->lock);
+    ret = vfs_truncate(&wal->file->f_path, 0);
+    if (!ret)
+        ret = vfs_fsync(wal->file, 1);
+    if (ret) {
+        pr_warn("chardev: Failed to truncate write-ahead log %s (%d)\n", wal_path, ret);
+    } else {
+        wal->pos = 0;
+        wal->synced = 0;
+    }
+    mutex_unlock(&wal->lock);
+}
+
+static void chardev_wal_close(void)
+{
+    struct chardev_wal *wal = &chardev_wal;
+
+    if (!wal->file)
+        return;
+
+    filp_close(wal->file, NULL);
+    kfree(wal->buf);
+    memset(wal, 0, sizeof(*wal));
+}
+
+static int chardev_wal_open(void)
+{
+    struct chardev_wal *wal = &chardev_wal;
+    struct file *file;
+    int ret;
+
+    if (!wal_path || !*wal_path)
+        return 0;
+
+    mutex_init(&wal->lock);
+    mutex_init(&wal->sync_lock);
+    wal->buf = kmalloc(sizeof(struct chardev_wal_record) + BUFFER_SIZE, GFP_KERNEL);
+    if (!wal->buf)
+        return -ENOMEM;
+
+    file = filp_open(wal_path, O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+    if (IS_ERR(file)) {
+        pr_err("chardev: Failed to open write-ahead log %s\n", wal_path);
+        kfree(wal->buf);
+        wal->buf = NULL;
+        return PTR_ERR(file);
+    }
+    wal->file = file;
+
+    ret = chardev_wal_replay(wal);
+    if (ret < 0) {
+        pr_err("chardev: Failed to replay write-ahead log %s\n", wal_path);
+        chardev_wal_close();
+        return ret;
+    }
+
+    pr_info("chardev: Write-ahead log %s: %llu records replayed\n",
+            wal_path, wal->replayed);
+    return 0;
+}
+
+/*
+ * Mirroring
+ *
+ * A primary instance sends every change to its standby as the record the
+ * write-ahead log would hold, and the standby redoes it with
+ * chardev_wal_apply(). Synchronously, that happens under both locks
+ * before the change returns. Asynchronously, records are queued and a
+ * kernel thread per pair applies them in order, a batch under one
+ * standby lock. If the queue would outgrow mirror_queue_max, or a record
+ * cannot be allocated, the queue is dropped and the thread copies the
+ * whole primary instead.
+ *
+ * Where both are held, the primary's lock is always taken first and the
+ * standby's nested inside it, at CHARDEV_LOCK_STANDBY. The order cannot
+ * invert: under chardev_link_mutex a standby is refused as a primary and
+ * a primary as a standby, so no instance is ever on both sides and A and
+ * B cannot mirror to each other. Nor can a standby be in a tee, which
+ * takes sink locks above it.
+ */
+struct chardev_mirror_op {
+    struct list_head node;
+    u64 queued_ns;
+    struct chardev_wal_record rec;
+    char payload[];
+};
+
+struct chardev_mirror {
+    struct chardev_data *primary;
+    struct chardev_data *standby;
+    u32 mode;                           /* CHARDEV_MIRROR_SYNC or _ASYNC */
+    struct task_struct *thread;         /* applies the queue; NULL if synchronous */
+    wait_queue_head_t wait;             /* the thread for work, others for it to catch up */
+    spinlock_t lock;                    /* everything below */
+    struct list_head queue;
+    bool resync;                        /* copy the whole primary next */
+    u64 queued;
+    u64 applied;
+    u64 pending_bytes;
+    u64 behind_ns;                      /* when the oldest change not applied was made */
+    u64 max_lag_ns;
+    u64 resyncs;
+};
+
+/*
+ * Mirror pairs and tees are made and broken under this, so it also keeps
+ * a pair alive to report on
+ */
+static DEFINE_MUTEX(chardev_link_mutex);
+
+/* Whether some instance tees to @data (caller holds chardev_link_mutex) */
+static bool chardev_tee_sink(struct chardev_data *data)
+{
+    unsigned int i;
+
+    for (i = 0; i < num_devices; i++) {
+        if (device_data[i].tee_sinks & BIT_ULL(data - device_data))
+            return true;
+    }
+    return false;
+}
+
+static bool chardev_mirror_busy(struct chardev_mirror *m)
+{
+    bool busy;
+
+    spin_lock(&m->lock);
+    busy = !list_empty(&m->queue) || m->resync;
+    spin_unlock(&m->lock);
+    return busy;
+}
+
+static bool chardev_mirror_caught_up(struct chardev_mirror *m)
+{
+    bool done;
+
+    spin_lock(&m->lock);
+    done = m->applied == m->queued;
+    spin_unlock(&m->lock);
+    return done;
+}
+
+/*
+ * Send one change to the standby, if there is one (caller holds the
+ * primary's data->lock and has made the change). Never fails: what
+ * cannot be queued is made up for by a resync.
+ */
+static void chardev_mirror_record(struct chardev_data *data, u16 type, u64 arg,
+                                  const void *payload, u32 len)
+{
+    struct chardev_mirror *m = data->mirror;
+    struct chardev_wal_record rec = { .len = len, .type = type, .arg = arg };
+    struct chardev_mirror_op *op, *tmp;
+    LIST_HEAD(dropped);
+    u64 now;
+
+    if (likely(!m))
+        return;
+
+    if (m->mode == CHARDEV_MIRROR_SYNC) {
+        mutex_lock_nested(&m->standby->lock, CHARDEV_LOCK_STANDBY);
+        chardev_wal_apply(m->standby, &rec, payload);
+        mutex_unlock(&m->standby->lock);
+
+        spin_lock(&m->lock);
+        m->queued++;
+        m->applied++;
+        spin_unlock(&m->lock);
+        return;
+    }
+
+    now = ktime_get_ns();
+    op = kmalloc(sizeof(*op) + len, GFP_KERNEL);
+    if (op) {
+        op->queued_ns = now;
+        op->rec = rec;
+        if (len)
+            memcpy(op->payload, payload, len);
+    }
+
+    spin_lock(&m->lock);
+    if (m->applied == m->queued)
+        m->behind_ns = now;
+    m->queued++;
+    if (op && !m->resync && m->queued - m->applied <= READ_ONCE(mirror_queue_max)) {
+        list_add_tail(&op->node, &m->queue);
+        m->pending_bytes += len;
+        op = NULL;
+    } else if (!m->resync) {
+        /* Too far behind to replay: the whole primary goes over next */
+        list_splice_tail_init(&m->queue, &dropped);
+        m->pending_bytes = 0;
+        m->resync = true;
+    }
+    spin_unlock(&m->lock);
+    kfree(op);
+
+    list_for_each_entry_safe(op, tmp, &dropped, node)
+        kfree(op);
+    wake_up(&m->wait);
+}
+
+/* Copy the whole primary, which covers every change sent so far */
+static void chardev_mirror_resync(struct chardev_mirror *m)
+{
+    struct chardev_data *primary = m->primary, *standby = m->standby;
+
+    mutex_lock(&primary->lock);
+    mutex_lock_nested(&standby->lock, CHARDEV_LOCK_STANDBY);
+    chardev_set_contents(standby, primary->buffer, primary->buffer_size, primary->flag);
+    mutex_unlock(&standby->lock);
+
+    spin_lock(&m->lock);
+    m->resync = false;
+    m->applied = m->queued;
+    m->max_lag_ns = max(m->max_lag_ns, ktime_get_ns() - m->behind_ns);
+    m->behind_ns = 0;
+    m->resyncs++;
+    spin_unlock(&m->lock);
+    mutex_unlock(&primary->lock);
+}
+
+/* Apply everything queued so far, or resync; the mirror thread's work */
+static void chardev_mirror_drain(struct chardev_mirror *m)
+{
+    struct chardev_mirror_op *op, *tmp;
+    u64 n = 0, lag = 0;
+    LIST_HEAD(batch);
+    bool resync;
+
+    spin_lock(&m->lock);
+    resync = m->resync;
+    list_splice_tail_init(&m->queue, &batch);
+    m->pending_bytes = 0;
+    spin_unlock(&m->lock);
+
+    if (resync) {
+        chardev_mirror_resync(m);
+        goto out;
+    }
+    if (list_empty(&batch))
+        return;
+
+    mutex_lock(&m->standby->lock);
+    list_for_each_entry_safe(op, tmp, &batch, node) {
+        chardev_wal_apply(m->standby, &op->rec, op->payload);
+        lag = max(lag, ktime_get_ns() - op->queued_ns);
+        n++;
+        list_del(&op->node);
+        kfree(op);
+    }
+    mutex_unlock(&m->standby->lock);
+
+    spin_lock(&m->lock);
+    m->applied += n;
+    m->max_lag_ns = max(m->max_lag_ns, lag);
+    if (m->applied == m->queued)
+        m->behind_ns = 0;
+    else if (!list_empty(&m->queue))
+        m->behind_ns = list_first_entry(&m->queue, struct chardev_mirror_op, node)->queued_ns;
+    spin_unlock(&m->lock);
+out:
+    wake_up(&m->wait);
+}
+
+static int chardev_mirror_thread_fn(void *arg)
+{
+    struct chardev_mirror *m = arg;
+
+    while (!kthread_should_stop()) {
+        wait_event_interruptible(m->wait, chardev_mirror_busy(m) || kthread_should_stop());
+        chardev_mirror_drain(m);
+    }
+    return 0;
+}
+
+/*
+ * Break up a pair (caller holds chardev_link_mutex). Nothing new is
+ * sent once the primary lets go, and the standby is let go once it has
+ * applied the rest, so it ends up exactly as the primary was.
+ */
+static void chardev_mirror_stop(struct chardev_data *primary)
+{
+    struct chardev_mirror *m = primary->mirror;
+
+    mutex_lock(&primary->lock);
+    primary->mirror = NULL;
+    mutex_unlock(&primary->lock);
+
+    if (m->thread) {
+        wait_event(m->wait, chardev_mirror_caught_up(m));
+        kthread_stop(m->thread);
+    }
+
+    mutex_lock(&m->standby->lock);
+    m->standby->mirror_of = NULL;
+    mutex_unlock(&m->standby->lock);
+
+    pr_info("chardev: Instance %td no longer mirrors to %td\n",
+            primary - device_data, m->standby - device_data);
+    kfree(m);
+}
+
+/* EROFS for changes made to a standby directly (caller holds data->lock) */
+static int chardev_mirror_writable(struct chardev_data *data)
+{
+    return data->mirror_of ? -EROFS : 0;
+}
+
+/*
+ * Snapshots
+ *
+ * Every instance goes to one file in the layout described in
+ * chardev_uapi.h. Each instance is copied out under its own lock and
+ * nothing else is: compression, the one large write and the fsync run
+ * with every device still serving, and the snapshot is consistent per
+ * instance rather than across them. IOCTL_LOAD checks the whole file
+ * before it changes any instance.
+ *
+ * Restoring at init only reads the entry headers: each instance gets its
+ * size and flag at once and remembers where its data lies, and the data
+ * is read in by chardev_restore() on the first operation that takes the
+ * instance lock, or earlier by the prefetcher. Devices are up after a
+ * few small reads, however big the file.
+ */
+#define SNAPSHOT_ENTRY_MAX \
+    ALIGN(sizeof(struct chardev_snapshot_instance) + LZ4_COMPRESSBOUND(BUFFER_SIZE), \
+          CHARDEV_SNAPSHOT_ALIGN)
+#define SNAPSHOT_MAX (sizeof(struct chardev_snapshot_header) + MAX_DEVICES * SNAPSHOT_ENTRY_MAX)
+
+/* One instance as read from a snapshot */
+struct chardev_snapshot_entry {
+    bool present;
+    int flag;
+    u32 size;
+    char data[BUFFER_SIZE];
+};
+
+/* The file lazily restored instances are read from; NULL once all are in */
+static struct file *chardev_restore_file;
+static struct delayed_work chardev_prefetch_work;
+static atomic_t chardev_restore_faulted;
+static atomic_t chardev_restore_prefetched;
+
+/*
+ * Reads and writes an instance has served, counting those recorded in the
+ * snapshot it was restored from. Its live counts are folded in when it is
+ * destroyed, so the snapshot saved on exit still has them.
+ */
+static int chardev_snapshot_accesses(struct chardev_data *data, u32 *accesses)
+{
+    struct chardev_pcpu_stats *sum;
+    u64 n = data->restore.accesses;
+
+    if (data->stats) {
+        sum = chardev_stats_get(data);
+        if (!sum)
+            return -ENOMEM;
+        n += sum->reads + sum->writes;
+        kfree(sum);
+    }
+    *accesses = min_t(u64, n, U32_MAX);
+    return 0;
+}
+
+/* Sanity of an entry header, before its data is touched */
+static bool chardev_snapshot_inst_ok(const struct chardev_snapshot_instance *inst)
+{
+    return inst->size <= BUFFER_SIZE && inst->stored <= inst->size;
+}
+
+/* Data of @inst from the @stored bytes that followed it, checked against its CRC */
+static int chardev_snapshot_unpack(const struct chardev_snapshot_instance *inst,
+                                   const char *stored, char *out)
+{
+    int n;
+
+    if (inst->stored == inst->size) {
+        memcpy(out, stored, inst->size);
+    } else {
+        n = LZ4_decompress_safe(stored, out, inst->stored, BUFFER_SIZE);
+        if (n != inst->size)
+            return -EBADMSG;
+    }
+
+    if (crc32_le(~0, (u8 *)out, inst->size) != inst->crc)
+        return -EBADMSG;
+    return 0;
+}
+
+/*
+ * Read in an instance's data if it is still waiting in the snapshot
+ * (caller holds data->lock). One that cannot be read or does not check
+ * out is left empty, as a damaged file at init would leave it.
+ */
+static void chardev_restore(struct chardev_data *data, bool prefetch)
+{
+    const struct chardev_snapshot_instance *inst = &data->restore;
+    loff_t pos = data->restore_pos;
+    char *buf, *stored;
+    ssize_t n;
+    int ret = -ENOMEM;
+
+    if (likely(!pos))
+        return;
+
+    buf = kmalloc(BUFFER_SIZE + LZ4_COMPRESSBOUND(BUFFER_SIZE), GFP_KERNEL);
+    if (buf) {
+        stored = buf + BUFFER_SIZE;
+        n = kernel_read(chardev_restore_file, stored, inst->stored, &pos);
+        if (n < 0)
+            ret = n;
+        else if (n != inst->stored)
+            ret = -EINVAL;
+        else
+            ret = chardev_snapshot_unpack(inst, stored, buf);
+    }
+
+    if (ret) {
+        pr_err("chardev: Failed to restore instance %u from %s (%d)\n",
+               inst->minor, snapshot_path, ret);
+        chardev_set_contents(data, "", 0, 0);
+    } else {
+        chardev_set_contents(data, buf, inst->size, inst->flag);
+    }
+    kfree(buf);
+
+    atomic_inc(prefetch ? &chardev_restore_prefetched : &chardev_restore_faulted);
+}
+
+static int chardev_snapshot_save(const char *path, u32 flags)
+{
+    struct chardev_snapshot_header *hdr;
+    struct chardev_snapshot_instance *inst;
+    struct chardev_data *data;
+    char *image, *p, *copy;
+    void *wrkmem = NULL;
+    struct file *file;
+    loff_t pos = 0;
+    unsigned int i;
+    ssize_t n;
+    int ret = 0;
+    int stored;
+
+    if (flags & ~CHARDEV_SNAPSHOT_LZ4)
+        return -EINVAL;
+
+    image = vzalloc(SNAPSHOT_MAX);
+    copy = kmalloc(BUFFER_SIZE, GFP_KERNEL);
+    if ((flags & CHARDEV_SNAPSHOT_LZ4))
+        wrkmem = vmalloc(LZ4_MEM_COMPRESS);
+    if (!image || !copy || ((flags & CHARDEV_SNAPSHOT_LZ4) && !wrkmem)) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    hdr = (struct chardev_snapshot_header *)image;
+    hdr->magic = CHARDEV_SNAPSHOT_MAGIC;
+    hdr->version = CHARDEV_SNAPSHOT_VERSION;
+    hdr->flags = flags;
+    hdr->instances = num_devices;
+    hdr->buffer_size = BUFFER_SIZE;
+    hdr->realtime_ns = ktime_get_real_ns();
+    p = (char *)(hdr + 1);
+
+    for (i = 0; i < num_devices; i++) {
+        data = &device_data[i];
+        inst = (struct chardev_snapshot_instance *)p;
+
+        /* Busy instances are prefetched first after the next restore */
+        ret = chardev_snapshot_accesses(data, &inst->accesses);
+        if (ret)
+            goto out;
+
+        if (mutex_lock_interruptible(&data->lock)) {
+            ret = -ERESTARTSYS;
+            goto out;
+        }
+        chardev_restore(data, false);
+        inst->size = data->buffer_size;
+        inst->flag = data->flag;
+        memcpy(copy, data->buffer, inst->size);
+        mutex_unlock(&data->lock);
+
+        inst->minor = i;
+        inst->crc = crc32_le(~0, (u8 *)copy, inst->size);
+        p += sizeof(*inst);
+
+        /* Stored as is when compression is off or does not pay */
+        stored = 0;
+        if (wrkmem && inst->size)
+            stored = LZ4_compress_default(copy, p, inst->size,
+                                          LZ4_COMPRESSBOUND(BUFFER_SIZE), wrkmem);
+        if (stored <= 0 || stored >= inst->size) {
+            memcpy(p, copy, inst->size);
+            stored = inst->size;
+        }
+        inst->stored = stored;
+        p += ALIGN(stored, CHARDEV_SNAPSHOT_ALIGN);
+    }
+
+    file = filp_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0600);
+    if (IS_ERR(file)) {
+        ret = PTR_ERR(file);
+        goto out;
+    }
+
+    n = kernel_write(file, image, p - image, &pos);
+    if (n != p - image)
+        ret = n < 0 ? n : -EIO;
+    else
+        ret = vfs_fsync(file, 0);
+    filp_close(file, NULL);
+
+    if (!ret)
+        pr_info("chardev: Saved %u instance(s) to %s, %lld bytes\n",
+                num_devices, path, (long long)pos);
+
+out:
+    vfree(wrkmem);
+    kfree(copy);
+    vfree(image);
+    return ret;
+}
+
+/*
+ * Check and unpack a snapshot image into @entries, one per instance.
+ * Instances the file has beyond num_devices are skipped.
+ */
+static int chardev_snapshot_parse(const char *image, size_t len,
+                                  struct chardev_snapshot_entry *entries)
+{
+    const struct chardev_snapshot_header *hdr = (const void *)image;
+    const struct chardev_snapshot_instance *inst;
+    const char *p = image + sizeof(*hdr), *end = image + len;
+    struct chardev_snapshot_entry *e;
+    unsigned int i;
+    int ret;
+
+    if (len < sizeof(*hdr) || hdr->magic != CHARDEV_SNAPSHOT_MAGIC)
+        return -EINVAL;
+    if (hdr->version < 1 || hdr->version > CHARDEV_SNAPSHOT_VERSION ||
+        hdr->instances > MAX_DEVICES)
+        return -EINVAL;
+
+    for (i = 0; i < hdr->instances; i++) {
+        inst = (const struct chardev_snapshot_instance *)p;
+        if (end - p < sizeof(*inst))
+            return -EINVAL;
+        p += sizeof(*inst);
+
+        if (!chardev_snapshot_inst_ok(inst) || end - p < inst->stored)
+            return -EINVAL;
+        if (inst->minor >= num_devices) {
+            p += ALIGN(inst->stored, CHARDEV_SNAPSHOT_ALIGN);
+            continue;
+        }
+
+        e = &entries[inst->minor];
+        ret = chardev_snapshot_unpack(inst, p, e->data);
+        if (ret)
+            return ret;
+
+        e->present = true;
+        e->flag = inst->flag;
+        e->size = inst->size;
+        p += ALIGN(inst->stored, CHARDEV_SNAPSHOT_ALIGN);
+    }
+    return 0;
+}
+
+/*
+ * Restore the instances a snapshot holds. Before the devices exist
+ * (@live false) they are filled in directly; afterwards each one is
+ * replaced under its lock and, with the write-ahead log on, logged.
+ */
+static int chardev_snapshot_load(const char *path, bool live)
+{
+    struct chardev_snapshot_entry *entries;
+    struct chardev_data *data;
+    loff_t pos = 0, lsn = 0, logged;
+    struct file *file;
+    unsigned int i;
+    char *image;
+    ssize_t n;
+    int ret, err;
+
+    image = vmalloc(SNAPSHOT_MAX);
+    entries = vzalloc(num_devices * sizeof(*entries));
+    if (!image || !entries) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    file = filp_open(path, O_RDONLY | O_LARGEFILE, 0);
+    if (IS_ERR(file)) {
+        ret = PTR_ERR(file);
+        goto out;
+    }
+
+    /* In as few large reads as the file system allows */
+    do {
+        n = kernel_read(file, image + pos, SNAPSHOT_MAX - pos, &pos);
+    } while (n > 0 && pos < SNAPSHOT_MAX);
+    filp_close(file, NULL);
+    if (n < 0) {
+        ret = n;
+        goto out;
+    }
+    if (pos == SNAPSHOT_MAX) {
+        ret = -EFBIG;
+        goto out;
+    }
+
+    ret = chardev_snapshot_parse(image, pos, entries);
+    if (ret)
+        goto out;
+
+    for (i = 0; i < num_devices; i++) {
+        if (!entries[i].present)
+            continue;
+        data = &device_data[i];
+
+        if (!live) {
+            chardev_set_contents(data, entries[i].data, entries[i].size, entries[i].flag);
+            continue;
+        }
+
+        if (mutex_lock_interruptible(&data->lock)) {
+            ret = -ERESTARTSYS;
+            break;
+        }
+
+        /* A standby gets its primary's image instead */
+        if (data->mirror_of) {
+            mutex_unlock(&data->lock);
+            continue;
+        }
+
+        logged = chardev_wal_append(data, WAL_IMAGE, (u32)entries[i].flag,
+                                    entries[i].data, entries[i].size);
+        if (logged < 0) {
+            mutex_unlock(&data->lock);
+            ret = logged;
+            break;
+        }
+        if (logged)
+            lsn = logged;
+        chardev_set_contents(data, entries[i].data, entries[i].size, entries[i].flag);
+        chardev_mirror_record(data, WAL_IMAGE, (u32)entries[i].flag,
+                              entries[i].data, entries[i].size);
+        mutex_unlock(&data->lock);
+    }
+
+    /* Whatever was replaced must be as durable as a write */
+    err = chardev_wal_sync(lsn);
+    if (!ret)
+        ret = err;
+
+    if (!ret)
+        pr_info("chardev: Loaded snapshot %s\n", path);
+
+out:
+    vfree(entries);
+    vfree(image);
+    return ret;
+}
+
+/*
+ * Restore at init, before the devices exist: take each instance's entry
+ * header, its size and flag, and leave the data for later. The file stays
+ * open until every instance has been read in.
+ */
+static int chardev_restore_open(const char *path)
+{
+    struct chardev_snapshot_header hdr;
+    struct chardev_snapshot_instance inst;
+    struct chardev_data *data;
+    unsigned int i, pending = 0;
+    struct file *file;
+    loff_t pos = 0;
+    ssize_t n;
+    int ret = 0;
+
+    atomic_set(&chardev_restore_faulted, 0);
+    atomic_set(&chardev_restore_prefetched, 0);
+
+    file = filp_open(path, O_RDONLY | O_LARGEFILE, 0);
+    if (IS_ERR(file))
+        return PTR_ERR(file);
+
+    n = kernel_read(file, &hdr, sizeof(hdr), &pos);
+    if (n != sizeof(hdr) || hdr.magic != CHARDEV_SNAPSHOT_MAGIC ||
+        hdr.version < 1 || hdr.version > CHARDEV_SNAPSHOT_VERSION ||
+        hdr.instances > MAX_DEVICES) {
+        ret = n < 0 ? n : -EINVAL;
+        goto out;
+    }
+
+    for (i = 0; i < hdr.instances; i++) {
+        n = kernel_read(file, &inst, sizeof(inst), &pos);
+        if (n != sizeof(inst) || !chardev_snapshot_inst_ok(&inst)) {
+            ret = n < 0 ? n : -EINVAL;
+            goto out;
+        }
+        if (inst.minor < num_devices && !device_data[inst.minor].restore_pos) {
+            data = &device_data[inst.minor];
+            data->restore = inst;
+            data->restore_pos = pos;
+            data->buffer_size = inst.size;
+            data->flag = inst.flag;
+        }
+        pos += ALIGN(inst.stored, CHARDEV_SNAPSHOT_ALIGN);
+    }
+
+out:
+    for (i = 0; i < num_devices; i++) {
+        data = &device_data[i];
+        if (ret)
+            memset(data, 0, sizeof(*data));
+        else if (data->restore_pos)
+            pending++;
+    }
+
+    if (pending) {
+        chardev_restore_file = file;
+        pr_info("chardev: Restoring %u instance(s) from %s on demand\n", pending, path);
+    } else {
+        filp_close(file, NULL);
+    }
+    return ret;
+}
+
+/* Prefetch order: most accesses recorded first, then by minor */
+struct chardev_restore_rank {
+    u32 accesses;
+    u32 minor;
+};
+
+static int chardev_restore_cmp(const void *a, const void *b)
+{
+    const struct chardev_restore_rank *x = a, *y = b;
+
+    if (x->accesses != y->accesses)
+        return x->accesses < y->accesses ? 1 : -1;
+    return x->minor < y->minor ? -1 : x->minor > y->minor;
+}
+
+static void chardev_restore_close(void)
+{
+    if (chardev_restore_file) {
+        filp_close(chardev_restore_file, NULL);
+        chardev_restore_file = NULL;
+    }
+}
+
+/*
+ * Read in whatever the first operations have not asked for yet. The
+ * entries' accesses are fixed at init; only restore_pos needs the lock.
+ */
+static void chardev_prefetch_work_fn(struct work_struct *work)
+{
+    struct chardev_restore_rank *ranks;
+    struct chardev_data *data;
+    unsigned int i;
+
+    ranks = kmalloc_array(num_devices, sizeof(*ranks), GFP_KERNEL);
+    if (!ranks)
+        return;
+
+    for (i = 0; i < num_devices; i++) {
+        ranks[i].accesses = device_data[i].restore.accesses;
+        ranks[i].minor = i;
+    }
+    sort(ranks, num_devices, sizeof(*ranks), chardev_restore_cmp, NULL);
+
+    for (i = 0; i < num_devices; i++) {
+        data = &device_data[ranks[i].minor];
+        mutex_lock(&data->lock);
+        chardev_restore(data, true);
+        mutex_unlock(&data->lock);
+    }
+    kfree(ranks);
+
+    /* Nothing is read from the file any more */
+    chardev_restore_close();
+    pr_info("chardev: Snapshot %s fully restored\n", snapshot_path);
+}
+
+/* IOCTL_SAVE and IOCTL_LOAD: every instance, to or from a file the caller names */
+static long chardev_snapshot_ioctl(unsigned int cmd, struct chardev_snapshot_req __user *arg)
+{
+    struct chardev_snapshot_req req;
+    char *path;
+    long ret;
+
+    /* Reads and writes any file the caller names, from inside the kernel */
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+    if (req.reserved || (cmd == IOCTL_LOAD && req.flags))
+        return -EINVAL;
+
+    path = strndup_user(u64_to_user_ptr(req.path), PATH_MAX);
+    if (IS_ERR(path))
+        return PTR_ERR(path);
+
+    if (cmd == IOCTL_SAVE)
+        ret = chardev_snapshot_save(path, req.flags);
+    else
+        ret = chardev_snapshot_load(path, true);
+
+    kfree(path);
+    return ret;
+}
+
+/*
+ * Pair @primary with @standby (caller holds chardev_link_mutex). The
+ * standby starts as a full copy, restored first if need be, and every
+ * change after that is sent on.
+ */
+static int chardev_mirror_start(struct chardev_data *primary, struct chardev_data *standby,
+                                u32 mode)
+{
+    struct chardev_mirror *m;
+
+    m = kzalloc(sizeof(*m), GFP_KERNEL);
+    if (!m)
+        return -ENOMEM;
+
+    m->primary = primary;
+    m->standby = standby;
+    m->mode = mode;
+    init_waitqueue_head(&m->wait);
+    spin_lock_init(&m->lock);
+    INIT_LIST_HEAD(&m->queue);
+
+    if (mode == CHARDEV_MIRROR_ASYNC) {
+        m->thread = kthread_run(chardev_mirror_thread_fn, m, "chardev-mirror%td",
+                                primary - device_data);
+        if (IS_ERR(m->thread)) {
+            long ret = PTR_ERR(m->thread);
+
+            kfree(m);
+            return ret;
+        }
+    }
+
+    mutex_lock(&primary->lock);
+    chardev_restore(primary, false);
+    mutex_lock_nested(&standby->lock, CHARDEV_LOCK_STANDBY);
+    chardev_set_contents(standby, primary->buffer, primary->buffer_size, primary->flag);
+    standby->mirror_of = primary;
+    mutex_unlock(&standby->lock);
+    primary->mirror = m;
+    mutex_unlock(&primary->lock);
+
+    pr_info("chardev: Instance %td mirrors to %td (%s)\n", primary - device_data,
+            standby - device_data, mode == CHARDEV_MIRROR_SYNC ? "sync" : "async");
+    return 0;
+}
+
+static void chardev_mirror_status(struct chardev_data *data, struct chardev_mirror_status *st)
+{
+    struct chardev_mirror *m = data->mirror_of ? data->mirror_of->mirror : data->mirror;
+    u64 now = ktime_get_ns();
+
+    memset(st, 0, sizeof(*st));
+    st->primary = data->mirror_of ? data->mirror_of - device_data : -1;
+    st->standby = data->mirror ? data->mirror->standby - device_data : -1;
+    if (!m)
+        return;
+
+    st->mode = m->mode;
+    spin_lock(&m->lock);
+    st->pending = min_t(u64, m->queued - m->applied, U32_MAX);
+    st->queued = m->queued;
+    st->applied = m->applied;
+    st->pending_bytes = m->pending_bytes;
+    st->lag_ns = m->behind_ns ? now - m->behind_ns : 0;
+    st->max_lag_ns = m->max_lag_ns;
+    st->resyncs = m->resyncs;
+    spin_unlock(&m->lock);
+}
+
+/* IOCTL_SET_MIRROR, IOCTL_GET_MIRROR and IOCTL_PROMOTE */
+static long chardev_mirror_ioctl(struct chardev_data *data, unsigned int cmd,
+                                 unsigned long arg)
+{
+    struct chardev_mirror_status status;
+    struct chardev_mirror_req req;
+    struct chardev_data *standby;
+    long ret = 0;
+
+    /* Pairing overwrites another instance */
+    if (cmd != IOCTL_GET_MIRROR && !capable(CAP_SYS_ADMIN))
+        return -EPERM;
+
+    if (cmd == IOCTL_SET_MIRROR) {
+        if (copy_from_user(&req, (void __user *)arg, sizeof(req)))
+            return -EFAULT;
+        if (req.mode > CHARDEV_MIRROR_ASYNC)
+            return -EINVAL;
+    }
+
+    if (mutex_lock_interruptible(&chardev_link_mutex))
+        return -ERESTARTSYS;
+
+    switch (cmd) {
+        case IOCTL_SET_MIRROR:
+            if (req.mode == CHARDEV_MIRROR_OFF) {
+                if (data->mirror)
+                    chardev_mirror_stop(data);
+                break;
+            }
+            if (req.standby >= num_devices || &device_data[req.standby] == data) {
+                ret = -EINVAL;
+                break;
+            }
+
+            /* One standby per primary, no chains, and no standby in a tee */
+            standby = &device_data[req.standby];
+            if (data->mirror || data->mirror_of || standby->mirror || standby->mirror_of ||
+                standby->tee_sinks || chardev_tee_sink(standby)) {
+                ret = -EBUSY;
+                break;
+            }
+            ret = chardev_mirror_start(data, standby, req.mode);
+            break;
+
+        case IOCTL_GET_MIRROR:
+            chardev_mirror_status(data, &status);
+            if (copy_to_user((void __user *)arg, &status, sizeof(status)))
+                ret = -EFAULT;
+            break;
+
+        case IOCTL_PROMOTE:
+            /* Failover: take what the primary had sent, then stand alone */
+            if (data->mirror_of)
+                chardev_mirror_stop(data->mirror_of);
+            else
+                ret = -EINVAL;
+            break;
+    }
+
+    mutex_unlock(&chardev_link_mutex);
+    return ret;
+}
+
+/*
+ * Tee
+ *
+ * Writes to a source instance fan out to the sinks in its tee_sinks. The
+ * data comes from user space once, into the source, and each sink gets a
+ * copy from there at the same offset. Sinks are taken in turn while the
+ * source's lock is held, so each sees the source's writes in order. To a
+ * sink it is a write like any other: stamped, counted, logged, mirrored
+ * and put in its record ring, flagged CHARDEV_RECORD_F_TEE.
+ *
+ * Locks go source, sink, then the sink's standby, at the subclasses of
+ * enum chardev_lock_subclass. Linking keeps it that way: a source is
+ * never a sink or a standby, and a sink never a source or a standby.
+ *
+ * The source's write has happened by the time the sinks are filled, so a
+ * sink's failure is not the writer's: the sink keeps the data in memory,
+ * as a source would, the error is counted and the sink is left out until
+ * the tee is set again, so it is never silently behind.
+ */
+static void chardev_tee(struct chardev_data *data, loff_t pos, u32 len, u16 flags,
+                        loff_t *lsn)
+{
+    struct chardev_pcpu_stats *s;
+    struct chardev_data *sink;
+    unsigned int i;
+    loff_t logged;
+
+    for (i = 0; i < num_devices; i++) {
+        if (!(data->tee_sinks & ~data->tee_failed & BIT_ULL(i)))
+            continue;
+        sink = &device_data[i];
+
+        mutex_lock_nested(&sink->lock, CHARDEV_LOCK_SINK);
+        chardev_restore(sink, false);
+
+        memcpy(sink->buffer + pos, data->buffer + pos, len);
+        chardev_stamp_write(sink, pos, len);
+        logged = chardev_wal_append(sink, WAL_WRITE, pos, sink->buffer + pos, len);
+        if (logged < 0) {
+            WRITE_ONCE(data->tee_failed, data->tee_failed | BIT_ULL(i));
+            WRITE_ONCE(data->tee_errors, data->tee_errors + 1);
+            pr_err("chardev: Instance %td no longer tees to %u: %d\n",
+                   data - device_data, i, (int)logged);
+        } else if (logged) {
+            *lsn = logged;
+        }
+        chardev_extend(sink, pos + len);
+        chardev_mirror_record(sink, WAL_WRITE, pos, sink->buffer + pos, len);
+        chardev_ring_append(sink, CHARDEV_RECORD_DATA, flags | CHARDEV_RECORD_F_TEE,
+                            sink->buffer + pos, len);
+
+        s = chardev_stats_begin(sink);
+        s->writes++;
+        s->bytes_written += len;
+        chardev_stats_end(sink, s);
+        mutex_unlock(&sink->lock);
+    }
+}
+
+/* IOCTL_SET_TEE and IOCTL_GET_TEE */
+static long chardev_tee_ioctl(struct chardev_data *data, unsigned int cmd,
+                              struct chardev_tee __user *arg)
+{
+    u64 all = num_devices == 64 ? U64_MAX : BIT_ULL(num_devices) - 1;
+    struct chardev_tee tee;
+    unsigned int i;
+    long ret = 0;
+
+    if (cmd == IOCTL_SET_TEE) {
+        /* Writes into other instances */
+        if (!capable(CAP_SYS_ADMIN))
+            return -EPERM;
+        if (copy_from_user(&tee, arg, sizeof(tee)))
+            return -EFAULT;
+        if ((tee.sinks & ~all) || (tee.sinks & BIT_ULL(data - device_data)))
+            return -EINVAL;
+    }
+
+    if (mutex_lock_interruptible(&chardev_link_mutex))
+        return -ERESTARTSYS;
+
+    if (cmd == IOCTL_GET_TEE) {
+        tee.sinks = data->tee_sinks;
+        tee.failed = READ_ONCE(data->tee_failed);
+        if (copy_to_user(arg, &tee, sizeof(tee)))
+            ret = -EFAULT;
+        goto out;
+    }
+
+    /* No chains: a source is no sink, a sink no source, and neither a standby */
+    if (tee.sinks) {
+        if (data->mirror_of || chardev_tee_sink(data))
+            ret = -EBUSY;
+        for (i = 0; i < num_devices && !ret; i++) {
+            if ((tee.sinks & BIT_ULL(i)) &&
+                (device_data[i].tee_sinks || device_data[i].mirror_of))
+                ret = -EBUSY;
+        }
+        if (ret)
+            goto out;
+    }
+
+    mutex_lock(&data->lock);
+    data->tee_sinks = tee.sinks;
+    WRITE_ONCE(data->tee_failed, 0);
+    mutex_unlock(&data->lock);
+    pr_info("chardev: Instance %td tees to %#llx\n", data - device_data, tee.sinks);
+out:
+    mutex_unlock(&chardev_link_mutex);
+    return ret;
+}
+
+/*
+ * Device read function
+ */
+static ssize_t chardev_read(struct file *file, char __user *user_buffer, 
+                           size_t count, loff_t *offset)
+{
+    struct chardev_file *cf = file->private_data;
+    struct chardev_data *data = cf->data;
+    struct chardev_pcpu_stats *s;
+    loff_t pos = *offset;
+    size_t to_read;
+    u64 locked, start;
+    ssize_t ret;
+    int err;
+
+    start = chardev_slo_start();
+    if (start)
+        atomic_inc(&data->waiting_readers);
+    err = chardev_lock(data, LOCK_OP_READ, &locked, &cf->blocked_ns);
+    if (start)
+        atomic_dec(&data->waiting_readers);
+    if (err)
+        return -ERESTARTSYS;
+    chardev_restore(data, false);
+
+    /* Calculate bytes to read (none at or beyond the end of data) */
+    to_read = chardev_read_len(data, *offset, count);
+    if (to_read == 0) {
+        ret = 0;
+        goto out;
+    }
+
+    /* Copy data to user space */
+    if (copy_to_user(user_buffer, data->buffer + *offset, to_read)) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    chardev_stamp_read(data, *offset, to_read);
+
+    *offset += to_read;
+    ret = to_read;
+
+    pr_info("chardev: Read %zu bytes from device\n", to_read);
+
+out:
+    cf->reads++;
+    s = chardev_stats_begin(data);
+    s->reads++;
+    if (ret > 0) {
+        cf->bytes_read += ret;
+        s->bytes_read += ret;
+    }
+    chardev_stats_end(data, s);
+    chardev_slo_end(data, start);
+    chardev_unlock(data, LOCK_OP_READ, locked);
+    trace_chardev_read(file, MINOR(data->cdev.dev), pos, count, ret);
+    return ret;
+}
+
+/*
+ * Device write function
+ */
+static ssize_t chardev_write(struct file *file, const char __user *user_buffer,
+                            size_t count, loff_t *offset)
+{
+    struct chardev_file *cf = file->private_data;
+    struct chardev_data *data = cf->data;
+    struct chardev_pcpu_stats *s;
+    loff_t pos = *offset;
+    loff_t lsn = 0;
+    ssize_t to_write;
+    u64 locked, start;
+    ssize_t ret;
+    int err;
+
+    start = chardev_slo_start();
+    if (chardev_lock(data, LOCK_OP_WRITE, &locked, &cf->blocked_ns))
+        return -ERESTARTSYS;
+    chardev_restore(data, false);
+
+    ret = chardev_mirror_writable(data);
+    if (ret)
+        goto out;
+
+    /* Calculate bytes to write, failing if offset is beyond buffer */
+    to_write = chardev_write_len(*offset, count);
+    if (to_write < 0) {
+        ret = to_write;
+        goto out;
+    }
+
+    /* Copy data from user space */
+    if (copy_from_user(data->buffer + *offset, user_buffer, to_write)) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    chardev_stamp_write(data, *offset, to_write);
+
+    lsn = chardev_wal_append(data, WAL_WRITE, pos, data->buffer + pos, to_write);
+    if (lsn < 0) {
+        ret = lsn;
+        goto out;
+    }
+
+    *offset += to_write;
+    
+    /* Update buffer size if we wrote beyond current size */
+    chardev_extend(data, *offset);
+    chardev_mirror_record(data, WAL_WRITE, pos, data->buffer + pos, to_write);
+
+    chardev_tee(data, pos, to_write, (size_t)to_write < count ? CHARDEV_RECORD_F_SHORT : 0,
+                &lsn);
+
+    chardev_ring_append(data, CHARDEV_RECORD_DATA,
+                        (size_t)to_write < count ? CHARDEV_RECORD_F_SHORT : 0,
+                        data->buffer + pos, to_write);
+
+    ret = to_write;
+
+    pr_info("chardev: Wrote %zd bytes to device\n", to_write);
+
+out:
+    cf->writes++;
+    s = chardev_stats_begin(data);
+    s->writes++;
+    if (ret > 0) {
+        cf->bytes_written += ret;
+        s->bytes_written += ret;
+    }
+    chardev_stats_end(data, s);
+    chardev_slo_end(data, start);
+    chardev_unlock(data, LOCK_OP_WRITE, locked);
+
+    /* Durable before it is acknowledged */
+    if (lsn > 0) {
+        err = chardev_wal_sync(lsn);
+        if (err)
+            ret = err;
+    }
+
+    trace_chardev_write(file, MINOR(data->cdev.dev), pos, count, ret);
+    return ret;
+}
+
+/*
+ * In-kernel self-benchmark for IOCTL_SELFTEST_BENCH
+ *
+ * Times the building blocks of the data path with no system call in the
+ * way, so userspace can compare them against end-to-end numbers. Runs
+ * without data->lock held (the lock loop takes it itself) and never touches
+ * the device contents: the memcpy loop copies from a snapshot of the
+ * backing store, taken once under the lock, into a scratch buffer. Every loop offers the CPU back every SELFTEST_RESCHED_INTERVAL
+ * iterations, so a long run does not stall a non-preemptible kernel.
+ */
+static long chardev_selftest_bench(struct chardev_data *data,
+                                   struct chardev_selftest_bench __user *arg)
+{
+    struct chardev_selftest_bench bench;
+    struct page *pages[2];
+    unsigned long ubuf;
+    char *scratch, *copy;
+    int nr_pages = 0;
+    struct page *page;
+    u64 t0;
+    u32 i;
+    long ret = 0;
+
+    /* Ties up a CPU and the allocator for a while: not for everyone */
+    if (!capable(CAP_SYS_ADMIN))
+        return -EPERM;
+
+    if (copy_from_user(&bench, arg, sizeof(bench)))
+        return -EFAULT;
+
+    if (bench.iterations == 0)
+        bench.iterations = SELFTEST_DEFAULT_ITERATIONS;
+    if (bench.copy_size == 0)
+        bench.copy_size = BUFFER_SIZE;
+    if (bench.iterations > SELFTEST_MAX_ITERATIONS || bench.copy_size > BUFFER_SIZE)
+        return -EINVAL;
+
+    scratch = kzalloc(2 * BUFFER_SIZE, GFP_KERNEL);
+    if (!scratch)
+        return -ENOMEM;
+    copy = scratch + BUFFER_SIZE;
+
+    if (mutex_lock_interruptible(&data->lock)) {
+        ret = -ERESTARTSYS;
+        goto out;
+    }
+    memcpy(copy, data->buffer, BUFFER_SIZE);
+    mutex_unlock(&data->lock);
+
+    /* Pin the user buffer so the copy loop measures copies, not faults */
+    ubuf = (unsigned long)bench.user_buffer;
+    if (ubuf) {
+        nr_pages = DIV_ROUND_UP(offset_in_page(ubuf) + bench.copy_size, PAGE_SIZE);
+        ret = pin_user_pages_fast(ubuf, nr_pages, FOLL_WRITE, pages);
+        if (ret != nr_pages) {
+            if (ret > 0)
+                unpin_user_pages(pages, ret);
+            ret = ret < 0 ? ret : -EFAULT;
+            goto out;
+        }
+        ret = 0;
+    }
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < bench.iterations; i++) {
+        memcpy(scratch, copy, bench.copy_size);
+        barrier();
+        if (!(i % SELFTEST_RESCHED_INTERVAL))
+            cond_resched();
+    }
+    bench.memcpy_ns = ktime_get_ns() - t0;
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < bench.iterations; i++) {
+        page = alloc_page(GFP_KERNEL);
+        if (!page) {
+            ret = -ENOMEM;
+            goto out_unpin;
+        }
+        __free_page(page);
+        if (!(i % SELFTEST_RESCHED_INTERVAL))
+            cond_resched();
+    }
+    bench.page_alloc_ns = ktime_get_ns() - t0;
+
+    t0 = ktime_get_ns();
+    for (i = 0; i < bench.iterations; i++) {
+        if (mutex_lock_interruptible(&data->lock)) {
+            ret = -ERESTARTSYS;
+            goto out_unpin;
+        }
+        mutex_unlock(&data->lock);
+        if (!(i % SELFTEST_RESCHED_INTERVAL))
+            cond_resched();
+    }
+    bench.lock_ns = ktime_get_ns() - t0;
+
+    bench.copy_to_user_ns = 0;
+    if (ubuf) {
+        t0 = ktime_get_ns();
+        for (i = 0; i < bench.iterations; i++) {
+            if (copy_to_user((void __user *)ubuf, scratch, bench.copy_size)) {
+                ret = -EFAULT;
+                goto out_unpin;
+            }
+            if (!(i % SELFTEST_RESCHED_INTERVAL))
+                cond_resched();
+        }
+        bench.copy_to_user_ns = ktime_get_ns() - t0;
+    }
+
+    pr_info("chardev: IOCTL - Self-benchmark: %u iterations of %u bytes\n",
+            bench.iterations, bench.copy_size);
+
+    if (copy_to_user(arg, &bench, sizeof(bench)))
+        ret = -EFAULT;
+
+out_unpin:
+    if (nr_pages)
+        unpin_user_pages(pages, nr_pages);
+out:
+    kfree(scratch);
+    return ret;
+}
+
+/*
+ * IOCTL_WRITE_BATCH: several positioned writes for one system call and one
+ * lock acquisition (caller holds data->lock). Returns the number of entries
+ * written; an error only if the first one fails. *lsn is set to the log
+ * position of the last entry logged.
+ */
+static long chardev_write_batch(struct chardev_data *data,
+                                struct chardev_batch __user *arg, loff_t *lsn)
 {
-    struct chardev_data *data = file->private_data;
-    size_t to_read;
-    ssize_t ret;
+    struct chardev_batch_entry *entries;
+    struct chardev_batch batch;
+    loff_t logged;
+    ssize_t len;
+    long ret = 0;
+    u32 i;
 
-    if (mutex_lock_interruptible(&data->lock))
-        return -ERESTARTSYS;
+    if (copy_from_user(&batch, arg, sizeof(batch)))
+        return -EFAULT;
+    if (batch.count == 0 || batch.count > CHARDEV_BATCH_MAX || batch.reserved)
+        return -EINVAL;
 
-    /* Check if offset is beyond buffer */
-    if (*offset >= data->buffer_size) {
-        ret = 0;
+    entries = kmalloc_array(batch.count, sizeof(*entries), GFP_KERNEL);
+    if (!entries)
+        return -ENOMEM;
+
+    if (copy_from_user(entries, u64_to_user_ptr(batch.entries),
+                       batch.count * sizeof(*entries))) {
+        ret = -EFAULT;
         goto out;
     }
 
-    /* Calculate bytes to read */
-    to_read = min(count, data->buffer_size - (size_t)*offset);
+    for (i = 0; i < batch.count; i++) {
+        if (entries[i].reserved) {
+            ret = -EINVAL;
+            break;
+        }
 
-    /* Copy data to user space */
-    if (copy_to_user(user_buffer, data->buffer + *offset, to_read)) {
-        ret = -EFAULT;
-        goto out;
+        /* Offsets are unsigned here, so reject large ones before the loff_t math */
+        if (entries[i].offset >= BUFFER_SIZE) {
+            ret = -ENOSPC;
+            break;
+        }
+
+        len = chardev_write_len(entries[i].offset, entries[i].len);
+        if (len < 0) {
+            ret = len;
+            break;
+        }
+
+        if (copy_from_user(data->buffer + entries[i].offset,
+                           u64_to_user_ptr(entries[i].buf), len)) {
+            ret = -EFAULT;
+            break;
+        }
+
+        chardev_stamp_write(data, entries[i].offset, len);
+
+        /* Logged before the size moves, as write() does */
+        logged = chardev_wal_append(data, WAL_WRITE, entries[i].offset,
+                                    data->buffer + entries[i].offset, len);
+        if (logged < 0) {
+            ret = logged;
+            break;
+        }
+        *lsn = logged;
+        chardev_extend(data, entries[i].offset + len);
+        chardev_mirror_record(data, WAL_WRITE, entries[i].offset,
+                              data->buffer + entries[i].offset, len);
+
+        chardev_tee(data, entries[i].offset, len,
+                    CHARDEV_RECORD_F_BATCH | (len < entries[i].len ? CHARDEV_RECORD_F_SHORT : 0),
+                    lsn);
+
+        chardev_ring_append(data, CHARDEV_RECORD_DATA,
+                            CHARDEV_RECORD_F_BATCH |
+                            (len < entries[i].len ? CHARDEV_RECORD_F_SHORT : 0),
+                            data->buffer + entries[i].offset, len);
     }
 
-    *offset += to_read;
-    ret = to_read;
+    /* Partial success reports what was done, as writev() does */
+    if (i > 0)
+        ret = i;
 
-    pr_info("chardev: Read %zu bytes from device\n", to_read);
+    pr_info("chardev: IOCTL - Write batch: %u of %u entries\n", i, batch.count);
 
 out:
-    mutex_unlock(&data->lock);
+    kfree(entries);
     return ret;
 }
 
+/* IOCTL_GET_STAMP (caller holds data->lock) */
+static long chardev_get_stamp(struct chardev_data *data, struct chardev_stamp __user *arg)
+{
+    struct chardev_stamp stamp;
+
+    if (copy_from_user(&stamp, arg, sizeof(stamp)))
+        return -EFAULT;
+    if (stamp.offset >= BUFFER_SIZE)
+        return -EINVAL;
+
+    stamp.enqueue_ns = data->enqueue_ns[stamp.offset / STAMP_BLOCK];
+    stamp.dequeue_ns = data->dequeue_ns[stamp.offset / STAMP_BLOCK];
+
+    if (copy_to_user(arg, &stamp, sizeof(stamp)))
+        return -EFAULT;
+    return 0;
+}
+
 /*
- * Device write function
+ * Statistics snapshot for IOCTL_GET_STATS and <debugfs>/.../stats
+ *
+ * Nothing here takes data->lock: counters and histograms come from the
+ * per-CPU copies, the rest are single words read once.
  */
-static ssize_t chardev_write(struct file *file, const char __user *user_buffer,
-                            size_t count, loff_t *offset)
+static int chardev_stats_fill(struct chardev_data *data, struct chardev_stats *st)
 {
-    struct chardev_data *data = file->private_data;
-    size_t to_write;
-    ssize_t ret;
+    struct chardev_pcpu_stats *sum;
+    unsigned int op;
 
-    if (mutex_lock_interruptible(&data->lock))
-        return -ERESTARTSYS;
+    sum = chardev_stats_get(data);
+    if (!sum)
+        return -ENOMEM;
 
-    /* Check if offset is beyond buffer */
-    if (*offset >= BUFFER_SIZE) {
-        ret = -ENOSPC;
-        goto out;
+    memset(st, 0, sizeof(*st));
+    st->version = CHARDEV_STATS_VERSION;
+    st->size = sizeof(*st);
+    st->ktime_ns = ktime_get_ns();
+    st->buffer_size = READ_ONCE(data->buffer_size);
+    st->flag = READ_ONCE(data->flag);
+    st->lock_stats = static_key_enabled(&chardev_lock_stats_key) ? 1 : 0;
+    st->reads = sum->reads;
+    st->writes = sum->writes;
+    st->ioctls = sum->ioctls;
+    st->bytes_read = sum->bytes_read;
+    st->bytes_written = sum->bytes_written;
+    st->ring_records = READ_ONCE(data->ring_seq);
+    st->ring_dropped = READ_ONCE(data->ring_dropped);
+    st->slo_breached = READ_ONCE(data->slo_breached);
+    st->tee_errors = READ_ONCE(data->tee_errors);
+    chardev_hist_export(&st->queue_delay, &sum->queue_delay);
+    for (op = 0; op < LOCK_OPS; op++) {
+        chardev_hist_export(&st->lock_wait[op], &sum->lock_stats.wait[op]);
+        chardev_hist_export(&st->lock_hold[op], &sum->lock_stats.hold[op]);
     }
 
-    /* Calculate bytes to write */
-    to_write = min(count, BUFFER_SIZE - (size_t)*offset);
+    kfree(sum);
+    return 0;
+}
 
-    /* Copy data from user space */
-    if (copy_from_user(data->buffer + *offset, user_buffer, to_write)) {
-        ret = -EFAULT;
-        goto out;
-    }
+/* struct chardev_stats as first released; no caller gets less */
+#define CHARDEV_STATS_MIN_SIZE offsetof(struct chardev_stats, tee_errors)
 
-    *offset += to_write;
-    
-    /* Update buffer size if we wrote beyond current size */
-    if (*offset > data->buffer_size)
-        data->buffer_size = *offset;
+/* IOCTL_GET_STATS for a struct chardev_stats of any release */
+static bool chardev_is_get_stats(unsigned int cmd)
+{
+    return _IOC_TYPE(cmd) == CHARDEV_IOC_MAGIC && _IOC_DIR(cmd) == _IOC_READ &&
+           _IOC_NR(cmd) == _IOC_NR(IOCTL_GET_STATS);
+}
 
-    ret = to_write;
+/* Copies out as much of the snapshot as the caller's struct holds */
+static long chardev_get_stats(struct chardev_data *data, struct chardev_stats __user *arg,
+                              size_t size)
+{
+    struct chardev_stats *st;
+    long ret = 0;
 
-    pr_info("chardev: Wrote %zu bytes to device\n", to_write);
+    if (size < CHARDEV_STATS_MIN_SIZE)
+        return -EINVAL;
 
-out:
-    mutex_unlock(&data->lock);
+    st = kmalloc(sizeof(*st), GFP_KERNEL);
+    if (!st)
+        return -ENOMEM;
+
+    if (chardev_stats_fill(data, st))
+        ret = -ENOMEM;
+    else if (copy_to_user(arg, st, min(size, sizeof(*st))))
+        ret = -EFAULT;
+
+    kfree(st);
     return ret;
 }
 
@@ -138,19 +2423,63 @@ out:
  */
 static long chardev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
-    struct chardev_data *data = file->private_data;
+    struct chardev_file *cf = file->private_data;
+    struct chardev_data *data = cf->data;
+    struct chardev_pcpu_stats *s;
+    loff_t lsn = 0;
     int ret = 0;
-    int value;
+    int value = 0;
+    u64 locked, start;
+    int err;
 
-    if (mutex_lock_interruptible(&data->lock))
+    /* Long-running and takes data->lock itself */
+    if (cmd == IOCTL_SELFTEST_BENCH)
+        return chardev_selftest_bench(data, (struct chardev_selftest_bench __user *)arg);
+
+    /* Take every instance's lock in turn themselves */
+    if (cmd == IOCTL_SAVE || cmd == IOCTL_LOAD)
+        return chardev_snapshot_ioctl(cmd, (struct chardev_snapshot_req __user *)arg);
+
+    /* Take the locks of both instances of a pair */
+    if (cmd == IOCTL_SET_MIRROR || cmd == IOCTL_GET_MIRROR || cmd == IOCTL_PROMOTE)
+        return chardev_mirror_ioctl(data, cmd, arg);
+
+    if (cmd == IOCTL_SET_TEE || cmd == IOCTL_GET_TEE)
+        return chardev_tee_ioctl(data, cmd, (struct chardev_tee __user *)arg);
+
+    /* Lockless and not counted, so monitoring neither waits nor shows up */
+    if (chardev_is_get_stats(cmd))
+        return chardev_get_stats(data, (struct chardev_stats __user *)arg, _IOC_SIZE(cmd));
+
+    start = chardev_slo_start();
+    if (chardev_lock(data, LOCK_OP_IOCTL, &locked, &cf->blocked_ns))
         return -ERESTARTSYS;
+    chardev_restore(data, false);
+
+    cf->ioctls++;
+    s = chardev_stats_begin(data);
+    s->ioctls++;
+    chardev_stats_end(data, s);
 
     switch (cmd) {
         case IOCTL_RESET:
+            ret = chardev_mirror_writable(data);
+            if (ret)
+                break;
+
+            lsn = chardev_wal_append(data, WAL_RESET, 0, NULL, 0);
+            if (lsn < 0) {
+                ret = lsn;
+                break;
+            }
+
             /* Reset buffer */
             memset(data->buffer, 0, BUFFER_SIZE);
-            data->buffer_size = 0;
-            data->flag = 0;
+            WRITE_ONCE(data->buffer_size, 0);
+            WRITE_ONCE(data->flag, 0);
+            memset(data->enqueue_ns, 0, sizeof(data->enqueue_ns));
+            memset(data->dequeue_ns, 0, sizeof(data->dequeue_ns));
+            chardev_mirror_record(data, WAL_RESET, 0, NULL, 0);
             pr_info("chardev: IOCTL - Buffer reset\n");
             break;
 
@@ -168,8 +2497,18 @@ static long chardev_ioctl(struct file *file, unsigned int cmd, unsigned long arg
             /* Set flag value */
             if (copy_from_user(&value, (int __user *)arg, sizeof(int))) {
                 ret = -EFAULT;
+                break;
+            }
+            ret = chardev_mirror_writable(data);
+            if (ret)
+                break;
+
+            lsn = chardev_wal_append(data, WAL_FLAG, (u32)value, NULL, 0);
+            if (lsn < 0) {
+                ret = lsn;
             } else {
-                data->flag = value;
+                WRITE_ONCE(data->flag, value);
+                chardev_mirror_record(data, WAL_FLAG, (u32)value, NULL, 0);
                 pr_info("chardev: IOCTL - Set flag: %d\n", value);
             }
             break;
@@ -184,16 +2523,93 @@ static long chardev_ioctl(struct file *file, unsigned int cmd, unsigned long arg
             }
             break;
 
+        case IOCTL_WRITE_BATCH:
+            ret = chardev_mirror_writable(data);
+            if (!ret)
+                ret = chardev_write_batch(data, (struct chardev_batch __user *)arg, &lsn);
+            value = ret;
+            break;
+
+        case IOCTL_GET_STAMP:
+            ret = chardev_get_stamp(data, (struct chardev_stamp __user *)arg);
+            break;
+
         default:
             pr_err("chardev: Invalid IOCTL command\n");
             ret = -EINVAL;
             break;
     }
 
-    mutex_unlock(&data->lock);
+    chardev_slo_end(data, start);
+    chardev_unlock(data, LOCK_OP_IOCTL, locked);
+
+    /* Durable before it is acknowledged */
+    if (lsn > 0) {
+        err = chardev_wal_sync(lsn);
+        if (err)
+            ret = err;
+    }
+
+    trace_chardev_ioctl(file, MINOR(data->cdev.dev), cmd, value, ret);
     return ret;
 }
 
+/*
+ * Map the record ring: the control page at offset 0, the data area after
+ * it. Only the control page may be mapped writable, for ctrl->tail, and
+ * a mapping that takes in the data area cannot be mprotect()ed writable.
+ */
+static int chardev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct chardev_file *cf = file->private_data;
+    struct chardev_data *data = cf->data;
+
+    if (!data->ring)
+        return -ENODEV;
+
+    if (vma->vm_pgoff != 0 || vma_pages(vma) != 1) {
+        if (vma->vm_flags & VM_WRITE)
+            return -EACCES;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+        vm_flags_clear(vma, VM_MAYWRITE);
+#else
+        vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+    }
+
+    return remap_vmalloc_range(vma, data->ring, vma->vm_pgoff);
+}
+
+/*
+ * /proc/<pid>/fdinfo/<fd>: this descriptor's counters. lag is how far the
+ * file position trails the end of the data written so far.
+ */
+static void chardev_show_fdinfo(struct seq_file *m, struct file *file)
+{
+    struct chardev_file *cf = file->private_data;
+    struct chardev_data *data = cf->data;
+    struct chardev_file snap;
+    loff_t pos = file->f_pos;
+    size_t size;
+
+    mutex_lock(&data->lock);
+    snap = *cf;
+    size = data->buffer_size;
+    mutex_unlock(&data->lock);
+
+    seq_printf(m, "chardev-minor:\t%u\n", MINOR(data->cdev.dev));
+    seq_printf(m, "chardev-mode:\t%s%s\n", (file->f_mode & FMODE_READ) ? "r" : "",
+               (file->f_mode & FMODE_WRITE) ? "w" : "");
+    seq_printf(m, "chardev-pos:\t%lld\n", (long long)pos);
+    seq_printf(m, "chardev-lag:\t%llu\n", pos < size ? (u64)(size - pos) : 0);
+    seq_printf(m, "chardev-reads:\t%llu\n", snap.reads);
+    seq_printf(m, "chardev-writes:\t%llu\n", snap.writes);
+    seq_printf(m, "chardev-ioctls:\t%llu\n", snap.ioctls);
+    seq_printf(m, "chardev-bytes-read:\t%llu\n", snap.bytes_read);
+    seq_printf(m, "chardev-bytes-written:\t%llu\n", snap.bytes_written);
+    seq_printf(m, "chardev-blocked-ns:\t%llu\n", snap.blocked_ns);
+}
+
 /*
  * File operations structure
  */
@@ -204,76 +2620,484 @@ static struct file_operations chardev_fops = {
     .read = chardev_read,
     .write = chardev_write,
     .unlocked_ioctl = chardev_ioctl,
+    .mmap = chardev_mmap,
+    .show_fdinfo = chardev_show_fdinfo,
+};
+
+/*
+ * Latency SLO watchdog
+ */
+
+/* Which thresholds the sampled values break */
+static unsigned int chardev_slo_reasons(u64 p99_ns, unsigned int fill_pct, int waiting)
+{
+    unsigned int p99_us = READ_ONCE(slo_p99_us);
+    unsigned int fill = READ_ONCE(slo_fill_pct);
+    unsigned int blocked = READ_ONCE(slo_blocked_readers);
+    unsigned int reasons = 0;
+
+    if (p99_us && p99_ns > (u64)p99_us * NSEC_PER_USEC)
+        reasons |= SLO_P99;
+    if (fill && fill_pct >= fill)
+        reasons |= SLO_FILL;
+    if (blocked && waiting >= blocked)
+        reasons |= SLO_BLOCKED;
+    return reasons;
+}
+
+static void chardev_slo_check(struct chardev_data *data)
+{
+    char env_state[32], env_reason[64], env_p99[48], env_ops[48], env_fill[32], env_blocked[48];
+    char *envp[] = { env_state, env_reason, env_p99, env_ops, env_fill, env_blocked, NULL };
+    int waiting = atomic_read(&data->waiting_readers);
+    unsigned int reasons, fill_pct;
+    u64 p99_ns, ops;
+
+    /*
+     * A lock that cannot be had right now is itself a symptom: keep the
+     * latency window for the next pass and judge on the waiters alone.
+     */
+    if (!mutex_trylock(&data->lock)) {
+        reasons = chardev_slo_reasons(0, 0, waiting) |
+                  (data->slo_breached & ~SLO_BLOCKED);
+        p99_ns = 0;
+        ops = 0;
+        fill_pct = 0;
+    } else {
+        p99_ns = chardev_hist_percentile(&data->slo_window, 99);
+        ops = data->slo_window.count;
+        fill_pct = data->buffer_size * 100 / BUFFER_SIZE;
+        memset(&data->slo_window, 0, sizeof(data->slo_window));
+        mutex_unlock(&data->lock);
+        reasons = chardev_slo_reasons(p99_ns, fill_pct, waiting);
+    }
+
+    /* Only changes are reported: the breach, what it is about, the recovery */
+    if (reasons == data->slo_breached)
+        return;
+    WRITE_ONCE(data->slo_breached, reasons);
+
+    snprintf(env_state, sizeof(env_state), "CHARDEV_SLO=%s", reasons ? "breach" : "ok");
+    snprintf(env_reason, sizeof(env_reason), "CHARDEV_SLO_REASON=%s%s%s%s",
+             reasons ? "" : "none",
+             (reasons & SLO_P99) ? "p99," : "",
+             (reasons & SLO_FILL) ? "fill," : "",
+             (reasons & SLO_BLOCKED) ? "blocked," : "");
+    if (reasons)
+        env_reason[strlen(env_reason) - 1] = '\0';
+    snprintf(env_p99, sizeof(env_p99), "CHARDEV_P99_NS=%llu", p99_ns);
+    snprintf(env_ops, sizeof(env_ops), "CHARDEV_OPS=%llu", ops);
+    snprintf(env_fill, sizeof(env_fill), "CHARDEV_FILL_PCT=%u", fill_pct);
+    snprintf(env_blocked, sizeof(env_blocked), "CHARDEV_BLOCKED_READERS=%d", waiting);
+
+    kobject_uevent_env(&data->device->kobj, KOBJ_CHANGE, envp);
+    pr_info("chardev: SLO %s on %s (%s)\n", reasons ? "breach" : "recovered",
+            dev_name(data->device), env_reason + strlen("CHARDEV_SLO_REASON="));
+}
+
+static void chardev_slo_work_fn(struct work_struct *work)
+{
+    unsigned int i;
+
+    for (i = 0; i < num_devices; i++)
+        chardev_slo_check(&device_data[i]);
+
+    schedule_delayed_work(&chardev_slo_work, msecs_to_jiffies(slo_interval_ms));
+}
+
+/*
+ * debugfs: <debugfs>/chardev/<device>/queue_delay
+ */
+static int chardev_queue_delay_show(struct seq_file *m, void *v)
+{
+    struct chardev_data *data = m->private;
+    struct chardev_pcpu_stats *sum;
+
+    sum = chardev_stats_get(data);
+    if (!sum)
+        return -ENOMEM;
+
+    chardev_hist_show(m, &sum->queue_delay);
+    kfree(sum);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(chardev_queue_delay);
+
+/* <debugfs>/chardev/<device>/lock_stats */
+static int chardev_lock_stats_show(struct seq_file *m, void *v)
+{
+    static const char * const ops[LOCK_OPS] = { "read", "write", "ioctl" };
+    struct chardev_data *data = m->private;
+    struct chardev_pcpu_stats *sum;
+    struct chardev_lock_stats *stats;
+    unsigned int op;
+
+    sum = chardev_stats_get(data);
+    if (!sum)
+        return -ENOMEM;
+    stats = &sum->lock_stats;
+
+    seq_printf(m, "enabled: %d\n", static_key_enabled(&chardev_lock_stats_key) ? 1 : 0);
+    for (op = 0; op < LOCK_OPS; op++) {
+        seq_printf(m, "[%s wait]\n", ops[op]);
+        chardev_hist_show(m, &stats->wait[op]);
+        seq_printf(m, "[%s hold]\n", ops[op]);
+        chardev_hist_show(m, &stats->hold[op]);
+    }
+
+    kfree(sum);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(chardev_lock_stats);
+
+/* <debugfs>/chardev/<device>/stats: struct chardev_stats, taken on open */
+static int chardev_stats_open(struct inode *inode, struct file *file)
+{
+    struct chardev_data *data = inode->i_private;
+    struct chardev_stats *st;
+
+    st = kmalloc(sizeof(*st), GFP_KERNEL);
+    if (!st)
+        return -ENOMEM;
+
+    if (chardev_stats_fill(data, st)) {
+        kfree(st);
+        return -ENOMEM;
+    }
+
+    file->private_data = st;
+    return 0;
+}
+
+static ssize_t chardev_stats_read(struct file *file, char __user *buf,
+                                  size_t count, loff_t *ppos)
+{
+    return simple_read_from_buffer(buf, count, ppos, file->private_data,
+                                   sizeof(struct chardev_stats));
+}
+
+static int chardev_stats_release(struct inode *inode, struct file *file)
+{
+    kfree(file->private_data);
+    return 0;
+}
+
+static const struct file_operations chardev_stats_fops = {
+    .owner = THIS_MODULE,
+    .open = chardev_stats_open,
+    .read = chardev_stats_read,
+    .llseek = default_llseek,
+    .release = chardev_stats_release,
+};
+
+/* <debugfs>/chardev/lock_stats_enable: 0 or 1, flips the static branch */
+static int chardev_lock_stats_enable_show(struct seq_file *m, void *v)
+{
+    seq_printf(m, "%d\n", static_key_enabled(&chardev_lock_stats_key) ? 1 : 0);
+    return 0;
+}
+
+static int chardev_lock_stats_enable_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, chardev_lock_stats_enable_show, NULL);
+}
+
+static ssize_t chardev_lock_stats_enable_write(struct file *file, const char __user *buf,
+                                               size_t count, loff_t *ppos)
+{
+    bool enable;
+    int ret;
+
+    ret = kstrtobool_from_user(buf, count, &enable);
+    if (ret)
+        return ret;
+
+    if (enable)
+        static_branch_enable(&chardev_lock_stats_key);
+    else
+        static_branch_disable(&chardev_lock_stats_key);
+    return count;
+}
+
+static const struct file_operations chardev_lock_stats_enable_fops = {
+    .owner = THIS_MODULE,
+    .open = chardev_lock_stats_enable_open,
+    .read = seq_read,
+    .write = chardev_lock_stats_enable_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+/* <debugfs>/chardev/lock_stats_reset: any write clears every instance */
+static ssize_t chardev_lock_stats_reset_write(struct file *file, const char __user *buf,
+                                              size_t count, loff_t *ppos)
+{
+    struct chardev_pcpu_stats *s;
+    struct chardev_data *data;
+    unsigned int i;
+    int cpu;
+
+    /* Holding the lock keeps out the CPUs' own writers */
+    for (i = 0; i < num_devices; i++) {
+        data = &device_data[i];
+        if (mutex_lock_interruptible(&data->lock))
+            return -ERESTARTSYS;
+        for_each_possible_cpu(cpu) {
+            s = per_cpu_ptr(data->stats, cpu);
+            preempt_disable();
+            write_seqcount_begin(&s->seq);
+            s->lock_stats = (struct chardev_lock_stats){};
+            write_seqcount_end(&s->seq);
+            preempt_enable();
+        }
+        mutex_unlock(&data->lock);
+    }
+    return count;
+}
+
+static const struct file_operations chardev_lock_stats_reset_fops = {
+    .owner = THIS_MODULE,
+    .write = chardev_lock_stats_reset_write,
 };
 
+/* <debugfs>/chardev/wal, while the write-ahead log is on */
+static int chardev_wal_stats_show(struct seq_file *m, void *v)
+{
+    struct chardev_wal *wal = &chardev_wal;
+
+    mutex_lock(&wal->lock);
+    seq_printf(m, "path: %s\n", wal_path);
+    seq_printf(m, "replayed: %llu\n", wal->replayed);
+    seq_printf(m, "records: %llu\n", wal->records);
+    seq_printf(m, "bytes: %llu\n", wal->bytes);
+    seq_printf(m, "size: %lld\n", (long long)wal->pos);
+    seq_printf(m, "error: %d\n", wal->error);
+    mutex_unlock(&wal->lock);
+
+    seq_printf(m, "syncs: %llu\n", READ_ONCE(wal->syncs));
+    seq_printf(m, "synced: %lld\n", (long long)READ_ONCE(wal->synced));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(chardev_wal_stats);
+
+/* <debugfs>/chardev/restore, after a lazy restore at init */
+static int chardev_restore_stats_show(struct seq_file *m, void *v)
+{
+    unsigned int i, pending = 0;
+
+    for (i = 0; i < num_devices; i++)
+        pending += !!READ_ONCE(device_data[i].restore_pos);
+
+    seq_printf(m, "path: %s\n", snapshot_path);
+    seq_printf(m, "pending: %u\n", pending);
+    seq_printf(m, "faulted: %d\n", atomic_read(&chardev_restore_faulted));
+    seq_printf(m, "prefetched: %d\n", atomic_read(&chardev_restore_prefetched));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(chardev_restore_stats);
+
+/*
+ * Create one device instance: cdev plus its /dev node
+ */
+static int chardev_create_instance(unsigned int index)
+{
+    struct chardev_data *data = &device_data[index];
+    dev_t devno = MKDEV(MAJOR(dev_number), MINOR(dev_number) + index);
+    struct device *device;
+    int ret;
+
+    /* Initialize mutex */
+    mutex_init(&data->lock);
+
+    ret = chardev_stats_alloc(data);
+    if (ret < 0) {
+        pr_err("chardev: Failed to allocate statistics %u\n", index);
+        return ret;
+    }
+
+    if (ring_pages) {
+        ret = chardev_ring_alloc(data, ring_pages);
+        if (ret < 0) {
+            pr_err("chardev: Failed to allocate record ring %u\n", index);
+            chardev_stats_free(data);
+            return ret;
+        }
+    }
+
+    /* Initialize and add character device */
+    cdev_init(&data->cdev, &chardev_fops);
+    data->cdev.owner = THIS_MODULE;
+
+    ret = cdev_add(&data->cdev, devno, 1);
+    if (ret < 0) {
+        pr_err("chardev: Failed to add character device %u\n", index);
+        chardev_ring_free(data);
+        chardev_stats_free(data);
+        return ret;
+    }
+
+    /* Create device file; the first instance keeps the plain name */
+    if (index == 0)
+        device = device_create(chardev_class, NULL, devno, NULL, DEVICE_NAME);
+    else
+        device = device_create(chardev_class, NULL, devno, NULL, DEVICE_NAME "%u", index);
+    if (IS_ERR(device)) {
+        pr_err("chardev: Failed to create device file %u\n", index);
+        cdev_del(&data->cdev);
+        chardev_ring_free(data);
+        chardev_stats_free(data);
+        return PTR_ERR(device);
+    }
+
+    data->device = device;
+    atomic_set(&data->waiting_readers, 0);
+
+    /* debugfs failures are not fatal and need no checking */
+    data->debugfs = debugfs_create_dir(dev_name(device), chardev_debugfs);
+    debugfs_create_file("queue_delay", 0444, data->debugfs, data, &chardev_queue_delay_fops);
+    debugfs_create_file("lock_stats", 0444, data->debugfs, data, &chardev_lock_stats_fops);
+    debugfs_create_file_size("stats", 0444, data->debugfs, data, &chardev_stats_fops,
+                             sizeof(struct chardev_stats));
+
+    return 0;
+}
+
+static void chardev_destroy_instance(unsigned int index)
+{
+    debugfs_remove_recursive(device_data[index].debugfs);
+
+    /* Destroy device */
+    device_destroy(chardev_class, MKDEV(MAJOR(dev_number), MINOR(dev_number) + index));
+
+    /* Delete character device */
+    cdev_del(&device_data[index].cdev);
+
+    chardev_ring_free(&device_data[index]);
+
+    /* Kept for the snapshot saved on exit */
+    chardev_snapshot_accesses(&device_data[index], &device_data[index].restore.accesses);
+    chardev_stats_free(&device_data[index]);
+}
+
 /*
  * Module initialization function
  */
 static int __init chardev_init(void)
 {
     int ret;
-    struct device *device;
+    unsigned int i;
 
     pr_info("chardev: Initializing character device driver\n");
 
+    if (num_devices < 1 || num_devices > MAX_DEVICES) {
+        pr_err("chardev: num_devices must be between 1 and %d\n", MAX_DEVICES);
+        return -EINVAL;
+    }
+
+    if (ring_pages > CHARDEV_RING_MAX_PAGES || (ring_pages & (ring_pages - 1))) {
+        pr_err("chardev: ring_pages must be 0 or a power of two up to %d\n",
+               CHARDEV_RING_MAX_PAGES);
+        return -EINVAL;
+    }
+
     /* Allocate device data */
-    device_data = kzalloc(sizeof(struct chardev_data), GFP_KERNEL);
+    device_data = kcalloc(num_devices, sizeof(struct chardev_data), GFP_KERNEL);
     if (!device_data) {
         pr_err("chardev: Failed to allocate memory\n");
         return -ENOMEM;
     }
 
-    /* Initialize mutex */
-    mutex_init(&device_data->lock);
+    /*
+     * Bring back the saved, then the logged contents before anyone can see
+     * the devices. The log is replayed onto the whole image, so with one
+     * the snapshot is read in at once rather than on demand.
+     */
+    if (snapshot_path && *snapshot_path) {
+        if (wal_path && *wal_path)
+            ret = chardev_snapshot_load(snapshot_path, false);
+        else
+            ret = chardev_restore_open(snapshot_path);
+        if (ret == -ENOENT)
+            pr_info("chardev: No snapshot at %s yet\n", snapshot_path);
+        else if (ret)
+            pr_warn("chardev: Snapshot %s not restored (%d), starting empty\n",
+                    snapshot_path, ret);
+    }
 
-    /* Allocate device number */
-    ret = alloc_chrdev_region(&dev_number, 0, 1, DEVICE_NAME);
+    ret = chardev_wal_open();
+    if (ret < 0)
+        goto fail_restore;
+
+    /* Allocate device numbers */
+    ret = alloc_chrdev_region(&dev_number, 0, num_devices, DEVICE_NAME);
     if (ret < 0) {
         pr_err("chardev: Failed to allocate device number\n");
-        goto fail_alloc;
+        goto fail_wal;
     }
 
     pr_info("chardev: Allocated device number - Major: %d, Minor: %d\n",
             MAJOR(dev_number), MINOR(dev_number));
 
     /* Create device class */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+    chardev_class = class_create(CLASS_NAME);
+#else
     chardev_class = class_create(THIS_MODULE, CLASS_NAME);
+#endif
     if (IS_ERR(chardev_class)) {
         pr_err("chardev: Failed to create device class\n");
         ret = PTR_ERR(chardev_class);
         goto fail_class;
     }
 
-    /* Initialize and add character device */
-    cdev_init(&device_data->cdev, &chardev_fops);
-    device_data->cdev.owner = THIS_MODULE;
+    chardev_debugfs = debugfs_create_dir(DEVICE_NAME, NULL);
 
-    ret = cdev_add(&device_data->cdev, dev_number, 1);
-    if (ret < 0) {
-        pr_err("chardev: Failed to add character device\n");
-        goto fail_cdev;
+    /* Create the device instances */
+    for (i = 0; i < num_devices; i++) {
+        ret = chardev_create_instance(i);
+        if (ret < 0)
+            goto fail_device;
     }
 
-    /* Create device file */
-    device = device_create(chardev_class, NULL, dev_number, NULL, DEVICE_NAME);
-    if (IS_ERR(device)) {
-        pr_err("chardev: Failed to create device file\n");
-        ret = PTR_ERR(device);
-        goto fail_device;
+    /* Knobs that reach every instance go in once they all exist */
+    debugfs_create_file("lock_stats_enable", 0644, chardev_debugfs, NULL,
+                        &chardev_lock_stats_enable_fops);
+    debugfs_create_file("lock_stats_reset", 0200, chardev_debugfs, NULL,
+                        &chardev_lock_stats_reset_fops);
+    if (chardev_wal.file)
+        debugfs_create_file("wal", 0444, chardev_debugfs, NULL, &chardev_wal_stats_fops);
+    if (chardev_restore_file)
+        debugfs_create_file("restore", 0444, chardev_debugfs, NULL,
+                            &chardev_restore_stats_fops);
+
+    /* The instances are served from now on; the prefetcher only fills the gaps */
+    INIT_DELAYED_WORK(&chardev_prefetch_work, chardev_prefetch_work_fn);
+    if (chardev_restore_file && snapshot_prefetch)
+        schedule_delayed_work(&chardev_prefetch_work, 0);
+
+    /* Likewise the watchdog, which walks them all */
+    INIT_DELAYED_WORK(&chardev_slo_work, chardev_slo_work_fn);
+    if (slo_interval_ms) {
+        static_branch_enable(&chardev_slo_key);
+        schedule_delayed_work(&chardev_slo_work, msecs_to_jiffies(slo_interval_ms));
     }
 
     pr_info("chardev: Character device driver loaded successfully\n");
-    pr_info("chardev: Device node created at /dev/%s\n", DEVICE_NAME);
+    pr_info("chardev: %u device node(s) created at /dev/%s\n", num_devices, DEVICE_NAME);
 
     return 0;
 
 fail_device:
-    cdev_del(&device_data->cdev);
-fail_cdev:
+    while (i--)
+        chardev_destroy_instance(i);
+    debugfs_remove_recursive(chardev_debugfs);
     class_destroy(chardev_class);
 fail_class:
-    unregister_chrdev_region(dev_number, 1);
-fail_alloc:
+    unregister_chrdev_region(dev_number, num_devices);
+fail_wal:
+    chardev_wal_close();
+fail_restore:
+    chardev_restore_close();
     kfree(device_data);
     return ret;
 }
@@ -283,19 +3107,50 @@ fail_alloc:
  */
 static void __exit chardev_exit(void)
 {
+    unsigned int i;
+    int ret;
+
     pr_info("chardev: Unloading character device driver\n");
 
-    /* Destroy device */
-    device_destroy(chardev_class, dev_number);
-    
-    /* Delete character device */
-    cdev_del(&device_data->cdev);
+    if (slo_interval_ms) {
+        cancel_delayed_work_sync(&chardev_slo_work);
+        static_branch_disable(&chardev_slo_key);
+    }
+    cancel_delayed_work_sync(&chardev_prefetch_work);
+
+    /* Standbys catch up before anything goes away */
+    mutex_lock(&chardev_link_mutex);
+    for (i = 0; i < num_devices; i++) {
+        if (device_data[i].mirror)
+            chardev_mirror_stop(&device_data[i]);
+    }
+    mutex_unlock(&chardev_link_mutex);
+
+    /* Destroy device instances */
+    for (i = 0; i < num_devices; i++)
+        chardev_destroy_instance(i);
+    debugfs_remove_recursive(chardev_debugfs);
     
     /* Destroy class */
     class_destroy(chardev_class);
     
-    /* Unregister device number */
-    unregister_chrdev_region(dev_number, 1);
+    /* Unregister device numbers */
+    unregister_chrdev_region(dev_number, num_devices);
+
+    /* The devices are gone, so this is the final state */
+    if (snapshot_path && *snapshot_path) {
+        ret = chardev_snapshot_save(snapshot_path, CHARDEV_SNAPSHOT_LZ4);
+        if (ret)
+            pr_err("chardev: Failed to save snapshot %s (%d)\n", snapshot_path, ret);
+        else
+            chardev_wal_checkpoint();
+    }
+
+    /* Every change was synced before it returned: nothing left to flush */
+    chardev_wal_close();
+
+    /* Saving read in whatever was still waiting in the old snapshot */
+    chardev_restore_close();
     
     /* Free device data */
     kfree(device_data);
@@ -306,6 +3161,10 @@ static void __exit chardev_exit(void)
 module_init(chardev_init);
 module_exit(chardev_exit);
 
+#ifdef CONFIG_CHARDEV_KUNIT_TEST
+#include "chardev_kunit.c"
+#endif
+
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Your Name");
 MODULE_DESCRIPTION("Character Device Driver with Read/Write/IOCTL Interface and Mutex Synchronization");
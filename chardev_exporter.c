@@ -0,0 +1,439 @@
+/*
+ * Prometheus exporter for the Character Device Driver
+ *
+ *   chardev_exporter [-d DIR] [-l LISTEN]    serve http://LISTEN/metrics
+ *   chardev_exporter [-d DIR] -1             print the metrics once
+ *
+ * Each scrape opens <debugfs>/chardev/<device>/stats for every instance and
+ * takes its struct chardev_stats with a single read(); the driver gathers
+ * it from per-CPU counters without taking the instance lock. Nothing opens
+ * the device nodes, so scrapes leave the fdinfo
+ * counters, the queueing-delay stamps and the record ring alone. Requests
+ * are served one at a time: however many scrapers there are, the driver
+ * sees at most one snapshot per instance in flight.
+ *
+ * LISTEN is [ADDR:]PORT (default 127.0.0.1:9469) or unix:PATH. Over a UNIX
+ * socket the exporter still speaks HTTP, e.g. for
+ * curl --unix-socket PATH http://localhost/metrics.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <netdb.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include "chardev_uapi.h"
+
+#define EXPORTER_DEFAULT_DIR    "/sys/kernel/debug/chardev"
+#define EXPORTER_DEFAULT_LISTEN "127.0.0.1:9469"
+#define EXPORTER_MAX_REQUEST    4096
+#define EXPORTER_TIMEOUT_SECS   5
+
+struct instance {
+    char name[64];
+    struct chardev_stats stats;
+};
+
+static const char * const lock_ops[CHARDEV_LOCK_OPS] = { "read", "write", "ioctl" };
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -d DIR     driver debugfs directory (default %s)\n"
+            "  -l LISTEN  [ADDR:]PORT or unix:PATH to serve /metrics on (default %s)\n"
+            "  -1         print the metrics once to stdout and exit\n",
+            prog, EXPORTER_DEFAULT_DIR, EXPORTER_DEFAULT_LISTEN);
+}
+
+/*
+ * Collecting
+ */
+
+/* One read() of the stats file; 0 on success */
+static int read_stats(const char *dir, const char *name, struct chardev_stats *st)
+{
+    char path[PATH_MAX];
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s/stats", dir, name);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    /* A newer driver may append fields; the ones we know come first */
+    memset(st, 0, sizeof(*st));
+    n = read(fd, st, sizeof(*st));
+    close(fd);
+
+    if (n < (ssize_t)sizeof(*st) || st->version != CHARDEV_STATS_VERSION) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+static int compare_instances(const void *a, const void *b)
+{
+    return strcmp(((const struct instance *)a)->name, ((const struct instance *)b)->name);
+}
+
+/* Every instance directory under dir, sorted by name; count in *count */
+static struct instance *collect(const char *dir, size_t *count)
+{
+    struct instance *list = NULL, *grown;
+    size_t n = 0, cap = 0;
+    struct dirent *de;
+    DIR *d;
+
+    d = opendir(dir);
+    if (!d)
+        return NULL;
+
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.' || strlen(de->d_name) >= sizeof(list->name))
+            continue;
+        if (n == cap) {
+            cap = cap ? 2 * cap : 8;
+            grown = realloc(list, cap * sizeof(*list));
+            if (!grown)
+                break;
+            list = grown;
+        }
+        /* Plain files at the top (lock_stats_enable, ...) have no stats */
+        if (read_stats(dir, de->d_name, &list[n].stats) < 0)
+            continue;
+        strcpy(list[n].name, de->d_name);
+        n++;
+    }
+    closedir(d);
+
+    if (n)
+        qsort(list, n, sizeof(*list), compare_instances);
+    *count = n;
+    return list ? list : calloc(1, sizeof(*list));
+}
+
+/*
+ * Formatting: Prometheus text exposition format 0.0.4
+ */
+
+static void header(FILE *out, const char *name, const char *type, const char *help)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* One sample per instance of an unsigned struct chardev_stats field */
+#define EMIT_FIELD(out, list, n, metric, type, help, field)                     \
+    do {                                                                        \
+        size_t _i;                                                              \
+                                                                                \
+        header(out, metric, type, help);                                        \
+        for (_i = 0; _i < (n); _i++)                                            \
+            fprintf(out, "%s{device=\"%s\"} %llu\n", metric, (list)[_i].name,   \
+                    (unsigned long long)(list)[_i].stats.field);                \
+    } while (0)
+
+/* Log2 buckets: bucket i holds values below 2^i ns; the last one is open-ended */
+static void emit_hist(FILE *out, const char *name, const char *labels,
+                      const struct chardev_stats_hist *h)
+{
+    unsigned long long cumulative = 0;
+    unsigned int i;
+
+    for (i = 0; i < CHARDEV_HIST_BUCKETS - 1; i++) {
+        cumulative += h->buckets[i];
+        fprintf(out, "%s_bucket{%s,le=\"%.9g\"} %llu\n", name, labels,
+                (double)(1ULL << i) / 1e9, cumulative);
+    }
+    fprintf(out, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels, (unsigned long long)h->count);
+    fprintf(out, "%s_sum{%s} %.9f\n", name, labels, (double)h->sum / 1e9);
+    fprintf(out, "%s_count{%s} %llu\n", name, labels, (unsigned long long)h->count);
+}
+
+static void emit_lock_hists(FILE *out, const struct instance *list, size_t n, int hold)
+{
+    const char *name = hold ? "chardev_lock_hold_seconds" : "chardev_lock_wait_seconds";
+    char labels[128];
+    unsigned int op;
+    size_t i;
+
+    header(out, name, "histogram", hold ? "Time the instance lock was held, by operation"
+                                        : "Time spent waiting for the instance lock, by operation");
+    for (i = 0; i < n; i++) {
+        for (op = 0; op < CHARDEV_LOCK_OPS; op++) {
+            snprintf(labels, sizeof(labels), "device=\"%s\",op=\"%s\"", list[i].name, lock_ops[op]);
+            emit_hist(out, name, labels,
+                      hold ? &list[i].stats.lock_hold[op] : &list[i].stats.lock_wait[op]);
+        }
+    }
+}
+
+static void emit(FILE *out, const struct instance *list, size_t n)
+{
+    static const struct { unsigned int bit; const char *reason; } slo[] = {
+        { CHARDEV_SLO_P99, "p99" },
+        { CHARDEV_SLO_FILL, "fill" },
+        { CHARDEV_SLO_BLOCKED, "blocked" },
+    };
+    char labels[128];
+    size_t i, r;
+
+    header(out, "chardev_instances", "gauge", "Driver instances exporting statistics");
+    fprintf(out, "chardev_instances %zu\n", n);
+
+    EMIT_FIELD(out, list, n, "chardev_buffer_bytes", "gauge", "Bytes of data held", buffer_size);
+    header(out, "chardev_flag", "gauge", "Value set with IOCTL_SET_FLAG");
+    for (i = 0; i < n; i++)
+        fprintf(out, "chardev_flag{device=\"%s\"} %d\n", list[i].name, list[i].stats.flag);
+    EMIT_FIELD(out, list, n, "chardev_reads_total", "counter", "read() calls", reads);
+    EMIT_FIELD(out, list, n, "chardev_writes_total", "counter", "write() calls", writes);
+    EMIT_FIELD(out, list, n, "chardev_ioctls_total", "counter", "ioctl() calls", ioctls);
+    EMIT_FIELD(out, list, n, "chardev_read_bytes_total", "counter", "Bytes read", bytes_read);
+    EMIT_FIELD(out, list, n, "chardev_written_bytes_total", "counter", "Bytes written",
+               bytes_written);
+    EMIT_FIELD(out, list, n, "chardev_ring_records_total", "counter",
+               "Records offered to the record ring", ring_records);
+    EMIT_FIELD(out, list, n, "chardev_ring_dropped_total", "counter",
+               "Records dropped because the record ring was full", ring_dropped);
+    EMIT_FIELD(out, list, n, "chardev_tee_errors_total", "counter",
+               "Copies to tee sinks that failed", tee_errors);
+    EMIT_FIELD(out, list, n, "chardev_lock_stats_enabled", "gauge",
+               "1 while lock wait and hold times are collected", lock_stats);
+
+    header(out, "chardev_slo_breach", "gauge", "1 while the SLO watchdog reports this threshold broken");
+    for (i = 0; i < n; i++) {
+        for (r = 0; r < sizeof(slo) / sizeof(slo[0]); r++)
+            fprintf(out, "chardev_slo_breach{device=\"%s\",reason=\"%s\"} %d\n", list[i].name,
+                    slo[r].reason, (list[i].stats.slo_breached & slo[r].bit) ? 1 : 0);
+    }
+
+    header(out, "chardev_queue_delay_seconds", "histogram",
+           "Time from a write to the first read of the same data");
+    for (i = 0; i < n; i++) {
+        snprintf(labels, sizeof(labels), "device=\"%s\"", list[i].name);
+        emit_hist(out, "chardev_queue_delay_seconds", labels, &list[i].stats.queue_delay);
+    }
+
+    emit_lock_hists(out, list, n, 0);
+    emit_lock_hists(out, list, n, 1);
+}
+
+/* The whole scrape as one malloc'd string; NULL if the directory is unreadable */
+static char *scrape(const char *dir, size_t *len)
+{
+    struct instance *list;
+    char *text = NULL;
+    size_t n;
+    FILE *out;
+
+    list = collect(dir, &n);
+    if (!list)
+        return NULL;
+
+    out = open_memstream(&text, len);
+    if (out) {
+        emit(out, list, n);
+        fclose(out);
+    }
+    free(list);
+    return text;
+}
+
+/*
+ * Serving
+ */
+
+static int listen_on(const char *spec)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM,
+                              .ai_flags = AI_PASSIVE };
+    struct addrinfo *res, *ai;
+    char host[256] = "", *port;
+    int fd = -1, one = 1, err;
+
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un sun = { .sun_family = AF_UNIX };
+
+        if (strlen(spec + 5) >= sizeof(sun.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(sun.sun_path, spec + 5);
+        unlink(sun.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0 || listen(fd, 16) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    /* [ADDR:]PORT; ADDR may be a bracketed IPv6 address */
+    snprintf(host, sizeof(host), "%s", spec);
+    port = strrchr(host, ':');
+    if (port) {
+        *port++ = '\0';
+        if (host[0] == '[' && host[strlen(host) - 1] == ']') {
+            memmove(host, host + 1, strlen(host));
+            host[strlen(host) - 1] = '\0';
+        }
+    } else {
+        port = host;
+    }
+
+    err = getaddrinfo(port == host || !host[0] ? NULL : host, port, &hints, &res);
+    if (err) {
+        fprintf(stderr, "chardev_exporter: %s: %s\n", spec, gai_strerror(err));
+        errno = EINVAL;
+        return -1;
+    }
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 16) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static void write_all(int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len) {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+static void respond(int fd, const char *status, const char *type, const char *body, size_t len)
+{
+    char head[256];
+    int n;
+
+    n = snprintf(head, sizeof(head),
+                 "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                 "Connection: close\r\n\r\n", status, type, len);
+    write_all(fd, head, n);
+    write_all(fd, body, len);
+}
+
+/* One request per connection: GET /metrics (or /) gets a fresh scrape */
+static void serve(int client, const char *dir)
+{
+    struct timeval timeout = { .tv_sec = EXPORTER_TIMEOUT_SECS };
+    char request[EXPORTER_MAX_REQUEST];
+    size_t used = 0, len;
+    char *text;
+    ssize_t n;
+
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    while (used < sizeof(request) - 1) {
+        n = read(client, request + used, sizeof(request) - 1 - used);
+        if (n <= 0)
+            return;
+        used += n;
+        request[used] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+
+    if (strncmp(request, "GET /metrics ", 13) != 0 && strncmp(request, "GET / ", 6) != 0) {
+        respond(client, "404 Not Found", "text/plain", "try /metrics\n", 13);
+        return;
+    }
+
+    text = scrape(dir, &len);
+    if (!text) {
+        char msg[256];
+
+        n = snprintf(msg, sizeof(msg), "cannot read %s: %s\n", dir, strerror(errno));
+        respond(client, "503 Service Unavailable", "text/plain", msg, n);
+        return;
+    }
+    respond(client, "200 OK", "text/plain; version=0.0.4; charset=utf-8", text, len);
+    free(text);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = EXPORTER_DEFAULT_DIR;
+    const char *listen_spec = EXPORTER_DEFAULT_LISTEN;
+    int once = 0, opt, fd, client;
+    size_t len;
+    char *text;
+
+    while ((opt = getopt(argc, argv, "d:l:1h")) != -1) {
+        switch (opt) {
+            case 'd':
+                dir = optarg;
+                break;
+            case 'l':
+                listen_spec = optarg;
+                break;
+            case '1':
+                once = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (once) {
+        text = scrape(dir, &len);
+        if (!text) {
+            fprintf(stderr, "chardev_exporter: cannot read %s: %s\n", dir, strerror(errno));
+            return 1;
+        }
+        fwrite(text, 1, len, stdout);
+        free(text);
+        return 0;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    fd = listen_on(listen_spec);
+    if (fd < 0) {
+        fprintf(stderr, "chardev_exporter: cannot listen on %s: %s\n", listen_spec, strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "chardev_exporter: serving %s on %s\n", dir, listen_spec);
+
+    for (;;) {
+        client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("chardev_exporter: accept");
+            return 1;
+        }
+        serve(client, dir);
+        close(client);
+    }
+}
@@ -0,0 +1,620 @@
+/*
+ * KUnit tests and microbenchmarks for the Character Device Driver
+ *
+ * Included at the end of chardev.c when CONFIG_CHARDEV_KUNIT_TEST is set,
+ * so the static helpers and file operations can be exercised directly.
+ * The benchmark suite times the data-path pieces without any system call
+ * in the way and reports the cost per operation in the KUnit log.
+ */
+#include <kunit/test.h>
+#include <linux/ktime.h>
+#include <linux/timex.h>
+
+#define CHARDEV_BENCH_ITERATIONS 100000
+
+/* A device instance and an open file pointing at it, as after chardev_open() */
+struct chardev_test_ctx {
+    struct chardev_data *data;
+    struct chardev_file cf;
+    struct file file;
+    struct chardev_pcpu_stats *sum;     /* and scratch space after it */
+};
+
+static int chardev_test_init(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx;
+
+    ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+    if (!ctx)
+        return -ENOMEM;
+
+    ctx->data = kunit_kzalloc(test, sizeof(*ctx->data), GFP_KERNEL);
+    if (!ctx->data)
+        return -ENOMEM;
+
+    ctx->sum = kunit_kzalloc(test, 2 * sizeof(*ctx->sum), GFP_KERNEL);
+    if (!ctx->sum)
+        return -ENOMEM;
+
+    mutex_init(&ctx->data->lock);
+    if (chardev_stats_alloc(ctx->data))
+        return -ENOMEM;
+
+    ctx->cf.data = ctx->data;
+    ctx->file.private_data = &ctx->cf;
+    test->priv = ctx;
+    return 0;
+}
+
+static void chardev_test_exit(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+
+    chardev_stats_free(ctx->data);
+}
+
+/* The instance's per-CPU statistics summed up as they are now */
+static struct chardev_pcpu_stats *chardev_test_stats(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+
+    chardev_stats_sum(ctx->data, ctx->sum, ctx->sum + 1);
+    return ctx->sum;
+}
+
+/*
+ * Offset math
+ */
+static void chardev_test_read_len(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+
+    /* Nothing to read from an empty device */
+    KUNIT_EXPECT_EQ(test, chardev_read_len(ctx->data, 0, 10), (size_t)0);
+
+    ctx->data->buffer_size = 100;
+    KUNIT_EXPECT_EQ(test, chardev_read_len(ctx->data, 0, 10), (size_t)10);
+    KUNIT_EXPECT_EQ(test, chardev_read_len(ctx->data, 0, 1000), (size_t)100);
+    KUNIT_EXPECT_EQ(test, chardev_read_len(ctx->data, 90, 1000), (size_t)10);
+    KUNIT_EXPECT_EQ(test, chardev_read_len(ctx->data, 99, 1), (size_t)1);
+    KUNIT_EXPECT_EQ(test, chardev_read_len(ctx->data, 100, 1), (size_t)0);
+    KUNIT_EXPECT_EQ(test, chardev_read_len(ctx->data, 5000, 1), (size_t)0);
+}
+
+static void chardev_test_write_len(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, chardev_write_len(0, 10), (ssize_t)10);
+    KUNIT_EXPECT_EQ(test, chardev_write_len(0, BUFFER_SIZE + 1), (ssize_t)BUFFER_SIZE);
+    KUNIT_EXPECT_EQ(test, chardev_write_len(BUFFER_SIZE - 1, 10), (ssize_t)1);
+    KUNIT_EXPECT_EQ(test, chardev_write_len(BUFFER_SIZE, 1), (ssize_t)-ENOSPC);
+    KUNIT_EXPECT_EQ(test, chardev_write_len(BUFFER_SIZE * 2, 1), (ssize_t)-ENOSPC);
+    KUNIT_EXPECT_EQ(test, chardev_write_len(10, 0), (ssize_t)0);
+}
+
+/*
+ * Buffer growth: the data size only ever moves forward until a reset
+ */
+static void chardev_test_extend(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+
+    chardev_extend(ctx->data, 10);
+    KUNIT_EXPECT_EQ(test, ctx->data->buffer_size, (size_t)10);
+
+    chardev_extend(ctx->data, 5);
+    KUNIT_EXPECT_EQ(test, ctx->data->buffer_size, (size_t)10);
+
+    chardev_extend(ctx->data, BUFFER_SIZE);
+    KUNIT_EXPECT_EQ(test, ctx->data->buffer_size, (size_t)BUFFER_SIZE);
+}
+
+/*
+ * ioctl paths that do not touch user memory
+ */
+static void chardev_test_ioctl_reset(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+
+    memset(ctx->data->buffer, 'x', BUFFER_SIZE);
+    ctx->data->buffer_size = BUFFER_SIZE;
+    ctx->data->flag = 7;
+
+    KUNIT_EXPECT_EQ(test, chardev_ioctl(&ctx->file, IOCTL_RESET, 0), 0L);
+    KUNIT_EXPECT_EQ(test, ctx->data->buffer_size, (size_t)0);
+    KUNIT_EXPECT_EQ(test, ctx->data->flag, 0);
+    KUNIT_EXPECT_EQ(test, ctx->data->buffer[0], (char)0);
+    KUNIT_EXPECT_EQ(test, ctx->data->buffer[BUFFER_SIZE - 1], (char)0);
+}
+
+static void chardev_test_ioctl_invalid(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+
+    KUNIT_EXPECT_EQ(test, chardev_ioctl(&ctx->file, _IO('c', 99), 0), (long)-EINVAL);
+    KUNIT_EXPECT_EQ(test, chardev_ioctl(&ctx->file, _IO('x', 1), 0), (long)-EINVAL);
+}
+
+/*
+ * Queueing delay: only the first read after a write counts
+ */
+static void chardev_test_stamps(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+    struct chardev_data *data = ctx->data;
+
+    chardev_stamp_write(data, 60, 10);
+    KUNIT_EXPECT_NE(test, data->enqueue_ns[0], (u64)0);
+    KUNIT_EXPECT_NE(test, data->enqueue_ns[1], (u64)0);
+    KUNIT_EXPECT_EQ(test, data->enqueue_ns[2], (u64)0);
+
+    chardev_stamp_read(data, 0, 64);
+    KUNIT_EXPECT_NE(test, data->dequeue_ns[0], (u64)0);
+    KUNIT_EXPECT_EQ(test, data->dequeue_ns[1], (u64)0);
+    KUNIT_EXPECT_EQ(test, chardev_test_stats(test)->queue_delay.count, (u64)1);
+
+    chardev_stamp_read(data, 0, 128);
+    chardev_stamp_read(data, 200, 10);
+    KUNIT_EXPECT_EQ(test, chardev_test_stats(test)->queue_delay.count, (u64)2);
+
+    chardev_stamp_read(data, 0, 0);
+    KUNIT_EXPECT_EQ(test, chardev_test_stats(test)->queue_delay.count, (u64)2);
+}
+
+static void chardev_test_hist(struct kunit *test)
+{
+    struct chardev_hist h = {}, sum;
+
+    chardev_hist_add(&h, 0);
+    chardev_hist_add(&h, 1);
+    chardev_hist_add(&h, 1000);
+    chardev_hist_add(&h, ~0ULL);
+    KUNIT_EXPECT_EQ(test, h.buckets[0], (u64)1);
+    KUNIT_EXPECT_EQ(test, h.buckets[1], (u64)1);
+    KUNIT_EXPECT_EQ(test, h.buckets[10], (u64)1);
+    KUNIT_EXPECT_EQ(test, h.buckets[HIST_BUCKETS - 1], (u64)1);
+    KUNIT_EXPECT_EQ(test, h.count, (u64)4);
+    KUNIT_EXPECT_EQ(test, h.max, ~0ULL);
+
+    /* Per-CPU copies fold into one */
+    memset(&sum, 0, sizeof(sum));
+    chardev_hist_add(&sum, 1000);
+    chardev_hist_merge(&sum, &h);
+    KUNIT_EXPECT_EQ(test, sum.buckets[10], (u64)2);
+    KUNIT_EXPECT_EQ(test, sum.count, (u64)5);
+    KUNIT_EXPECT_EQ(test, sum.sum, h.sum + 1000);
+    KUNIT_EXPECT_EQ(test, sum.max, ~0ULL);
+}
+
+/*
+ * SLO watchdog: percentiles come from bucket bounds; 0 disables a threshold
+ */
+static void chardev_test_slo(struct kunit *test)
+{
+    unsigned int p99_us = slo_p99_us, fill = slo_fill_pct, blocked = slo_blocked_readers;
+    struct chardev_hist h = {};
+    int i;
+
+    KUNIT_EXPECT_EQ(test, chardev_hist_percentile(&h, 99), (u64)0);
+    for (i = 0; i < 99; i++)
+        chardev_hist_add(&h, 100);
+    chardev_hist_add(&h, 100000);
+    KUNIT_EXPECT_EQ(test, chardev_hist_percentile(&h, 99), (u64)128);
+    KUNIT_EXPECT_EQ(test, chardev_hist_percentile(&h, 100), (u64)131072);
+
+    WRITE_ONCE(slo_p99_us, 0);
+    WRITE_ONCE(slo_fill_pct, 0);
+    WRITE_ONCE(slo_blocked_readers, 0);
+    KUNIT_EXPECT_EQ(test, chardev_slo_reasons(~0ULL, 100, 1000), 0U);
+
+    WRITE_ONCE(slo_p99_us, 10);
+    WRITE_ONCE(slo_fill_pct, 50);
+    WRITE_ONCE(slo_blocked_readers, 2);
+    KUNIT_EXPECT_EQ(test, chardev_slo_reasons(10000, 49, 1), 0U);
+    KUNIT_EXPECT_EQ(test, chardev_slo_reasons(10001, 50, 2),
+                    (unsigned int)(SLO_P99 | SLO_FILL | SLO_BLOCKED));
+
+    WRITE_ONCE(slo_p99_us, p99_us);
+    WRITE_ONCE(slo_fill_pct, fill);
+    WRITE_ONCE(slo_blocked_readers, blocked);
+}
+
+/*
+ * Lock statistics: recorded only while the static branch is on
+ */
+static void chardev_test_lock_stats(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+    struct chardev_lock_stats *stats;
+    u64 locked, blocked = 0;
+
+    KUNIT_ASSERT_EQ(test, chardev_lock(ctx->data, LOCK_OP_READ, &locked, &blocked), 0);
+    chardev_unlock(ctx->data, LOCK_OP_READ, locked);
+    KUNIT_EXPECT_EQ(test, chardev_test_stats(test)->lock_stats.wait[LOCK_OP_READ].count, (u64)0);
+
+    static_branch_enable(&chardev_lock_stats_key);
+    KUNIT_ASSERT_EQ(test, chardev_lock(ctx->data, LOCK_OP_WRITE, &locked, &blocked), 0);
+    KUNIT_EXPECT_NE(test, locked, (u64)0);
+    chardev_unlock(ctx->data, LOCK_OP_WRITE, locked);
+    static_branch_disable(&chardev_lock_stats_key);
+
+    stats = &chardev_test_stats(test)->lock_stats;
+    KUNIT_EXPECT_EQ(test, stats->wait[LOCK_OP_WRITE].count, (u64)1);
+    KUNIT_EXPECT_EQ(test, stats->hold[LOCK_OP_WRITE].count, (u64)1);
+    KUNIT_EXPECT_EQ(test, stats->hold[LOCK_OP_READ].count, (u64)0);
+}
+
+/*
+ * Record ring: records are stored in order, stamped, wrap, and are dropped
+ * when full
+ */
+static void chardev_test_ring(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+    struct chardev_ring_ctrl *ctrl;
+    struct chardev_ring_record rec;
+    char payload[900], *ring;
+    u64 size = CHARDEV_RING_RECORD_SIZE(sizeof(payload));
+    u64 before = ktime_get_ns();
+    int i;
+
+    KUNIT_ASSERT_EQ(test, chardev_ring_alloc(ctx->data, 1), 0);
+    ctrl = ctx->data->ring;
+    ring = (char *)ctrl + ctrl->ctrl_size;
+    KUNIT_EXPECT_EQ(test, ctrl->data_size, (u32)PAGE_SIZE);
+
+    memset(payload, 'p', sizeof(payload));
+    for (i = 0; i < PAGE_SIZE / size; i++)
+        KUNIT_EXPECT_TRUE(test, chardev_ring_append(ctx->data, CHARDEV_RECORD_DATA, 0,
+                                                    payload, sizeof(payload)));
+    KUNIT_EXPECT_FALSE(test, chardev_ring_append(ctx->data, CHARDEV_RECORD_DATA, 0,
+                                                 payload, sizeof(payload)));
+    KUNIT_EXPECT_EQ(test, ctrl->dropped, (u64)1);
+    KUNIT_EXPECT_EQ(test, ctrl->head, (PAGE_SIZE / size) * size);
+
+    memcpy(&rec, ring + size, sizeof(rec));
+    KUNIT_EXPECT_EQ(test, rec.len, (u32)sizeof(payload));
+    KUNIT_EXPECT_EQ(test, rec.type, (u16)CHARDEV_RECORD_DATA);
+    KUNIT_EXPECT_EQ(test, rec.seq, (u64)1);
+    KUNIT_EXPECT_GE(test, rec.ktime_ns, before);
+    KUNIT_EXPECT_LE(test, rec.ktime_ns, ktime_get_ns());
+
+    /* Free one record: the next one starts near the end and wraps */
+    ctrl->tail = size;
+    payload[sizeof(payload) - 1] = 'e';
+    KUNIT_EXPECT_TRUE(test, chardev_ring_append(ctx->data, CHARDEV_RECORD_DATA,
+                                                CHARDEV_RECORD_F_SHORT,
+                                                payload, sizeof(payload)));
+    KUNIT_EXPECT_EQ(test, ring[(ctrl->head - size + sizeof(rec) + sizeof(payload) - 1) &
+                               (PAGE_SIZE - 1)], 'e');
+
+    /* The dropped record used up a sequence number */
+    memcpy(&rec, ring + ((ctrl->head - size) & (PAGE_SIZE - 1)), sizeof(rec));
+    KUNIT_EXPECT_EQ(test, rec.seq, PAGE_SIZE / size + 1);
+    KUNIT_EXPECT_EQ(test, rec.flags, (u16)CHARDEV_RECORD_F_SHORT);
+
+    /* A tail ahead of head is never trusted */
+    ctrl->tail = ctrl->head + 8;
+    KUNIT_EXPECT_FALSE(test, chardev_ring_append(ctx->data, CHARDEV_RECORD_DATA, 0, payload, 1));
+
+    chardev_ring_free(ctx->data);
+    KUNIT_EXPECT_FALSE(test, chardev_ring_append(ctx->data, CHARDEV_RECORD_DATA, 0, payload, 1));
+}
+
+/* Log records as replay checks and applies them; no file involved */
+static void chardev_test_wal(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+    struct chardev_wal_record rec = {
+        .magic = WAL_MAGIC, .len = 5, .type = WAL_WRITE, .arg = 10,
+    };
+    char payload[] = "hello";
+    u32 crc;
+
+    crc = chardev_wal_crc(&rec, payload);
+    payload[0] = 'j';
+    KUNIT_EXPECT_NE(test, chardev_wal_crc(&rec, payload), crc);
+    rec.arg = 11;
+    KUNIT_EXPECT_NE(test, chardev_wal_crc(&rec, "hello"), crc);
+
+    KUNIT_EXPECT_EQ(test, chardev_wal_apply(ctx->data, &rec, payload), 0);
+    KUNIT_EXPECT_EQ(test, ctx->data->buffer_size, (size_t)16);
+    KUNIT_EXPECT_EQ(test, memcmp(ctx->data->buffer + 11, "jello", 5), 0);
+
+    rec.arg = BUFFER_SIZE - 4;
+    KUNIT_EXPECT_EQ(test, chardev_wal_apply(ctx->data, &rec, payload), -EINVAL);
+    KUNIT_EXPECT_EQ(test, ctx->data->buffer_size, (size_t)16);
+
+    rec = (struct chardev_wal_record){ .type = WAL_FLAG, .arg = (u32)-3 };
+    KUNIT_EXPECT_EQ(test, chardev_wal_apply(ctx->data, &rec, NULL), 0);
+    KUNIT_EXPECT_EQ(test, ctx->data->flag, -3);
+
+    rec.type = WAL_RESET;
+    KUNIT_EXPECT_EQ(test, chardev_wal_apply(ctx->data, &rec, NULL), 0);
+    KUNIT_EXPECT_EQ(test, ctx->data->buffer_size, (size_t)0);
+    KUNIT_EXPECT_EQ(test, ctx->data->flag, 0);
+
+    rec.type = 0;
+    KUNIT_EXPECT_EQ(test, chardev_wal_apply(ctx->data, &rec, NULL), -EINVAL);
+}
+
+/* Snapshot images built by hand, raw and LZ4, then damaged */
+static void chardev_test_snapshot_parse(struct kunit *test)
+{
+    struct chardev_snapshot_header *hdr;
+    struct chardev_snapshot_instance *inst;
+    struct chardev_snapshot_entry *entries;
+    char *image, data[BUFFER_SIZE];
+    void *wrkmem;
+    size_t len;
+    int stored;
+
+    image = kunit_kzalloc(test, SNAPSHOT_MAX, GFP_KERNEL);
+    entries = kunit_kzalloc(test, num_devices * sizeof(*entries), GFP_KERNEL);
+    wrkmem = kunit_kzalloc(test, LZ4_MEM_COMPRESS, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, image);
+    KUNIT_ASSERT_NOT_NULL(test, entries);
+    KUNIT_ASSERT_NOT_NULL(test, wrkmem);
+
+    memset(data, 'z', sizeof(data));
+    hdr = (struct chardev_snapshot_header *)image;
+    *hdr = (struct chardev_snapshot_header){
+        .magic = CHARDEV_SNAPSHOT_MAGIC, .version = CHARDEV_SNAPSHOT_VERSION,
+        .instances = 1, .buffer_size = BUFFER_SIZE,
+    };
+    inst = (struct chardev_snapshot_instance *)(hdr + 1);
+    *inst = (struct chardev_snapshot_instance){
+        .flag = -1, .size = 100, .stored = 100, .crc = crc32_le(~0, (u8 *)data, 100),
+    };
+    memcpy(inst + 1, data, 100);
+    len = sizeof(*hdr) + sizeof(*inst) + ALIGN(100, CHARDEV_SNAPSHOT_ALIGN);
+
+    KUNIT_EXPECT_EQ(test, chardev_snapshot_parse(image, len, entries), 0);
+    KUNIT_EXPECT_TRUE(test, entries[0].present);
+    KUNIT_EXPECT_EQ(test, entries[0].flag, -1);
+    KUNIT_EXPECT_EQ(test, entries[0].size, (u32)100);
+    KUNIT_EXPECT_EQ(test, memcmp(entries[0].data, data, 100), 0);
+
+    /* Cut short, or stored bytes that are not the data */
+    KUNIT_EXPECT_EQ(test, chardev_snapshot_parse(image, len - 40, entries), -EINVAL);
+    ((char *)(inst + 1))[50] ^= 1;
+    KUNIT_EXPECT_EQ(test, chardev_snapshot_parse(image, len, entries), -EBADMSG);
+
+    /* Compressed: a run of one byte shrinks to a handful */
+    stored = LZ4_compress_default(data, (char *)(inst + 1), 100,
+                                  LZ4_COMPRESSBOUND(BUFFER_SIZE), wrkmem);
+    KUNIT_ASSERT_GT(test, stored, 0);
+    KUNIT_EXPECT_LT(test, stored, 100);
+    inst->stored = stored;
+    len = sizeof(*hdr) + sizeof(*inst) + ALIGN(stored, CHARDEV_SNAPSHOT_ALIGN);
+    memset(entries, 0, sizeof(*entries));
+    KUNIT_EXPECT_EQ(test, chardev_snapshot_parse(image, len, entries), 0);
+    KUNIT_EXPECT_EQ(test, memcmp(entries[0].data, data, 100), 0);
+
+    inst->size = 99;
+    KUNIT_EXPECT_EQ(test, chardev_snapshot_parse(image, len, entries), -EBADMSG);
+    inst->size = 100;
+
+    /* Instances this module does not have are skipped, not refused */
+    inst->minor = MAX_DEVICES;
+    memset(entries, 0, sizeof(*entries));
+    KUNIT_EXPECT_EQ(test, chardev_snapshot_parse(image, len, entries), 0);
+    KUNIT_EXPECT_FALSE(test, entries[0].present);
+
+    /* Version 1 files, without access counts, still load */
+    hdr->version = 1;
+    KUNIT_EXPECT_EQ(test, chardev_snapshot_parse(image, len, entries), 0);
+    hdr->version = CHARDEV_SNAPSHOT_VERSION + 1;
+    KUNIT_EXPECT_EQ(test, chardev_snapshot_parse(image, len, entries), -EINVAL);
+}
+
+static void chardev_test_restore_order(struct kunit *test)
+{
+    struct chardev_restore_rank ranks[] = {
+        { .accesses = 5, .minor = 0 },
+        { .accesses = 0, .minor = 1 },
+        { .accesses = 900, .minor = 2 },
+        { .accesses = 5, .minor = 3 },
+        { .accesses = U32_MAX, .minor = 4 },
+    };
+    static const u32 expect[] = { 4, 2, 0, 3, 1 };
+    size_t i;
+
+    /* Busiest first; equally busy ones by minor */
+    sort(ranks, ARRAY_SIZE(ranks), sizeof(ranks[0]), chardev_restore_cmp, NULL);
+    for (i = 0; i < ARRAY_SIZE(expect); i++)
+        KUNIT_EXPECT_EQ(test, ranks[i].minor, expect[i]);
+}
+
+/* An asynchronous pair without its thread: the queue is drained by hand */
+static void chardev_test_mirror(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+    struct chardev_data *primary = ctx->data, *standby;
+    unsigned int queue_max = mirror_queue_max;
+    struct chardev_mirror *m;
+    int i;
+
+    standby = kunit_kzalloc(test, sizeof(*standby), GFP_KERNEL);
+    m = kunit_kzalloc(test, sizeof(*m), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, standby);
+    KUNIT_ASSERT_NOT_NULL(test, m);
+    mutex_init(&standby->lock);
+    m->primary = primary;
+    m->standby = standby;
+    m->mode = CHARDEV_MIRROR_ASYNC;
+    init_waitqueue_head(&m->wait);
+    spin_lock_init(&m->lock);
+    INIT_LIST_HEAD(&m->queue);
+    primary->mirror = m;
+
+    memcpy(primary->buffer, "abc", 3);
+    chardev_extend(primary, 3);
+    chardev_mirror_record(primary, WAL_WRITE, 0, primary->buffer, 3);
+    KUNIT_EXPECT_EQ(test, m->queued, (u64)1);
+    KUNIT_EXPECT_EQ(test, m->pending_bytes, (u64)3);
+    KUNIT_EXPECT_EQ(test, standby->buffer_size, (size_t)0);
+    KUNIT_EXPECT_NE(test, m->behind_ns, (u64)0);
+
+    chardev_mirror_drain(m);
+    KUNIT_EXPECT_EQ(test, m->applied, (u64)1);
+    KUNIT_EXPECT_EQ(test, m->pending_bytes, (u64)0);
+    KUNIT_EXPECT_EQ(test, m->behind_ns, (u64)0);
+    KUNIT_EXPECT_EQ(test, standby->buffer_size, (size_t)3);
+    KUNIT_EXPECT_EQ(test, memcmp(standby->buffer, "abc", 3), 0);
+
+    /* One past the limit drops the queue and asks for a full copy */
+    mirror_queue_max = 2;
+    for (i = 1; i <= 3; i++) {
+        primary->flag = i;
+        chardev_mirror_record(primary, WAL_FLAG, i, NULL, 0);
+    }
+    KUNIT_EXPECT_TRUE(test, m->resync);
+    KUNIT_EXPECT_TRUE(test, list_empty(&m->queue));
+    KUNIT_EXPECT_EQ(test, m->queued, (u64)4);
+
+    chardev_mirror_drain(m);
+    KUNIT_EXPECT_FALSE(test, m->resync);
+    KUNIT_EXPECT_EQ(test, m->applied, m->queued);
+    KUNIT_EXPECT_EQ(test, m->resyncs, (u64)1);
+    KUNIT_EXPECT_EQ(test, standby->flag, 3);
+
+    mirror_queue_max = queue_max;
+    primary->mirror = NULL;
+}
+
+static struct kunit_case chardev_test_cases[] = {
+    KUNIT_CASE(chardev_test_read_len),
+    KUNIT_CASE(chardev_test_write_len),
+    KUNIT_CASE(chardev_test_extend),
+    KUNIT_CASE(chardev_test_ioctl_reset),
+    KUNIT_CASE(chardev_test_ioctl_invalid),
+    KUNIT_CASE(chardev_test_stamps),
+    KUNIT_CASE(chardev_test_hist),
+    KUNIT_CASE(chardev_test_slo),
+    KUNIT_CASE(chardev_test_lock_stats),
+    KUNIT_CASE(chardev_test_ring),
+    KUNIT_CASE(chardev_test_wal),
+    KUNIT_CASE(chardev_test_snapshot_parse),
+    KUNIT_CASE(chardev_test_restore_order),
+    KUNIT_CASE(chardev_test_mirror),
+    {}
+};
+
+static struct kunit_suite chardev_test_suite = {
+    .name = "chardev",
+    .init = chardev_test_init,
+    .exit = chardev_test_exit,
+    .test_cases = chardev_test_cases,
+};
+
+/*
+ * Microbenchmarks
+ *
+ * Each case runs CHARDEV_BENCH_ITERATIONS operations and logs ns/op and,
+ * where the architecture has a cycle counter, cycles/op.
+ */
+static void chardev_bench_report(struct kunit *test, const char *what,
+                                 u64 ns, cycles_t cycles)
+{
+    if (cycles)
+        kunit_info(test, "%s: %llu ns/op, %llu cycles/op\n", what,
+                   div_u64(ns, CHARDEV_BENCH_ITERATIONS),
+                   div_u64((u64)cycles, CHARDEV_BENCH_ITERATIONS));
+    else
+        kunit_info(test, "%s: %llu ns/op\n", what,
+                   div_u64(ns, CHARDEV_BENCH_ITERATIONS));
+}
+
+/* Copy into the backing store, the work copy_from_user does after checks */
+static void chardev_bench_copy(struct kunit *test)
+{
+    static const size_t sizes[] = { 64, 256, BUFFER_SIZE };
+    struct chardev_test_ctx *ctx = test->priv;
+    char *src, label[32];
+    cycles_t c0, c1;
+    u64 t0, t1;
+    size_t i;
+    int n;
+
+    src = kunit_kzalloc(test, BUFFER_SIZE, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_ERR_OR_NULL(test, src);
+    memset(src, 'b', BUFFER_SIZE);
+
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        t0 = ktime_get_ns();
+        c0 = get_cycles();
+        for (n = 0; n < CHARDEV_BENCH_ITERATIONS; n++) {
+            memcpy(ctx->data->buffer, src, sizes[i]);
+            barrier();
+        }
+        c1 = get_cycles();
+        t1 = ktime_get_ns();
+
+        snprintf(label, sizeof(label), "copy %zu bytes", sizes[i]);
+        chardev_bench_report(test, label, t1 - t0, c1 - c0);
+    }
+}
+
+/* Uncontended acquire/release of the device lock as read/write/ioctl do it */
+static void chardev_bench_lock(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+    cycles_t c0, c1;
+    u64 t0, t1;
+    int n;
+
+    t0 = ktime_get_ns();
+    c0 = get_cycles();
+    for (n = 0; n < CHARDEV_BENCH_ITERATIONS; n++) {
+        if (mutex_lock_interruptible(&ctx->data->lock))
+            break;
+        mutex_unlock(&ctx->data->lock);
+    }
+    c1 = get_cycles();
+    t1 = ktime_get_ns();
+
+    KUNIT_EXPECT_EQ(test, n, CHARDEV_BENCH_ITERATIONS);
+    chardev_bench_report(test, "lock/unlock", t1 - t0, c1 - c0);
+}
+
+/* Offset math and size bookkeeping of one read plus one write */
+static void chardev_bench_bookkeeping(struct kunit *test)
+{
+    struct chardev_test_ctx *ctx = test->priv;
+    size_t total = 0;
+    cycles_t c0, c1;
+    u64 t0, t1;
+    int n;
+
+    t0 = ktime_get_ns();
+    c0 = get_cycles();
+    for (n = 0; n < CHARDEV_BENCH_ITERATIONS; n++) {
+        loff_t pos = n & (BUFFER_SIZE - 1);
+
+        total += chardev_write_len(pos, 64);
+        chardev_extend(ctx->data, pos + 64);
+        total += chardev_read_len(ctx->data, pos, 64);
+        barrier();
+    }
+    c1 = get_cycles();
+    t1 = ktime_get_ns();
+
+    KUNIT_EXPECT_GT(test, total, (size_t)0);
+    chardev_bench_report(test, "read+write bookkeeping", t1 - t0, c1 - c0);
+}
+
+static struct kunit_case chardev_bench_cases[] = {
+    KUNIT_CASE(chardev_bench_copy),
+    KUNIT_CASE(chardev_bench_lock),
+    KUNIT_CASE(chardev_bench_bookkeeping),
+    {}
+};
+
+static struct kunit_suite chardev_bench_suite = {
+    .name = "chardev_bench",
+    .init = chardev_test_init,
+    .exit = chardev_test_exit,
+    .test_cases = chardev_bench_cases,
+};
+
+kunit_test_suites(&chardev_test_suite, &chardev_bench_suite);
@@ -0,0 +1,119 @@
+/*
+ * Tracepoints for the Character Device Driver
+ *
+ * One event per file operation, with the file it came through, so a trace
+ * can be turned back into the same sequence of system calls. Enable with
+ *   echo 1 > /sys/kernel/tracing/events/chardev/enable
+ * or let 'test_chardev record' do it.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM chardev
+
+#if !defined(_CHARDEV_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _CHARDEV_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(chardev_file,
+
+    TP_PROTO(const struct file *file, unsigned int minor),
+
+    TP_ARGS(file, minor),
+
+    TP_STRUCT__entry(
+        __field(const void *, file)
+        __field(unsigned int, minor)
+    ),
+
+    TP_fast_assign(
+        __entry->file = file;
+        __entry->minor = minor;
+    ),
+
+    TP_printk("file=%p minor=%u", __entry->file, __entry->minor)
+);
+
+DEFINE_EVENT(chardev_file, chardev_open,
+    TP_PROTO(const struct file *file, unsigned int minor),
+    TP_ARGS(file, minor)
+);
+
+DEFINE_EVENT(chardev_file, chardev_release,
+    TP_PROTO(const struct file *file, unsigned int minor),
+    TP_ARGS(file, minor)
+);
+
+DECLARE_EVENT_CLASS(chardev_rw,
+
+    TP_PROTO(const struct file *file, unsigned int minor, loff_t pos,
+             size_t count, ssize_t ret),
+
+    TP_ARGS(file, minor, pos, count, ret),
+
+    TP_STRUCT__entry(
+        __field(const void *, file)
+        __field(unsigned int, minor)
+        __field(loff_t, pos)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->file = file;
+        __entry->minor = minor;
+        __entry->pos = pos;
+        __entry->count = count;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("file=%p minor=%u pos=%lld count=%zu ret=%zd", __entry->file,
+              __entry->minor, (long long)__entry->pos, __entry->count, __entry->ret)
+);
+
+DEFINE_EVENT(chardev_rw, chardev_read,
+    TP_PROTO(const struct file *file, unsigned int minor, loff_t pos,
+             size_t count, ssize_t ret),
+    TP_ARGS(file, minor, pos, count, ret)
+);
+
+DEFINE_EVENT(chardev_rw, chardev_write,
+    TP_PROTO(const struct file *file, unsigned int minor, loff_t pos,
+             size_t count, ssize_t ret),
+    TP_ARGS(file, minor, pos, count, ret)
+);
+
+TRACE_EVENT(chardev_ioctl,
+
+    TP_PROTO(const struct file *file, unsigned int minor, unsigned int cmd,
+             int value, long ret),
+
+    TP_ARGS(file, minor, cmd, value, ret),
+
+    TP_STRUCT__entry(
+        __field(const void *, file)
+        __field(unsigned int, minor)
+        __field(unsigned int, cmd)
+        __field(int, value)
+        __field(long, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->file = file;
+        __entry->minor = minor;
+        __entry->cmd = cmd;
+        __entry->value = value;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("file=%p minor=%u cmd=0x%x value=%d ret=%ld", __entry->file,
+              __entry->minor, __entry->cmd, __entry->value, __entry->ret)
+);
+
+#endif /* _CHARDEV_TRACE_H */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE chardev_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,280 @@
+/*
+ * Character Device Driver: user-space API
+ *
+ * Shared by the kernel module, the test tools and libchardev, so ioctl
+ * numbers and argument layouts are declared exactly once. Only fixed-width
+ * types, so the layout is the same for 32- and 64-bit callers.
+ */
+#ifndef _CHARDEV_UAPI_H
+#define _CHARDEV_UAPI_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define CHARDEV_BUFFER_SIZE 1024
+#define CHARDEV_IOC_MAGIC   'c'
+
+/* Most entries one IOCTL_WRITE_BATCH accepts */
+#define CHARDEV_BATCH_MAX   64
+
+/*
+ * IOCTL_SELFTEST_BENCH argument. The caller fills in the inputs; the driver
+ * times each loop with ktime_get_ns() and returns the total nanoseconds, so
+ * ns/op is <name>_ns / iterations.
+ */
+struct chardev_selftest_bench {
+    __u32 iterations;       /* in: loop count, 0 for the default; out: used */
+    __u32 copy_size;        /* in: bytes per copy, 0 for BUFFER_SIZE; out: used */
+    __u64 user_buffer;      /* in: copy_size bytes of user memory, 0 to skip */
+    __u64 memcpy_ns;        /* out: memcpy into a buffer like the backing store */
+    __u64 page_alloc_ns;    /* out: alloc_page() + __free_page() */
+    __u64 lock_ns;          /* out: device mutex lock + unlock */
+    __u64 copy_to_user_ns;  /* out: copy_to_user() into the pinned user buffer */
+};
+
+/* One positioned write of an IOCTL_WRITE_BATCH */
+struct chardev_batch_entry {
+    __u64 buf;              /* user address of the data */
+    __u64 offset;           /* device offset to write at */
+    __u32 len;              /* bytes to write */
+    __u32 reserved;         /* must be 0 */
+};
+
+/*
+ * IOCTL_WRITE_BATCH argument: count writes applied in order under one lock
+ * acquisition. Returns the number of entries written; like writev(), an
+ * error is only returned if the first entry fails.
+ */
+struct chardev_batch {
+    __u64 entries;          /* user address of struct chardev_batch_entry[count] */
+    __u32 count;            /* 1..CHARDEV_BATCH_MAX */
+    __u32 reserved;         /* must be 0 */
+};
+
+/*
+ * IOCTL_GET_STAMP: when the data at an offset was last written and when
+ * it was first read after that, both ktime_get_ns(). The driver keeps one
+ * pair per CHARDEV_STAMP_BLOCK bytes; dequeue_ns is 0 while unread.
+ */
+#define CHARDEV_STAMP_BLOCK     64
+
+struct chardev_stamp {
+    __u64 offset;           /* in: byte offset in the buffer */
+    __u64 enqueue_ns;       /* out: last write to the block, 0 if never */
+    __u64 dequeue_ns;       /* out: first read since then, 0 if none */
+};
+
+/*
+ * Record ring (module parameter ring_pages)
+ *
+ * mmap() of the device exposes a control page at offset 0 followed by
+ * data_size bytes of ring data. Every successful write() is also appended
+ * to the ring as a record: a struct chardev_ring_record header, then the
+ * written bytes, padded to CHARDEV_RING_ALIGN. The header is stamped by
+ * the driver with the write's time and a per-instance sequence number;
+ * a gap in the sequence marks dropped records. head and tail are
+ * free-running byte positions; a record starts at data[pos % data_size]
+ * and may wrap. The driver only moves head, the consumer only moves tail.
+ * Records that do not fit in the free space are dropped and counted.
+ */
+#define CHARDEV_RING_VERSION    2
+#define CHARDEV_RING_ALIGN      8
+#define CHARDEV_RING_MAX_PAGES  1024
+
+#define CHARDEV_RECORD_DATA     1   /* payload of one write() */
+
+#define CHARDEV_RECORD_F_SHORT  0x0001  /* fewer bytes stored than were written */
+#define CHARDEV_RECORD_F_BATCH  0x0002  /* from an IOCTL_WRITE_BATCH entry */
+#define CHARDEV_RECORD_F_TEE    0x0004  /* fanned out from a write to another instance */
+
+struct chardev_ring_ctrl {
+    __u32 version;          /* CHARDEV_RING_VERSION */
+    __u32 ctrl_size;        /* bytes before the data area (one page) */
+    __u32 data_size;        /* ring data bytes, a power of two */
+    __u32 reserved;
+    __u64 dropped;          /* records lost because the ring was full */
+    __u8  pad0[40];
+    __u64 head;             /* driver: end of the newest record */
+    __u8  pad1[56];
+    __u64 tail;             /* consumer: start of the oldest unread record */
+    __u8  pad2[56];
+};
+
+/* 24 bytes, no holes, 8-byte aligned in the ring */
+struct chardev_ring_record {
+    __u32 len;              /* payload bytes following the header */
+    __u16 type;             /* CHARDEV_RECORD_* */
+    __u16 flags;            /* CHARDEV_RECORD_F_* */
+    __u64 ktime_ns;         /* ktime_get_ns() when the write was stored */
+    __u64 seq;              /* per-instance, counts dropped records too */
+};
+
+/* Ring bytes taken by a record with len payload bytes */
+#define CHARDEV_RING_RECORD_SIZE(len) \
+    ((sizeof(struct chardev_ring_record) + (len) + CHARDEV_RING_ALIGN - 1) & \
+     ~(__u64)(CHARDEV_RING_ALIGN - 1))
+
+/*
+ * Statistics snapshot (IOCTL_GET_STATS, <debugfs>/chardev/<device>/stats)
+ *
+ * IOCTL_GET_STATS, or one read() of the stats file, returns a struct
+ * chardev_stats for the instance. It is gathered from per-CPU counters
+ * without taking the instance lock; each CPU's share is consistent in
+ * itself (a histogram's count matches its buckets), and the call neither
+ * waits for nor is counted among the instance's operations. Histograms
+ * are log2: bucket i counts values v with fls64(v) == i, i.e. v < 2^i ns,
+ * and the last bucket also takes everything larger. New fields are only
+ * ever appended and version changes only when existing fields change.
+ *
+ * The size encoded in the ioctl number is the caller's struct
+ * chardev_stats, so a binary built against an older header keeps its
+ * number and gets the fields it knows; IOCTL_GET_STATS_SIZE(n) asks for
+ * the first n bytes explicitly. size is what the driver has, so a reader
+ * built against a newer header can tell which fields it did not get. The
+ * stats file always holds the driver's whole struct.
+ */
+#define CHARDEV_STATS_VERSION   1
+#define CHARDEV_HIST_BUCKETS    40
+
+/* Indices of lock_wait[] and lock_hold[] */
+#define CHARDEV_LOCK_READ       0
+#define CHARDEV_LOCK_WRITE      1
+#define CHARDEV_LOCK_IOCTL      2
+#define CHARDEV_LOCK_OPS        3
+
+/* slo_breached: thresholds the SLO watchdog last reported broken */
+#define CHARDEV_SLO_P99         0x1
+#define CHARDEV_SLO_FILL        0x2
+#define CHARDEV_SLO_BLOCKED     0x4
+
+struct chardev_stats_hist {
+    __u64 count;
+    __u64 sum;              /* ns */
+    __u64 max;              /* ns */
+    __u64 buckets[CHARDEV_HIST_BUCKETS];
+};
+
+struct chardev_stats {
+    __u32 version;          /* CHARDEV_STATS_VERSION */
+    __u32 size;             /* sizeof(struct chardev_stats) of the driver */
+    __u64 ktime_ns;         /* when the snapshot was taken */
+    __u64 buffer_size;      /* bytes of data held */
+    __s32 flag;             /* IOCTL_SET_FLAG value */
+    __u32 lock_stats;       /* 1 if lock_wait/lock_hold are being collected */
+    __u64 reads;            /* read() calls */
+    __u64 writes;           /* write() calls */
+    __u64 ioctls;           /* ioctl() calls */
+    __u64 bytes_read;
+    __u64 bytes_written;
+    __u64 ring_records;     /* records offered to the ring, dropped ones included */
+    __u64 ring_dropped;
+    __u32 slo_breached;     /* CHARDEV_SLO_* of the last SLO uevent, 0 if none */
+    __u32 reserved;
+    struct chardev_stats_hist queue_delay;
+    struct chardev_stats_hist lock_wait[CHARDEV_LOCK_OPS];
+    struct chardev_stats_hist lock_hold[CHARDEV_LOCK_OPS];
+    __u64 tee_errors;       /* copies to tee sinks that failed */
+};
+
+/*
+ * Snapshot files (IOCTL_SAVE, IOCTL_LOAD, the snapshot_path parameter)
+ *
+ * A struct chardev_snapshot_header, then for each instance a struct
+ * chardev_snapshot_instance followed by its data: stored bytes, either
+ * the data itself (stored == size) or an LZ4 block that decompresses to
+ * it, zero-padded to a multiple of CHARDEV_SNAPSHOT_ALIGN. Host byte order.
+ */
+#define CHARDEV_SNAPSHOT_MAGIC      0x50414e53  /* "SNAP" */
+#define CHARDEV_SNAPSHOT_VERSION    2
+#define CHARDEV_SNAPSHOT_ALIGN      8
+
+#define CHARDEV_SNAPSHOT_LZ4        0x1     /* compress instances where it helps */
+
+struct chardev_snapshot_header {
+    __u32 magic;            /* CHARDEV_SNAPSHOT_MAGIC */
+    __u16 version;          /* CHARDEV_SNAPSHOT_VERSION */
+    __u16 flags;            /* CHARDEV_SNAPSHOT_* it was saved with */
+    __u32 instances;        /* entries that follow */
+    __u32 buffer_size;      /* CHARDEV_BUFFER_SIZE of the driver that saved it */
+    __u64 realtime_ns;      /* when it was saved, CLOCK_REALTIME */
+};
+
+struct chardev_snapshot_instance {
+    __u32 minor;
+    __s32 flag;
+    __u32 size;             /* bytes of data held */
+    __u32 stored;           /* bytes that follow, before padding */
+    __u32 crc;              /* crc32 (~0 seed, no final xor) of the data */
+    __u32 accesses;         /* reads and writes served, saturating; 0 before version 2 */
+};
+
+/* IOCTL_SAVE and IOCTL_LOAD argument */
+struct chardev_snapshot_req {
+    __u64 path;             /* user pointer to a NUL-terminated file name */
+    __u32 flags;            /* CHARDEV_SNAPSHOT_* for IOCTL_SAVE, 0 for IOCTL_LOAD */
+    __u32 reserved;
+};
+
+/*
+ * Mirroring (IOCTL_SET_MIRROR on the primary, IOCTL_PROMOTE on the standby)
+ *
+ * The standby starts as a copy of the primary and then receives every
+ * change made to it. It refuses changes of its own with EROFS until it
+ * is promoted or the primary stops mirroring.
+ */
+#define CHARDEV_MIRROR_OFF          0
+#define CHARDEV_MIRROR_SYNC         1   /* applied to the standby before the change returns */
+#define CHARDEV_MIRROR_ASYNC        2   /* queued and applied by a kernel thread */
+
+struct chardev_mirror_req {
+    __u32 standby;          /* minor of the instance to mirror to */
+    __u32 mode;             /* CHARDEV_MIRROR_* */
+};
+
+/* IOCTL_GET_MIRROR: the pair this instance belongs to, from either end */
+struct chardev_mirror_status {
+    __s32 primary;          /* minor this instance follows, -1 if none */
+    __s32 standby;          /* minor following this instance, -1 if none */
+    __u32 mode;             /* CHARDEV_MIRROR_*, OFF if in no pair */
+    __u32 pending;          /* changes not yet applied to the standby */
+    __u64 queued;           /* changes sent to the standby */
+    __u64 applied;          /* of those, applied (or covered by a resync) */
+    __u64 pending_bytes;    /* data waiting in the queue */
+    __u64 lag_ns;           /* age of the oldest change not yet applied, 0 if none */
+    __u64 max_lag_ns;       /* longest a change has waited to be applied */
+    __u64 resyncs;          /* full copies after the queue overflowed */
+};
+
+/*
+ * Tee (IOCTL_SET_TEE, IOCTL_GET_TEE on the source)
+ *
+ * Every write to the source, including batch entries, also lands at the
+ * same offset in each sink. A sink cannot be a source itself. A sink whose
+ * copy fails (its log record could not be written) is left out from then
+ * on; the write to the source still succeeds. Setting the tee again
+ * brings it back.
+ */
+struct chardev_tee {
+    __u64 sinks;            /* bit n set: minor n is a sink; 0 for none */
+    __u64 failed;           /* out: sinks left out after a failed copy */
+};
+
+/* IOCTL commands */
+#define IOCTL_RESET          _IO(CHARDEV_IOC_MAGIC, 1)
+#define IOCTL_GET_SIZE       _IOR(CHARDEV_IOC_MAGIC, 2, int)
+#define IOCTL_SET_FLAG       _IOW(CHARDEV_IOC_MAGIC, 3, int)
+#define IOCTL_GET_FLAG       _IOR(CHARDEV_IOC_MAGIC, 4, int)
+#define IOCTL_SELFTEST_BENCH _IOWR(CHARDEV_IOC_MAGIC, 5, struct chardev_selftest_bench)
+#define IOCTL_WRITE_BATCH    _IOW(CHARDEV_IOC_MAGIC, 6, struct chardev_batch)
+#define IOCTL_GET_STAMP      _IOWR(CHARDEV_IOC_MAGIC, 7, struct chardev_stamp)
+#define IOCTL_GET_STATS      _IOR(CHARDEV_IOC_MAGIC, 8, struct chardev_stats)
+#define IOCTL_GET_STATS_SIZE(n) _IOC(_IOC_READ, CHARDEV_IOC_MAGIC, 8, n)
+#define IOCTL_SAVE           _IOW(CHARDEV_IOC_MAGIC, 9, struct chardev_snapshot_req)
+#define IOCTL_LOAD           _IOW(CHARDEV_IOC_MAGIC, 10, struct chardev_snapshot_req)
+#define IOCTL_SET_MIRROR     _IOW(CHARDEV_IOC_MAGIC, 11, struct chardev_mirror_req)
+#define IOCTL_GET_MIRROR     _IOR(CHARDEV_IOC_MAGIC, 12, struct chardev_mirror_status)
+#define IOCTL_PROMOTE        _IO(CHARDEV_IOC_MAGIC, 13)
+#define IOCTL_SET_TEE        _IOW(CHARDEV_IOC_MAGIC, 14, struct chardev_tee)
+#define IOCTL_GET_TEE        _IOR(CHARDEV_IOC_MAGIC, 15, struct chardev_tee)
+
+#endif /* _CHARDEV_UAPI_H */
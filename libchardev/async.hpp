@@ -0,0 +1,467 @@
+/*
+ * libchardev: C++20 coroutine client on io_uring
+ *
+ *   chardev::EventLoop loop;
+ *   chardev::AsyncDevice dev(loop, device);
+ *
+ *   chardev::Task<> worker(chardev::AsyncDevice &dev) {
+ *       std::size_t n = co_await dev.read(buf, 0);
+ *       co_await dev.write(reply, 0);
+ *   }
+ *
+ *   loop.spawn(worker(dev));
+ *   loop.run();
+ *
+ * Each EventLoop owns one io_uring and is driven by one thread; use one
+ * loop per thread to spread work. Awaiting a read or write queues a
+ * submission entry and suspends; run() submits everything queued with one
+ * io_uring_enter(), reaps completions and resumes their coroutines. When the
+ * ring is full, further operations wait on an intrusive list inside their
+ * own awaiters, so any number can be outstanding without allocating.
+ *
+ * Uses the raw system calls; no liburing needed.
+ */
+#ifndef LIBCHARDEV_ASYNC_HPP
+#define LIBCHARDEV_ASYNC_HPP
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "libchardev/chardev.hpp"
+
+namespace chardev {
+
+/*
+ * Lazily started coroutine that can be co_awaited once
+ */
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            return h.promise().continuation;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+    void return_value(T v) { value.emplace(std::move(v)); }
+
+    T result()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object() noexcept;
+    void return_void() const noexcept {}
+
+    void result()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+} // namespace detail
+
+template <typename T>
+class Task {
+public:
+    using promise_type = detail::Promise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> h) noexcept : handle_(h) {}
+    Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    Task &operator=(Task &&) = delete;
+
+    ~Task()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+
+    /* Start the task; it resumes the awaiter when it finishes */
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+
+    T await_resume() { return handle_.promise().result(); }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+/* Eagerly started, self-destroying wrapper that EventLoop::spawn() uses */
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+} // namespace detail
+
+/*
+ * Minimal io_uring: maps the rings, hands out SQEs, submits and reaps
+ */
+class Ring {
+public:
+    explicit Ring(unsigned entries)
+    {
+        io_uring_params p{};
+
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+        if (fd_ < 0)
+            throw_errno("io_uring_setup");
+
+        sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+
+        sq_ = ::mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd_, IORING_OFF_SQ_RING);
+        cq_ = ::mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd_, IORING_OFF_CQ_RING);
+        sqes_ = static_cast<io_uring_sqe *>(::mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE, fd_,
+                                                   IORING_OFF_SQES));
+        if (sq_ == MAP_FAILED || cq_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+            int err = errno;
+
+            unmap();
+            ::close(fd_);
+            errno = err;
+            throw_errno("io_uring mmap");
+        }
+
+        sq_head_ = field(sq_, p.sq_off.head);
+        sq_tail_ = field(sq_, p.sq_off.tail);
+        sq_mask_ = *field(sq_, p.sq_off.ring_mask);
+        sq_array_ = field(sq_, p.sq_off.array);
+        cq_head_ = field(cq_, p.cq_off.head);
+        cq_tail_ = field(cq_, p.cq_off.tail);
+        cq_mask_ = *field(cq_, p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(static_cast<char *>(cq_) + p.cq_off.cqes);
+        sq_entries_ = p.sq_entries;
+        cq_entries_ = p.cq_entries;
+    }
+
+    Ring(const Ring &) = delete;
+    Ring &operator=(const Ring &) = delete;
+
+    ~Ring()
+    {
+        unmap();
+        ::close(fd_);
+    }
+
+    unsigned cq_entries() const noexcept { return cq_entries_; }
+    unsigned queued() const noexcept { return queued_; }
+
+    /* Next free submission entry, zeroed, or nullptr if the SQ is full */
+    io_uring_sqe *get_sqe() noexcept
+    {
+        unsigned head = std::atomic_ref(*sq_head_).load(std::memory_order_acquire);
+        unsigned tail = *sq_tail_ + queued_;
+        io_uring_sqe *sqe;
+
+        if (tail - head >= sq_entries_)
+            return nullptr;
+
+        sqe = &sqes_[tail & sq_mask_];
+        *sqe = io_uring_sqe{};
+        sq_array_[tail & sq_mask_] = tail & sq_mask_;
+        queued_++;
+        return sqe;
+    }
+
+    /* Publish queued entries and enter the kernel, waiting for wait completions */
+    void submit_and_wait(unsigned wait)
+    {
+        long ret;
+
+        std::atomic_ref(*sq_tail_).store(*sq_tail_ + queued_, std::memory_order_release);
+        unsubmitted_ += std::exchange(queued_, 0);
+
+        do {
+            ret = ::syscall(__NR_io_uring_enter, fd_, unsubmitted_, wait,
+                            wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        } while (ret < 0 && errno == EINTR);
+
+        /* EBUSY: completions must be reaped before more can be submitted */
+        if (ret < 0 && errno != EBUSY)
+            throw_errno("io_uring_enter");
+        if (ret > 0)
+            unsubmitted_ -= static_cast<unsigned>(ret);
+    }
+
+    /* Call fn(user_data, res) for every completion available now */
+    template <typename Fn>
+    unsigned reap(Fn &&fn)
+    {
+        unsigned head = *cq_head_, count = 0;
+        unsigned tail = std::atomic_ref(*cq_tail_).load(std::memory_order_acquire);
+
+        while (head != tail) {
+            io_uring_cqe cqe = cqes_[head & cq_mask_];
+
+            /* Free the slot before running the coroutine, which may submit more */
+            std::atomic_ref(*cq_head_).store(++head, std::memory_order_release);
+            fn(cqe.user_data, cqe.res);
+            count++;
+            tail = std::atomic_ref(*cq_tail_).load(std::memory_order_acquire);
+            head = *cq_head_;
+        }
+        return count;
+    }
+
+private:
+    static unsigned *field(void *base, unsigned offset)
+    {
+        return reinterpret_cast<unsigned *>(static_cast<char *>(base) + offset);
+    }
+
+    void unmap() noexcept
+    {
+        if (sq_ && sq_ != MAP_FAILED)
+            ::munmap(sq_, sq_len_);
+        if (cq_ && cq_ != MAP_FAILED)
+            ::munmap(cq_, cq_len_);
+        if (sqes_ && sqes_ != MAP_FAILED)
+            ::munmap(sqes_, sqes_len_);
+    }
+
+    int fd_ = -1;
+    void *sq_ = nullptr;
+    void *cq_ = nullptr;
+    io_uring_sqe *sqes_ = nullptr;
+    std::size_t sq_len_ = 0, cq_len_ = 0, sqes_len_ = 0;
+    unsigned *sq_head_, *sq_tail_, *sq_array_, *cq_head_, *cq_tail_;
+    io_uring_cqe *cqes_;
+    unsigned sq_mask_, cq_mask_, sq_entries_, cq_entries_;
+    unsigned queued_ = 0;       /* prepared, tail not yet published */
+    unsigned unsubmitted_ = 0;  /* published, not yet consumed by the kernel */
+};
+
+class EventLoop;
+
+/*
+ * One read or write; lives in the awaiting coroutine's frame
+ */
+class IoOp {
+public:
+    IoOp(EventLoop &loop, int fd, std::uint8_t opcode, void *buf, std::size_t len,
+         off_t offset) noexcept
+        : loop_(loop), fd_(fd), opcode_(opcode), buf_(buf),
+          len_(static_cast<unsigned>(len)), offset_(static_cast<std::uint64_t>(offset))
+    {
+    }
+
+    bool await_ready() const noexcept { return false; }
+    inline void await_suspend(std::coroutine_handle<> h);
+
+    std::size_t await_resume() const
+    {
+        if (result_ < 0) {
+            errno = -result_;
+            throw_errno(opcode_ == IORING_OP_READ ? "io_uring read" : "io_uring write");
+        }
+        return static_cast<std::size_t>(result_);
+    }
+
+private:
+    friend class EventLoop;
+
+    EventLoop &loop_;
+    int fd_;
+    std::uint8_t opcode_;
+    void *buf_;
+    unsigned len_;
+    std::uint64_t offset_;
+    int result_ = 0;
+    std::coroutine_handle<> handle_;
+    IoOp *next_ = nullptr;
+};
+
+class EventLoop {
+public:
+    explicit EventLoop(unsigned entries = 4096) : ring_(entries) {}
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    /* Start task now; run() keeps going until it and every other one finished */
+    void spawn(Task<> task)
+    {
+        live_++;
+        detach(std::move(task), *this);
+    }
+
+    /* Drive submissions and completions until no spawned task is left */
+    void run()
+    {
+        while (live_ > 0) {
+            while (waiting_ && try_queue(waiting_))
+                waiting_ = std::exchange(waiting_->next_, nullptr);
+
+            if (!ring_.queued() && in_flight_ == 0)
+                break;  /* every task is blocked on something that is not I/O */
+
+            /* Every task is waiting on I/O, so block for at least one completion */
+            ring_.submit_and_wait(1);
+            ring_.reap([this](std::uint64_t user_data, int res) {
+                IoOp *op = reinterpret_cast<IoOp *>(user_data);
+
+                in_flight_--;
+                op->result_ = res;
+                op->handle_.resume();
+            });
+        }
+    }
+
+    std::size_t in_flight() const noexcept { return in_flight_; }
+
+    /* Tasks that ended with an exception */
+    std::size_t failed() const noexcept { return failed_; }
+
+private:
+    friend class IoOp;
+
+    static detail::Detached detach(Task<> task, EventLoop &loop)
+    {
+        try {
+            co_await task;
+        } catch (...) {
+            loop.failed_++;
+        }
+        loop.live_--;
+    }
+
+    /* Queue op on the ring; false if the SQ or the CQ budget is full */
+    bool try_queue(IoOp *op) noexcept
+    {
+        io_uring_sqe *sqe;
+
+        if (in_flight_ >= ring_.cq_entries())
+            return false;
+        sqe = ring_.get_sqe();
+        if (!sqe)
+            return false;
+
+        sqe->opcode = op->opcode_;
+        sqe->fd = op->fd_;
+        sqe->addr = reinterpret_cast<std::uintptr_t>(op->buf_);
+        sqe->len = op->len_;
+        sqe->off = op->offset_;
+        sqe->user_data = reinterpret_cast<std::uintptr_t>(op);
+        in_flight_++;
+        return true;
+    }
+
+    void submit(IoOp *op) noexcept
+    {
+        if (!waiting_ && try_queue(op))
+            return;
+
+        /* Keep submission order: append to the wait list */
+        if (waiting_)
+            waiting_tail_->next_ = op;
+        else
+            waiting_ = op;
+        waiting_tail_ = op;
+    }
+
+    Ring ring_;
+    IoOp *waiting_ = nullptr;
+    IoOp *waiting_tail_ = nullptr;
+    std::size_t in_flight_ = 0;
+    std::size_t live_ = 0;
+    std::size_t failed_ = 0;
+};
+
+inline void IoOp::await_suspend(std::coroutine_handle<> h)
+{
+    handle_ = h;
+    loop_.submit(this);
+}
+
+/*
+ * A Device driven through an EventLoop
+ */
+class AsyncDevice {
+public:
+    AsyncDevice(EventLoop &loop, const Device &dev) noexcept : loop_(loop), fd_(dev.fd()) {}
+
+    /* co_await yields the byte count; errors are thrown as std::system_error */
+    IoOp read(std::span<std::byte> buf, off_t offset = 0) const noexcept
+    {
+        return IoOp(loop_, fd_, IORING_OP_READ, buf.data(), buf.size(), offset);
+    }
+
+    IoOp write(std::span<const std::byte> buf, off_t offset = 0) const noexcept
+    {
+        return IoOp(loop_, fd_, IORING_OP_WRITE, const_cast<std::byte *>(buf.data()),
+                    buf.size(), offset);
+    }
+
+private:
+    EventLoop &loop_;
+    int fd_;
+};
+
+} // namespace chardev
+
+#endif /* LIBCHARDEV_ASYNC_HPP */
@@ -0,0 +1,390 @@
+/*
+ * libchardev: header-only C++ client for the Character Device Driver
+ *
+ * RAII device handles, typed ioctls encoded at compile time from the shared
+ * UAPI header, and a write batcher that turns many small writes into one
+ * IOCTL_WRITE_BATCH. Nothing here allocates on the heap; errors are thrown
+ * as std::system_error carrying the errno of the failed call.
+ *
+ * Build with -std=c++20 and the repository root on the include path.
+ */
+#ifndef LIBCHARDEV_CHARDEV_HPP
+#define LIBCHARDEV_CHARDEV_HPP
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "chardev_uapi.h"
+
+namespace chardev {
+
+inline constexpr const char *default_path = "/dev/chardev";
+inline constexpr std::size_t buffer_size = CHARDEV_BUFFER_SIZE;
+inline constexpr std::size_t batch_max = CHARDEV_BATCH_MAX;
+
+[[noreturn]] inline void throw_errno(const char *what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+/*
+ * Typed ioctls
+ *
+ * Each command carries its direction and argument type, and its request
+ * number is computed with the kernel's _IOC encoding at compile time. The
+ * static_asserts below tie every one back to the UAPI header.
+ */
+enum class Dir : unsigned {
+    none = _IOC_NONE,
+    read = _IOC_READ,
+    write = _IOC_WRITE,
+    read_write = _IOC_READ | _IOC_WRITE,
+};
+
+template <Dir D, unsigned Nr, typename T = void>
+struct Ioctl {
+    using value_type = T;
+    static constexpr Dir dir = D;
+    static constexpr unsigned long request =
+        _IOC(static_cast<unsigned>(D), CHARDEV_IOC_MAGIC, Nr, sizeof(T));
+};
+
+template <Dir D, unsigned Nr>
+struct Ioctl<D, Nr, void> {
+    using value_type = void;
+    static constexpr Dir dir = D;
+    static constexpr unsigned long request = _IOC(static_cast<unsigned>(D), CHARDEV_IOC_MAGIC, Nr, 0);
+};
+
+namespace ioctl {
+inline constexpr Ioctl<Dir::none, 1> reset{};
+inline constexpr Ioctl<Dir::read, 2, int> get_size{};
+inline constexpr Ioctl<Dir::write, 3, int> set_flag{};
+inline constexpr Ioctl<Dir::read, 4, int> get_flag{};
+inline constexpr Ioctl<Dir::read_write, 5, chardev_selftest_bench> selftest_bench{};
+inline constexpr Ioctl<Dir::write, 6, chardev_batch> write_batch{};
+inline constexpr Ioctl<Dir::read_write, 7, chardev_stamp> get_stamp{};
+inline constexpr Ioctl<Dir::read, 8, chardev_stats> get_stats{};
+inline constexpr Ioctl<Dir::write, 9, chardev_snapshot_req> save{};
+inline constexpr Ioctl<Dir::write, 10, chardev_snapshot_req> load{};
+inline constexpr Ioctl<Dir::write, 11, chardev_mirror_req> set_mirror{};
+inline constexpr Ioctl<Dir::read, 12, chardev_mirror_status> get_mirror{};
+inline constexpr Ioctl<Dir::none, 13> promote{};
+inline constexpr Ioctl<Dir::write, 14, chardev_tee> set_tee{};
+inline constexpr Ioctl<Dir::read, 15, chardev_tee> get_tee{};
+} // namespace ioctl
+
+static_assert(ioctl::reset.request == IOCTL_RESET);
+static_assert(ioctl::get_size.request == IOCTL_GET_SIZE);
+static_assert(ioctl::set_flag.request == IOCTL_SET_FLAG);
+static_assert(ioctl::get_flag.request == IOCTL_GET_FLAG);
+static_assert(ioctl::selftest_bench.request == IOCTL_SELFTEST_BENCH);
+static_assert(ioctl::write_batch.request == IOCTL_WRITE_BATCH);
+static_assert(ioctl::get_stamp.request == IOCTL_GET_STAMP);
+static_assert(ioctl::get_stats.request == IOCTL_GET_STATS);
+static_assert(ioctl::save.request == IOCTL_SAVE);
+static_assert(ioctl::load.request == IOCTL_LOAD);
+static_assert(ioctl::set_mirror.request == IOCTL_SET_MIRROR);
+static_assert(ioctl::get_mirror.request == IOCTL_GET_MIRROR);
+static_assert(ioctl::promote.request == IOCTL_PROMOTE);
+static_assert(ioctl::set_tee.request == IOCTL_SET_TEE);
+static_assert(ioctl::get_tee.request == IOCTL_GET_TEE);
+
+/*
+ * An open device node; closes it on destruction. Move-only.
+ */
+class Device {
+public:
+    explicit Device(const char *path = default_path, int flags = O_RDWR)
+        : fd_(::open(path, flags | O_CLOEXEC))
+    {
+        if (fd_ < 0)
+            throw_errno("open");
+    }
+
+    /* Adopt an already open descriptor */
+    static Device adopt(int fd) noexcept { return Device(fd); }
+
+    Device(Device &&other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+
+    Device &operator=(Device &&other) noexcept
+    {
+        if (this != &other) {
+            close();
+            fd_ = std::exchange(other.fd_, -1);
+        }
+        return *this;
+    }
+
+    Device(const Device &) = delete;
+    Device &operator=(const Device &) = delete;
+
+    ~Device() { close(); }
+
+    int fd() const noexcept { return fd_; }
+    explicit operator bool() const noexcept { return fd_ >= 0; }
+
+    void close() noexcept
+    {
+        if (fd_ >= 0)
+            ::close(std::exchange(fd_, -1));
+    }
+
+    /* Positioned I/O; returns the byte count, which may be short at the end of data */
+    std::size_t read(std::span<std::byte> buf, off_t offset = 0) const
+    {
+        ssize_t ret;
+
+        do {
+            ret = ::pread(fd_, buf.data(), buf.size(), offset);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0)
+            throw_errno("pread");
+        return static_cast<std::size_t>(ret);
+    }
+
+    std::size_t write(std::span<const std::byte> buf, off_t offset = 0) const
+    {
+        ssize_t ret;
+
+        do {
+            ret = ::pwrite(fd_, buf.data(), buf.size(), offset);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0)
+            throw_errno("pwrite");
+        return static_cast<std::size_t>(ret);
+    }
+
+    /* Commands without an argument */
+    template <unsigned Nr>
+    long call(Ioctl<Dir::none, Nr>) const
+    {
+        return checked(::ioctl(fd_, Ioctl<Dir::none, Nr>::request));
+    }
+
+    /* Commands the kernel fills in */
+    template <unsigned Nr, typename T>
+    T call(Ioctl<Dir::read, Nr, T>) const
+    {
+        T value{};
+
+        checked(::ioctl(fd_, Ioctl<Dir::read, Nr, T>::request, &value));
+        return value;
+    }
+
+    /* Commands that pass a value in */
+    template <unsigned Nr, typename T>
+    long call(Ioctl<Dir::write, Nr, T>, const T &value) const
+    {
+        return checked(::ioctl(fd_, Ioctl<Dir::write, Nr, T>::request, &value));
+    }
+
+    /* Commands that take and update a struct */
+    template <unsigned Nr, typename T>
+    long call(Ioctl<Dir::read_write, Nr, T>, T &value) const
+    {
+        return checked(::ioctl(fd_, Ioctl<Dir::read_write, Nr, T>::request, &value));
+    }
+
+    void reset() const { call(ioctl::reset); }
+    int size() const { return call(ioctl::get_size); }
+    int flag() const { return call(ioctl::get_flag); }
+    void set_flag(int value) const { call(ioctl::set_flag, value); }
+
+    /* Last write and first read after it of the data at offset (ktime ns) */
+    chardev_stamp stamp(off_t offset) const
+    {
+        chardev_stamp s{.offset = static_cast<std::uint64_t>(offset), .enqueue_ns = 0, .dequeue_ns = 0};
+
+        call(ioctl::get_stamp, s);
+        return s;
+    }
+
+    /* Counters and histograms of the instance, without taking its lock */
+    chardev_stats stats() const { return call(ioctl::get_stats); }
+
+    /* Every instance to or from a snapshot file, named as the driver sees it (CAP_SYS_ADMIN) */
+    void save(const char *path, bool compress = true) const
+    {
+        call(ioctl::save, chardev_snapshot_req{
+            .path = reinterpret_cast<std::uintptr_t>(path),
+            .flags = compress ? CHARDEV_SNAPSHOT_LZ4 : 0u,
+            .reserved = 0,
+        });
+    }
+
+    void load(const char *path) const
+    {
+        call(ioctl::load, chardev_snapshot_req{
+            .path = reinterpret_cast<std::uintptr_t>(path), .flags = 0, .reserved = 0,
+        });
+    }
+
+    /* Replicate this instance to minor @standby; CHARDEV_MIRROR_OFF lets it go (CAP_SYS_ADMIN) */
+    void mirror_to(unsigned standby, std::uint32_t mode = CHARDEV_MIRROR_ASYNC) const
+    {
+        call(ioctl::set_mirror, chardev_mirror_req{.standby = standby, .mode = mode});
+    }
+
+    /* The pair this instance is in, from either end, with its replication lag */
+    chardev_mirror_status mirror_status() const { return call(ioctl::get_mirror); }
+
+    /* On a standby: apply what the primary sent, then stand alone (CAP_SYS_ADMIN) */
+    void promote() const { call(ioctl::promote); }
+
+    /* Fan this instance's writes out to the minors set in @sinks; 0 stops it (CAP_SYS_ADMIN) */
+    void tee(std::uint64_t sinks) const
+    {
+        call(ioctl::set_tee, chardev_tee{.sinks = sinks, .failed = 0});
+    }
+    std::uint64_t tee_sinks() const { return call(ioctl::get_tee).sinks; }
+    /* Sinks left out after a failed copy, until tee() is called again */
+    std::uint64_t tee_failed() const { return call(ioctl::get_tee).failed; }
+
+private:
+    explicit Device(int fd) noexcept : fd_(fd) {}
+
+    static long checked(long ret)
+    {
+        if (ret < 0)
+            throw_errno("ioctl");
+        return ret;
+    }
+
+    int fd_ = -1;
+};
+
+/*
+ * Collects small positioned writes and submits them together
+ *
+ * Data is copied into an inline arena so callers may reuse their buffers
+ * at once; a write that continues the previous one is merged into its
+ * entry. The batch goes out as one IOCTL_WRITE_BATCH when the entries or
+ * the arena run out, on flush(), or on destruction. Against a driver
+ * without the ioctl it falls back to one pwrite per entry.
+ */
+template <std::size_t MaxEntries = batch_max, std::size_t ArenaBytes = 4096>
+class WriteBatcher {
+    static_assert(MaxEntries >= 1 && MaxEntries <= batch_max,
+                  "IOCTL_WRITE_BATCH takes at most CHARDEV_BATCH_MAX entries");
+
+public:
+    explicit WriteBatcher(const Device &dev) noexcept : dev_(dev) {}
+
+    WriteBatcher(const WriteBatcher &) = delete;
+    WriteBatcher &operator=(const WriteBatcher &) = delete;
+
+    /* Destructors must not throw: whatever fails here is lost, call flush() first */
+    ~WriteBatcher()
+    {
+        try {
+            flush();
+        } catch (...) {
+        }
+    }
+
+    void write(std::span<const std::byte> data, off_t offset)
+    {
+        chardev_batch_entry *last;
+
+        /* Too big to stage: keep ordering, then write it directly */
+        if (data.size() > ArenaBytes) {
+            flush();
+            dev_.write(data, offset);
+            return;
+        }
+
+        if (used_ + data.size() > ArenaBytes)
+            flush();
+
+        /* The last entry always ends where the arena's free space starts */
+        last = count_ ? &entries_[count_ - 1] : nullptr;
+        if (last && last->offset + last->len == static_cast<std::uint64_t>(offset)) {
+            last->len += data.size();
+        } else {
+            if (count_ == MaxEntries)
+                flush();
+            entries_[count_++] = chardev_batch_entry{
+                .buf = address(used_),
+                .offset = static_cast<std::uint64_t>(offset),
+                .len = static_cast<std::uint32_t>(data.size()),
+                .reserved = 0,
+            };
+        }
+
+        std::memcpy(arena_.data() + used_, data.data(), data.size());
+        used_ += data.size();
+    }
+
+    void flush()
+    {
+        /* Whatever happens, the staged writes are not retried */
+        struct Clear {
+            WriteBatcher *batcher;
+            ~Clear() { batcher->clear(); }
+        } guard{this};
+        std::size_t done = 0;
+        long ret;
+
+        while (done < count_ && !fallback_) {
+            chardev_batch batch{
+                .entries = reinterpret_cast<std::uintptr_t>(&entries_[done]),
+                .count = static_cast<std::uint32_t>(count_ - done),
+                .reserved = 0,
+            };
+
+            ret = ::ioctl(dev_.fd(), ioctl::write_batch.request, &batch);
+            if (ret < 0 && errno == EINTR)
+                continue;
+            if (ret < 0 && (errno == ENOTTY || errno == EINVAL) && done == 0) {
+                fallback_ = true;
+                break;
+            }
+            if (ret <= 0)
+                throw_errno("IOCTL_WRITE_BATCH");
+            done += static_cast<std::size_t>(ret);
+        }
+
+        for (; done < count_; done++) {
+            const auto &e = entries_[done];
+
+            dev_.write({arena_.data() + (e.buf - address(0)), e.len},
+                       static_cast<off_t>(e.offset));
+        }
+    }
+
+    std::size_t pending() const noexcept { return count_; }
+
+private:
+    std::uint64_t address(std::size_t pos) const noexcept
+    {
+        return reinterpret_cast<std::uintptr_t>(arena_.data() + pos);
+    }
+
+    void clear() noexcept
+    {
+        count_ = 0;
+        used_ = 0;
+    }
+
+    const Device &dev_;
+    std::array<chardev_batch_entry, MaxEntries> entries_{};
+    std::array<std::byte, ArenaBytes> arena_{};
+    std::size_t count_ = 0;
+    std::size_t used_ = 0;
+    bool fallback_ = false;
+};
+
+} // namespace chardev
+
+#endif /* LIBCHARDEV_CHARDEV_HPP */
@@ -0,0 +1,349 @@
+/*
+ * libchardev: zero-copy reader for the driver's record ring
+ *
+ * With the module loaded with ring_pages=N, every write() is also appended
+ * to a ring the device exports through mmap() (layout in chardev_uapi.h).
+ * RingMapping maps it with the data area twice, back to back, so a record
+ * that wraps around the end of the ring is still contiguous in memory.
+ * Every record starts with the driver's packed header (length, type,
+ * flags, write time, sequence number). parse_records() splits a span of
+ * records into RecordViews; RecordRing hands batches of them out straight
+ * from the mapping; RingReader<Record> hands out each record in place as
+ * a const Record &. The space goes back to the driver once per call: no
+ * copies, no allocations, one store to the shared tail per batch.
+ *
+ * Records whose header does not describe a Record (another length or
+ * type) are skipped and counted.
+ */
+#ifndef LIBCHARDEV_RING_HPP
+#define LIBCHARDEV_RING_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+#include <sys/mman.h>
+#include <time.h>
+
+#include "libchardev/chardev.hpp"
+
+namespace chardev {
+
+/* The ring ABI the readers below are written against */
+static_assert(CHARDEV_RING_VERSION == 2, "written against ring version 2");
+static_assert(sizeof(chardev_ring_record) == 24 && CHARDEV_RING_ALIGN == 8,
+              "record headers are 24 bytes and records 8-byte aligned");
+static_assert(offsetof(chardev_ring_record, type) == 4 && offsetof(chardev_ring_record, flags) == 6 &&
+                  offsetof(chardev_ring_record, ktime_ns) == 8 && offsetof(chardev_ring_record, seq) == 16,
+              "record header fields are packed without holes");
+static_assert(offsetof(chardev_ring_ctrl, head) == 64 && offsetof(chardev_ring_ctrl, tail) == 128,
+              "head and tail live on their own cache lines");
+static_assert(CHARDEV_RING_RECORD_SIZE(0) == sizeof(chardev_ring_record) &&
+                  CHARDEV_RING_RECORD_SIZE(1) == 32,
+              "records are padded to CHARDEV_RING_ALIGN");
+
+/*
+ * The control page mapped read-write (the reader owns ctrl->tail) and the
+ * data area mapped read-only twice in a row. Move-only.
+ */
+class RingMapping {
+public:
+    explicit RingMapping(const Device &dev)
+    {
+        const long page = ::sysconf(_SC_PAGESIZE);
+        void *probe;
+
+        /* The control page says how much data follows */
+        probe = ::mmap(nullptr, page, PROT_READ, MAP_SHARED, dev.fd(), 0);
+        if (probe == MAP_FAILED)
+            throw_errno("mmap ring control");
+        const auto *ctrl = static_cast<const chardev_ring_ctrl *>(probe);
+        const std::uint32_t version = ctrl->version;
+        ctrl_size_ = ctrl->ctrl_size;
+        data_size_ = ctrl->data_size;
+        ::munmap(probe, page);
+
+        if (version != CHARDEV_RING_VERSION) {
+            errno = EPROTO;
+            throw_errno("ring version");
+        }
+
+        /* Reserve the whole range first so the fixed mappings land in it */
+        length_ = ctrl_size_ + 2 * data_size_;
+        base_ = ::mmap(nullptr, length_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base_ == MAP_FAILED) {
+            base_ = nullptr;
+            throw_errno("mmap ring reserve");
+        }
+
+        try {
+            map_fixed(dev, 0, ctrl_size_, PROT_READ | PROT_WRITE, 0);
+            map_fixed(dev, ctrl_size_, data_size_, PROT_READ, ctrl_size_);
+            map_fixed(dev, ctrl_size_ + data_size_, data_size_, PROT_READ, ctrl_size_);
+        } catch (...) {
+            unmap();
+            throw;
+        }
+    }
+
+    RingMapping(RingMapping &&other) noexcept
+        : base_(std::exchange(other.base_, nullptr)), length_(other.length_),
+          ctrl_size_(other.ctrl_size_), data_size_(other.data_size_)
+    {
+    }
+
+    RingMapping &operator=(RingMapping &&other) noexcept
+    {
+        if (this != &other) {
+            unmap();
+            base_ = std::exchange(other.base_, nullptr);
+            length_ = other.length_;
+            ctrl_size_ = other.ctrl_size_;
+            data_size_ = other.data_size_;
+        }
+        return *this;
+    }
+
+    RingMapping(const RingMapping &) = delete;
+    RingMapping &operator=(const RingMapping &) = delete;
+
+    ~RingMapping() { unmap(); }
+
+    chardev_ring_ctrl *ctrl() const noexcept { return static_cast<chardev_ring_ctrl *>(base_); }
+
+    /* data_size bytes, then the same bytes again */
+    const std::byte *data() const noexcept
+    {
+        return static_cast<const std::byte *>(base_) + ctrl_size_;
+    }
+
+    std::size_t data_size() const noexcept { return data_size_; }
+
+private:
+    void map_fixed(const Device &dev, std::size_t at, std::size_t len, int prot, off_t offset)
+    {
+        void *want = static_cast<std::byte *>(base_) + at;
+
+        if (::mmap(want, len, prot, MAP_SHARED | MAP_FIXED, dev.fd(), offset) == MAP_FAILED)
+            throw_errno("mmap ring");
+    }
+
+    void unmap() noexcept
+    {
+        if (base_)
+            ::munmap(std::exchange(base_, nullptr), length_);
+    }
+
+    void *base_ = nullptr;
+    std::size_t length_ = 0;
+    std::size_t ctrl_size_ = 0;
+    std::size_t data_size_ = 0;
+};
+
+/*
+ * One record where it lies: its header and its payload. Nothing is copied;
+ * a view is only as good as the memory under it.
+ */
+struct RecordView {
+    const chardev_ring_record *header;
+    std::span<const std::byte> payload;
+
+    std::uint16_t type() const noexcept { return header->type; }
+    std::uint16_t flags() const noexcept { return header->flags; }
+    std::uint64_t seq() const noexcept { return header->seq; }
+
+    /* ktime_get_ns() is CLOCK_MONOTONIC, so this compares with monotonic_ns() */
+    std::uint64_t ktime_ns() const noexcept { return header->ktime_ns; }
+    std::uint64_t age_ns(std::uint64_t now) const noexcept { return now - header->ktime_ns; }
+
+    /* The payload as a T, or nullptr if it is not exactly one */
+    template <typename T>
+    const T *as() const noexcept
+    {
+        static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= CHARDEV_RING_ALIGN);
+        return payload.size() == sizeof(T) ? reinterpret_cast<const T *>(payload.data()) : nullptr;
+    }
+};
+
+inline std::uint64_t monotonic_ns() noexcept
+{
+    timespec ts;
+
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Split records laid back to back (a span of the ring, or a saved copy of
+ * one) into views, up to out.size() of them. bytes must start on a record
+ * and be CHARDEV_RING_ALIGN aligned. Headers are fixed-size and every
+ * record starts 8-byte aligned, so the walk is one load and one add per
+ * record and never copies. Stops early at a record that is cut off; used
+ * is set to the bytes the returned views cover.
+ */
+inline std::size_t parse_records(std::span<const std::byte> bytes, std::span<RecordView> out,
+                                 std::size_t &used) noexcept
+{
+    std::size_t pos = 0, n = 0;
+
+    while (n < out.size() && bytes.size() - pos >= sizeof(chardev_ring_record)) {
+        const auto *hdr = reinterpret_cast<const chardev_ring_record *>(bytes.data() + pos);
+        const std::uint64_t size = CHARDEV_RING_RECORD_SIZE(hdr->len);
+
+        if (size > bytes.size() - pos)
+            break;
+        out[n++] = RecordView{hdr, bytes.subspan(pos + sizeof(*hdr), hdr->len)};
+        pos += size;
+    }
+
+    used = pos;
+    return n;
+}
+
+/*
+ * Untyped consumer: hands out batches of RecordViews straight from the
+ * mapping and gives their space back once per consume_batches() call.
+ */
+class RecordRing {
+public:
+    explicit RecordRing(const Device &dev) : map_(dev) {}
+
+    /*
+     * Call fn(std::span<const RecordView>) on batches of at most Batch
+     * records, up to max records in all, then move the tail once. The
+     * views are only valid inside fn. Returns the number of records.
+     */
+    template <std::size_t Batch = 64, typename Fn>
+    std::size_t consume_batches(Fn &&fn, std::size_t max = std::numeric_limits<std::size_t>::max())
+    {
+        const std::uint64_t head = head_ref().load(std::memory_order_acquire);
+        const std::uint64_t mask = map_.data_size() - 1;
+        std::uint64_t tail = tail_ref().load(std::memory_order_relaxed);
+        std::array<RecordView, Batch> views;
+        std::size_t n = 0, count, used;
+
+        /* More than a ring's worth pending means someone else moved the tail */
+        if (head - tail > map_.data_size()) {
+            corrupt_++;
+            tail = head;
+        }
+
+        while (tail != head && n < max) {
+            /* The second copy of the data keeps this span contiguous */
+            std::span<const std::byte> bytes(map_.data() + (tail & mask), head - tail);
+
+            count = parse_records(bytes, std::span(views).first(std::min(Batch, max - n)), used);
+
+            /* A length that runs past head cannot be resynchronised: drop the rest */
+            if (count == 0) {
+                corrupt_++;
+                tail = head;
+                break;
+            }
+
+            fn(std::span<const RecordView>(views.data(), count));
+            tail += used;
+            n += count;
+        }
+
+        tail_ref().store(tail, std::memory_order_release);
+        return n;
+    }
+
+    /* Throw away everything published so far */
+    void discard() noexcept
+    {
+        tail_ref().store(head_ref().load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    /* Bytes published and not yet consumed */
+    std::size_t backlog() const noexcept
+    {
+        return head_ref().load(std::memory_order_acquire) - tail_ref().load(std::memory_order_relaxed);
+    }
+
+    /* Ring data bytes */
+    std::size_t capacity() const noexcept { return map_.data_size(); }
+
+    /* Records the driver lost to a full ring */
+    std::uint64_t dropped() const noexcept
+    {
+        return std::atomic_ref(map_.ctrl()->dropped).load(std::memory_order_relaxed);
+    }
+
+    /* Times the ring held something unparseable and was skipped to head */
+    std::uint64_t corrupt() const noexcept { return corrupt_; }
+
+private:
+    std::atomic_ref<__u64> head_ref() const noexcept { return std::atomic_ref(map_.ctrl()->head); }
+    std::atomic_ref<__u64> tail_ref() const noexcept { return std::atomic_ref(map_.ctrl()->tail); }
+
+    RingMapping map_;
+    std::uint64_t corrupt_ = 0;
+};
+
+/*
+ * Typed consumer of the ring. Record must be a plain, trivially copyable
+ * type no more strictly aligned than the ring's payloads, and small enough
+ * for one write() to carry it.
+ */
+template <typename Record>
+class RingReader {
+    static_assert(std::is_trivially_copyable_v<Record>, "records are read in place from shared memory");
+    static_assert(alignof(Record) <= CHARDEV_RING_ALIGN &&
+                      sizeof(chardev_ring_record) % alignof(Record) == 0,
+                  "payloads are only CHARDEV_RING_ALIGN aligned");
+    static_assert(sizeof(Record) <= buffer_size, "a record must fit in a single write");
+
+public:
+    explicit RingReader(const Device &dev) : ring_(dev) {}
+
+    /*
+     * Call fn(const Record &) for each Record among up to max records
+     * published so far, then release their space with a single tail
+     * update. The reference is only valid inside fn. Returns the number
+     * of records passed to fn.
+     */
+    template <typename Fn>
+    std::size_t consume(Fn &&fn, std::size_t max = std::numeric_limits<std::size_t>::max())
+    {
+        std::size_t n = 0;
+
+        ring_.consume_batches([&](std::span<const RecordView> views) {
+            for (const auto &view : views) {
+                const Record *rec = view.type() == CHARDEV_RECORD_DATA ? view.as<Record>() : nullptr;
+
+                if (rec) {
+                    fn(*rec);
+                    n++;
+                } else {
+                    skipped_++;
+                }
+            }
+        }, max);
+        return n;
+    }
+
+    void discard() noexcept { ring_.discard(); }
+    std::size_t backlog() const noexcept { return ring_.backlog(); }
+    std::size_t capacity() const noexcept { return ring_.capacity(); }
+    std::uint64_t dropped() const noexcept { return ring_.dropped(); }
+
+    /* Records that were not a Record, and ring contents skipped as corrupt */
+    std::uint64_t skipped() const noexcept { return skipped_ + ring_.corrupt(); }
+
+private:
+    RecordRing ring_;
+    std::uint64_t skipped_ = 0;
+};
+
+} // namespace chardev
+
+#endif /* LIBCHARDEV_RING_HPP */
@@ -0,0 +1,305 @@
+/*
+ * Tests for libchardev against a loaded driver
+ *
+ *   ./test_libchardev [DEVICE]     (default /dev/chardev)
+ *
+ * Also counts heap allocations around the steady-state write, batch and
+ * ring paths, which must not allocate, and runs the coroutine client with
+ * many more operations outstanding than its io_uring holds. The ring test
+ * needs the module loaded with ring_pages set and is skipped otherwise.
+ */
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "libchardev/async.hpp"
+#include "libchardev/chardev.hpp"
+#include "libchardev/ring.hpp"
+
+#define ASYNC_THREADS   4
+#define ASYNC_TASKS     2500
+#define ASYNC_ROUNDS    4
+#define ASYNC_RING      256
+
+static int failures;
+static std::atomic<unsigned long> allocations;
+
+void *operator new(std::size_t size)
+{
+    allocations++;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+#define CHECK(cond, what)                                                   \
+    do {                                                                    \
+        if (cond) {                                                         \
+            std::printf("[PASS] %s\n", what);                               \
+        } else {                                                            \
+            std::printf("[FAIL] %s (%s:%d)\n", what, __FILE__, __LINE__);   \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static std::span<const std::byte> bytes(std::string_view s)
+{
+    return std::as_bytes(std::span(s.data(), s.size()));
+}
+
+static void test_device(const char *path)
+{
+    chardev::Device dev(path);
+    std::array<std::byte, 64> buf{};
+
+    dev.reset();
+    CHECK(dev.size() == 0, "reset clears the size");
+
+    CHECK(dev.write(bytes("Hello, libchardev"), 0) == 17, "write");
+    CHECK(dev.size() == 17, "size after write");
+    CHECK(dev.read(buf, 0) == 17 && std::memcmp(buf.data(), "Hello, libchardev", 17) == 0,
+          "read back");
+
+    dev.set_flag(42);
+    CHECK(dev.flag() == 42, "typed set_flag/get_flag");
+
+    auto stamp = dev.stamp(0);
+    CHECK(stamp.enqueue_ns != 0 && stamp.dequeue_ns >= stamp.enqueue_ns,
+          "read after write is stamped");
+
+    auto before = dev.stats();
+    dev.write(bytes("stat"), 0);
+    auto after = dev.stats();
+    CHECK(before.version == CHARDEV_STATS_VERSION && after.writes == before.writes + 1 &&
+              after.bytes_written == before.bytes_written + 4 && after.flag == 42,
+          "stats snapshot counts the write");
+
+    chardev::Device moved = std::move(dev);
+    CHECK(!dev && moved && moved.flag() == 42, "handles move");
+
+    try {
+        moved.write(bytes("x"), chardev::buffer_size);
+        CHECK(false, "write past the buffer throws");
+    } catch (const std::system_error &e) {
+        CHECK(e.code().value() == ENOSPC, "write past the buffer throws ENOSPC");
+    }
+}
+
+static void test_batcher(const char *path)
+{
+    chardev::Device dev(path);
+    std::array<std::byte, chardev::buffer_size> buf{};
+    unsigned long before;
+    char c;
+    int i;
+
+    dev.reset();
+    {
+        chardev::WriteBatcher<8, 256> batch(dev);
+
+        before = allocations;
+        /* Contiguous writes merge; the scattered ones fill entries and flush */
+        for (i = 0; i < 26; i++) {
+            c = static_cast<char>('a' + i);
+            batch.write(bytes({&c, 1}), i);
+        }
+        for (i = 0; i < 20; i++)
+            batch.write(bytes("#"), 100 + 10 * i);
+        batch.flush();
+        CHECK(allocations == before, "batching does not allocate");
+        CHECK(batch.pending() == 0, "flush empties the batch");
+    }
+
+    CHECK(dev.size() == 291, "batched writes extend the size");
+    dev.read(buf, 0);
+    CHECK(std::memcmp(buf.data(), "abcdefghijklmnopqrstuvwxyz", 26) == 0,
+          "merged writes land in order");
+    CHECK(buf[100] == std::byte{'#'} && buf[290] == std::byte{'#'} && buf[101] == std::byte{0},
+          "scattered writes land at their offsets");
+
+    {
+        chardev::WriteBatcher<> batch(dev);
+
+        batch.write(bytes("tail"), chardev::buffer_size - 2);
+        batch.write(bytes("late"), chardev::buffer_size + 10);
+        try {
+            batch.flush();
+            CHECK(false, "failing batch throws");
+        } catch (const std::system_error &e) {
+            CHECK(e.code().value() == ENOSPC, "failing batch entry throws ENOSPC");
+        }
+        CHECK(batch.pending() == 0, "failed batch is dropped");
+    }
+    CHECK(dev.size() == static_cast<int>(chardev::buffer_size), "partial batch applied");
+}
+
+struct Sample {
+    std::uint64_t seq;
+    char tag[8];
+};
+
+/* Records packed by hand as the driver lays them out */
+static void test_parse()
+{
+    alignas(8) std::array<std::byte, 256> buf{};
+    std::array<chardev::RecordView, 8> views;
+    std::size_t pos = 0, used, n;
+    std::uint64_t seq;
+
+    for (seq = 0; seq < 3; seq++) {
+        chardev_ring_record hdr{
+            .len = static_cast<std::uint32_t>(5 + seq), .type = CHARDEV_RECORD_DATA,
+            .flags = 0, .ktime_ns = 1000 + seq, .seq = seq,
+        };
+
+        std::memcpy(&buf[pos], &hdr, sizeof(hdr));
+        std::memcpy(&buf[pos + sizeof(hdr)], "payload", hdr.len);
+        pos += CHARDEV_RING_RECORD_SIZE(hdr.len);
+    }
+
+    n = chardev::parse_records(std::span(buf).first(pos), views, used);
+    CHECK(n == 3 && used == pos, "parse_records splits back-to-back records");
+    CHECK(views[2].seq() == 2 && views[2].ktime_ns() == 1002 && views[2].payload.size() == 7 &&
+              views[2].payload.data() == &buf[pos - CHARDEV_RING_RECORD_SIZE(7) + 24],
+          "views point into the buffer");
+
+    n = chardev::parse_records(std::span(buf).first(pos - 1), views, used);
+    CHECK(n == 2 && used == 2 * 32, "a cut-off record is left alone");
+    n = chardev::parse_records(std::span(buf).first(pos), std::span(views).first(1), used);
+    CHECK(n == 1 && used == 32, "parsing stops when the output is full");
+}
+
+/* Several ring's worth of records, so reads cross the wrap point many times */
+static void test_ring(const char *path)
+{
+    chardev::Device dev(path);
+    std::uint64_t seq = 0, expect = 0, bad = 0;
+    std::size_t per_ring;
+    unsigned long before;
+    int round;
+
+    try {
+        chardev::RingReader<Sample> reader(dev);
+
+        reader.discard();
+        dev.write(bytes("not a sample"), 0);
+        per_ring = reader.capacity() / CHARDEV_RING_RECORD_SIZE(sizeof(Sample));
+
+        before = allocations;
+        for (round = 0; round < 16; round++) {
+            for (std::size_t i = 0; i < per_ring / 2; i++) {
+                Sample s{.seq = seq++, .tag = "sample"};
+                dev.write(std::as_bytes(std::span(&s, 1)), 0);
+            }
+            reader.consume([&](const Sample &s) {
+                if (s.seq != expect++ || std::strcmp(s.tag, "sample") != 0)
+                    bad++;
+            });
+        }
+        CHECK(allocations == before, "consuming the ring does not allocate");
+        CHECK(expect == seq && bad == 0, "ring records arrive in order and intact");
+        CHECK(reader.skipped() == 1, "foreign record skipped");
+        CHECK(reader.dropped() == 0 && reader.backlog() == 0, "nothing dropped or left over");
+
+        /* The headers the typed reader hides */
+        chardev::RecordRing ring(dev);
+        std::uint64_t first = 0, last = 0, now;
+        std::size_t n;
+
+        dev.write(bytes("one"), 0);
+        dev.write(bytes("two"), 0);
+        now = chardev::monotonic_ns();
+        n = ring.consume_batches([&](std::span<const chardev::RecordView> views) {
+            first = views.front().seq();
+            last = views.back().seq();
+            bad += views.front().age_ns(now) > 1000000000ull;
+        });
+        CHECK(n == 2 && last == first + 1 && bad == 0, "records carry sequence numbers and times");
+    } catch (const std::system_error &e) {
+        if (e.code().value() != ENODEV)
+            throw;
+        std::printf("[SKIP] record ring (load with ring_pages=1)\n");
+    }
+}
+
+/* One record per task slot: write it, read it back, compare */
+static chardev::Task<bool> async_round(chardev::AsyncDevice &dev, int id, int round)
+{
+    std::array<std::byte, 16> out, in;
+    off_t offset = (id % (chardev::buffer_size / out.size())) * out.size();
+
+    out.fill(std::byte(id + round));
+    if (co_await dev.write(out, offset) != out.size())
+        co_return false;
+    co_return co_await dev.read(in, offset) == in.size();
+}
+
+static chardev::Task<> async_client(chardev::AsyncDevice &dev, int id, std::atomic<long> &ok)
+{
+    int round;
+
+    for (round = 0; round < ASYNC_ROUNDS; round++) {
+        if (co_await async_round(dev, id, round))
+            ok++;
+    }
+}
+
+/* Thousands of coroutines per loop, more than the ring holds at once */
+static void test_async(const char *path)
+{
+    chardev::Device dev(path);
+    std::vector<std::thread> threads;
+    std::atomic<long> ok = 0, failed = 0;
+    int t;
+
+    for (t = 0; t < ASYNC_THREADS; t++) {
+        threads.emplace_back([&, t] {
+            chardev::EventLoop loop(ASYNC_RING);
+            chardev::AsyncDevice adev(loop, dev);
+            int i;
+
+            for (i = 0; i < ASYNC_TASKS; i++)
+                loop.spawn(async_client(adev, t * ASYNC_TASKS + i, ok));
+            loop.run();
+            failed += loop.failed();
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    CHECK(failed == 0, "no async task failed");
+    CHECK(ok == ASYNC_THREADS * ASYNC_TASKS * ASYNC_ROUNDS, "every async write and read completed");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : chardev::default_path;
+
+    try {
+        test_device(path);
+        test_batcher(path);
+        test_parse();
+        test_ring(path);
+        test_async(path);
+    } catch (const std::system_error &e) {
+        std::printf("[FAIL] %s: %s\n", e.what(), e.code().message().c_str());
+        failures++;
+    }
+
+    std::printf("\n%d failure(s)\n", failures);
+    return failures ? 1 : 0;
+}
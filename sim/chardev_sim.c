@@ -0,0 +1,1397 @@
+/*
+ * Userspace simulation harness for the Character Device Driver
+ *
+ * Links chardev.c (built against the shims in sim/include) into an ordinary
+ * program, so the driver's file operations can be tested, benchmarked and
+ * profiled without root or a loaded module, and run under ASan/TSan.
+ *
+ *   ./chardev_sim [-v] [-T] [-p param=value]... test
+ *   ./chardev_sim [-v] [-T] [-p param=value]... kunit
+ *   ./chardev_sim [-v] [-T] [-p param=value]... bench [-r N] [-w N] [-s SIZE] [-t SECS]
+ *
+ * -T prints the driver's tracepoints to stderr as trace_pipe would, which
+ * 'test_chardev record -i' turns into a replayable trace.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "chardev_uapi.h"
+#include "sim.h"
+
+#define BUFFER_SIZE CHARDEV_BUFFER_SIZE
+
+#define SIM_MAX_THREADS     256
+#define STRESS_THREADS      8
+#define STRESS_ITERATIONS   20000
+#define WAL_WRITERS         8
+#define WAL_WRITES          64
+
+static int failures;
+
+#define CHECK(cond, what)                                           \
+    do {                                                            \
+        if (cond) {                                                 \
+            printf("[PASS] %s\n", what);                            \
+        } else {                                                    \
+            printf("[FAIL] %s (%s:%d, errno %d)\n", what,           \
+                   __FILE__, __LINE__, errno);                      \
+            failures++;                                             \
+        }                                                           \
+    } while (0)
+
+/*
+ * Functional tests (mirror test_chardev's suite, plus edge cases)
+ */
+static void test_open_close(void)
+{
+    struct sim_file *f = sim_open(0, O_RDWR);
+
+    CHECK(f != NULL, "open device");
+    if (f)
+        CHECK(sim_close(f) == 0, "close device");
+}
+
+static void test_write_read(void)
+{
+    const char msg[] = "Hello from user-space! This is a test message for the character device driver.";
+    char buf[BUFFER_SIZE] = { 0 };
+    struct sim_file *f = sim_open(0, O_RDWR);
+
+    sim_ioctl(f, IOCTL_RESET, 0);
+    CHECK(sim_write(f, msg, strlen(msg)) == (ssize_t)strlen(msg), "write message");
+    CHECK(sim_pread(f, buf, sizeof(buf), 0) == (ssize_t)strlen(msg), "read message back");
+    CHECK(strcmp(buf, msg) == 0, "read data matches written data");
+    CHECK(sim_read(f, buf, sizeof(buf)) == 0, "read at end of data returns 0");
+    sim_close(f);
+}
+
+static void test_ioctl_reset(void)
+{
+    char buf[16];
+    struct sim_file *f = sim_open(0, O_RDWR);
+
+    sim_pwrite(f, "Test data before reset", 22, 0);
+    CHECK(sim_ioctl(f, IOCTL_RESET, 0) == 0, "IOCTL_RESET");
+    CHECK(sim_pread(f, buf, sizeof(buf), 0) == 0, "buffer empty after reset");
+    sim_close(f);
+}
+
+static void test_ioctl_get_size(void)
+{
+    const char data[] = "Testing buffer size calculation";
+    struct sim_file *f = sim_open(0, O_RDWR);
+    int size = -1;
+
+    sim_ioctl(f, IOCTL_RESET, 0);
+    sim_write(f, data, strlen(data));
+    CHECK(sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&size) == 0, "IOCTL_GET_SIZE");
+    CHECK(size == (int)strlen(data), "size matches written data");
+    sim_close(f);
+}
+
+static void test_ioctl_flag(void)
+{
+    struct sim_file *f = sim_open(0, O_RDWR);
+    int set = 42, get = 0;
+
+    CHECK(sim_ioctl(f, IOCTL_SET_FLAG, (unsigned long)&set) == 0, "IOCTL_SET_FLAG");
+    CHECK(sim_ioctl(f, IOCTL_GET_FLAG, (unsigned long)&get) == 0, "IOCTL_GET_FLAG");
+    CHECK(get == set, "flag round-trips");
+    sim_close(f);
+}
+
+static void test_multiple_operations(void)
+{
+    char buf[BUFFER_SIZE] = { 0 };
+    struct sim_file *f = sim_open(0, O_RDWR);
+
+    sim_ioctl(f, IOCTL_RESET, 0);
+    sim_write(f, "First write operation", 21);
+    sim_write(f, " - Second write operation", 25);
+    CHECK(sim_pread(f, buf, sizeof(buf), 0) == 46, "sequential writes append");
+    CHECK(strcmp(buf, "First write operation - Second write operation") == 0,
+          "appended data intact");
+    sim_close(f);
+}
+
+static void test_edge_cases(void)
+{
+    char big[BUFFER_SIZE + 100];
+    struct sim_file *f = sim_open(0, O_RDWR);
+    int value;
+
+    memset(big, 'x', sizeof(big));
+    sim_ioctl(f, IOCTL_RESET, 0);
+    CHECK(sim_pwrite(f, big, sizeof(big), 0) == BUFFER_SIZE, "oversized write is truncated");
+    CHECK(sim_pwrite(f, big, 1, BUFFER_SIZE) < 0 && errno == ENOSPC,
+          "write at end of buffer fails with ENOSPC");
+    CHECK(sim_pwrite(f, NULL, 10, 0) < 0 && errno == EFAULT, "bad user pointer gives EFAULT");
+    CHECK(sim_ioctl(f, _IO('c', 99), 0) < 0 && errno == EINVAL, "unknown ioctl gives EINVAL");
+    CHECK(sim_ioctl(f, IOCTL_GET_SIZE, 0) < 0 && errno == EFAULT, "ioctl to bad pointer gives EFAULT");
+    CHECK(sim_lseek(f, 0, SEEK_SET) < 0 && errno == ESPIPE, "device is not seekable");
+    CHECK(sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&value) == 0 && value == BUFFER_SIZE,
+          "size capped at buffer size");
+    sim_close(f);
+}
+
+static void test_selftest_bench(void)
+{
+    struct chardev_selftest_bench bench = { .iterations = 1000, .copy_size = 256 };
+    struct sim_file *f = sim_open(0, O_RDWR);
+    char user[256];
+
+    bench.user_buffer = (unsigned long)user;
+    CHECK(sim_ioctl(f, IOCTL_SELFTEST_BENCH, (unsigned long)&bench) == 0, "IOCTL_SELFTEST_BENCH");
+    CHECK(bench.iterations == 1000 && bench.copy_size == 256, "self-benchmark echoes its inputs");
+    CHECK(bench.memcpy_ns > 0 && bench.page_alloc_ns > 0 && bench.lock_ns > 0 &&
+          bench.copy_to_user_ns > 0, "self-benchmark times every loop");
+
+    memset(&bench, 0, sizeof(bench));
+    CHECK(sim_ioctl(f, IOCTL_SELFTEST_BENCH, (unsigned long)&bench) == 0 &&
+          bench.iterations > 0 && bench.copy_size == BUFFER_SIZE && bench.copy_to_user_ns == 0,
+          "self-benchmark defaults, copy_to_user skipped without a buffer");
+
+    bench.copy_size = BUFFER_SIZE + 1;
+    CHECK(sim_ioctl(f, IOCTL_SELFTEST_BENCH, (unsigned long)&bench) < 0 && errno == EINVAL,
+          "self-benchmark rejects copies larger than the buffer");
+    CHECK(sim_ioctl(f, IOCTL_SELFTEST_BENCH, 0) < 0 && errno == EFAULT,
+          "self-benchmark with bad pointer gives EFAULT");
+    sim_close(f);
+}
+
+static void test_write_batch(void)
+{
+    struct chardev_batch_entry entries[3] = {
+        { .buf = (unsigned long)"abc", .offset = 0, .len = 3 },
+        { .buf = (unsigned long)"xyz", .offset = 10, .len = 3 },
+        { .buf = (unsigned long)"end", .offset = BUFFER_SIZE, .len = 3 },
+    };
+    struct chardev_batch batch = { .entries = (unsigned long)entries, .count = 2 };
+    struct sim_file *f = sim_open(0, O_RDWR);
+    char buf[16] = { 0 };
+    int size;
+
+    sim_ioctl(f, IOCTL_RESET, 0);
+    CHECK(sim_ioctl(f, IOCTL_WRITE_BATCH, (unsigned long)&batch) == 2, "IOCTL_WRITE_BATCH");
+    CHECK(sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&size) == 0 && size == 13,
+          "batch extends the data size");
+    CHECK(sim_pread(f, buf, 13, 0) == 13 && memcmp(buf, "abc", 3) == 0 &&
+          memcmp(buf + 10, "xyz", 3) == 0, "batch entries land at their offsets");
+
+    batch.count = 3;
+    CHECK(sim_ioctl(f, IOCTL_WRITE_BATCH, (unsigned long)&batch) == 2,
+          "batch stops at the first failing entry");
+    batch.entries = (unsigned long)&entries[2];
+    batch.count = 1;
+    CHECK(sim_ioctl(f, IOCTL_WRITE_BATCH, (unsigned long)&batch) < 0 && errno == ENOSPC,
+          "batch whose first entry fails returns the error");
+    batch.count = 0;
+    CHECK(sim_ioctl(f, IOCTL_WRITE_BATCH, (unsigned long)&batch) < 0 && errno == EINVAL,
+          "empty batch gives EINVAL");
+    batch.count = CHARDEV_BATCH_MAX + 1;
+    CHECK(sim_ioctl(f, IOCTL_WRITE_BATCH, (unsigned long)&batch) < 0 && errno == EINVAL,
+          "oversized batch gives EINVAL");
+    sim_close(f);
+}
+
+static void test_tracepoints(void)
+{
+    unsigned long before = sim_trace_events();
+    struct sim_file *f = sim_open(0, O_RDWR);
+    char buf[16];
+    int size;
+
+    sim_pwrite(f, "trace", 5, 0);
+    sim_pread(f, buf, sizeof(buf), 0);
+    sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&size);
+    sim_close(f);
+    CHECK(sim_trace_events() - before == 5, "open, write, read, ioctl and release traced");
+}
+
+static void test_queue_delay(void)
+{
+    struct chardev_stamp stamp = { .offset = 70 };
+    struct sim_file *f = sim_open(0, O_RDWR);
+    struct timespec pause = { 0, 2000000 };
+    unsigned long long count = 0, max_ns = 0;
+    char buf[2048], *p;
+
+    sim_ioctl(f, IOCTL_RESET, 0);
+    sim_pwrite(f, "queued", 6, 64);
+    CHECK(sim_ioctl(f, IOCTL_GET_STAMP, (unsigned long)&stamp) == 0 &&
+          stamp.enqueue_ns != 0 && stamp.dequeue_ns == 0, "write stamps its block");
+
+    nanosleep(&pause, NULL);
+    sim_pread(f, buf, 6, 64);
+    sim_pread(f, buf, 6, 64);
+    CHECK(sim_ioctl(f, IOCTL_GET_STAMP, (unsigned long)&stamp) == 0 &&
+          stamp.dequeue_ns - stamp.enqueue_ns >= 2000000, "first read stamps the dequeue");
+
+    CHECK(sim_debugfs_read("chardev/chardev/queue_delay", buf, sizeof(buf)) > 0,
+          "queue_delay in debugfs");
+    p = strstr(buf, "count: ");
+    if (p)
+        sscanf(p, "count: %llu", &count);
+    p = strstr(buf, "max_ns: ");
+    if (p)
+        sscanf(p, "max_ns: %llu", &max_ns);
+    CHECK(count >= 1 && max_ns >= 2000000, "queueing delay histogram counts the read");
+
+    stamp.offset = BUFFER_SIZE;
+    CHECK(sim_ioctl(f, IOCTL_GET_STAMP, (unsigned long)&stamp) < 0 && errno == EINVAL,
+          "stamp beyond the buffer gives EINVAL");
+    stamp.offset = 64;
+    sim_ioctl(f, IOCTL_RESET, 0);
+    CHECK(sim_ioctl(f, IOCTL_GET_STAMP, (unsigned long)&stamp) == 0 &&
+          stamp.enqueue_ns == 0, "reset clears the stamps");
+    sim_close(f);
+}
+
+/* Value of "key:\tvalue" in fdinfo text, or -1 */
+static long long fdinfo_value(const char *text, const char *key)
+{
+    const char *p = strstr(text, key);
+    long long value = -1;
+
+    if (p)
+        sscanf(p + strlen(key), ":\t%lld", &value);
+    return value;
+}
+
+static void test_fdinfo(void)
+{
+    struct sim_file *w = sim_open(0, O_WRONLY);
+    struct sim_file *r = sim_open(0, O_RDONLY);
+    char buf[1024];
+    int size;
+
+    sim_ioctl(w, IOCTL_RESET, 0);
+    sim_write(w, "0123456789", 10);
+    sim_write(w, "abcdef", 6);
+    sim_read(r, buf, 4);
+    sim_ioctl(r, IOCTL_GET_SIZE, (unsigned long)&size);
+
+    CHECK(sim_fdinfo(w, buf, sizeof(buf)) > 0 && strstr(buf, "chardev-mode:\tw\n") &&
+          fdinfo_value(buf, "chardev-writes") == 2 &&
+          fdinfo_value(buf, "chardev-bytes-written") == 16 &&
+          fdinfo_value(buf, "chardev-ioctls") == 1 &&
+          fdinfo_value(buf, "chardev-pos") == 16 && fdinfo_value(buf, "chardev-lag") == 0,
+          "fdinfo of the writer");
+    CHECK(sim_fdinfo(r, buf, sizeof(buf)) > 0 && strstr(buf, "chardev-mode:\tr\n") &&
+          fdinfo_value(buf, "chardev-reads") == 1 &&
+          fdinfo_value(buf, "chardev-bytes-read") == 4 &&
+          fdinfo_value(buf, "chardev-writes") == 0 &&
+          fdinfo_value(buf, "chardev-lag") == 12 &&
+          fdinfo_value(buf, "chardev-blocked-ns") >= 0,
+          "fdinfo of the reader is its own");
+    sim_close(w);
+    sim_close(r);
+}
+
+/* Count of the histogram following a "[section]" line in debugfs output */
+static unsigned long long hist_count(const char *text, const char *section)
+{
+    unsigned long long count = 0;
+    const char *p = strstr(text, section);
+
+    if (p && (p = strstr(p, "count: ")))
+        sscanf(p, "count: %llu", &count);
+    return count;
+}
+
+static void test_lock_stats(void)
+{
+    struct sim_file *f = sim_open(0, O_RDWR);
+    char buf[8192];
+    int size;
+
+    sim_debugfs_write("chardev/lock_stats_reset", "1", 1);
+    sim_pwrite(f, "x", 1, 0);
+    sim_debugfs_read("chardev/chardev/lock_stats", buf, sizeof(buf));
+    CHECK(strstr(buf, "enabled: 0") && hist_count(buf, "[write wait]") == 0,
+          "lock statistics off by default");
+
+    CHECK(sim_debugfs_write("chardev/lock_stats_enable", "1", 1) == 1, "enable lock statistics");
+    sim_pwrite(f, "x", 1, 0);
+    sim_pwrite(f, "x", 1, 0);
+    sim_pread(f, buf, 1, 0);
+    sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&size);
+    sim_debugfs_read("chardev/chardev/lock_stats", buf, sizeof(buf));
+    CHECK(hist_count(buf, "[write wait]") == 2 && hist_count(buf, "[write hold]") == 2 &&
+          hist_count(buf, "[read wait]") == 1 && hist_count(buf, "[ioctl hold]") == 1,
+          "wait and hold times per operation");
+
+    CHECK(sim_debugfs_write("chardev/lock_stats_reset", "1", 1) == 1 &&
+          sim_debugfs_read("chardev/chardev/lock_stats", buf, sizeof(buf)) > 0 &&
+          hist_count(buf, "[write wait]") == 0, "reset clears the lock statistics");
+
+    CHECK(sim_debugfs_write("chardev/lock_stats_enable", "bogus", 5) < 0 && errno == EINVAL,
+          "bad enable value gives EINVAL");
+    sim_debugfs_write("chardev/lock_stats_enable", "0", 1);
+    sim_pwrite(f, "x", 1, 0);
+    sim_debugfs_read("chardev/chardev/lock_stats", buf, sizeof(buf));
+    CHECK(hist_count(buf, "[write wait]") == 0, "disabled statistics stay untouched");
+    sim_close(f);
+}
+
+/* Next record in the ring, copied out so a wrapped one reads contiguously */
+static int ring_next(struct chardev_ring_ctrl *ctrl, struct chardev_ring_record *hdr,
+                     char *rec_buf, size_t size)
+{
+    const char *ring = (const char *)ctrl + ctrl->ctrl_size;
+    uint64_t head = __atomic_load_n(&ctrl->head, __ATOMIC_ACQUIRE);
+    struct chardev_ring_record rec;
+    size_t i;
+
+    if (ctrl->tail == head)
+        return -1;
+
+    for (i = 0; i < sizeof(rec); i++)
+        ((char *)&rec)[i] = ring[(ctrl->tail + i) & (ctrl->data_size - 1)];
+    for (i = 0; i < rec.len && i < size; i++)
+        rec_buf[i] = ring[(ctrl->tail + sizeof(rec) + i) & (ctrl->data_size - 1)];
+
+    __atomic_store_n(&ctrl->tail, ctrl->tail + CHARDEV_RING_RECORD_SIZE(rec.len),
+                     __ATOMIC_RELEASE);
+    if (hdr)
+        *hdr = rec;
+    return rec.type == CHARDEV_RECORD_DATA ? (int)rec.len : -1;
+}
+
+static void test_ring(void)
+{
+    struct sim_file *f = sim_open(0, O_RDWR);
+    struct chardev_ring_record hdr, prev;
+    struct chardev_ring_ctrl *ctrl;
+    char buf[BUFFER_SIZE], rec[BUFFER_SIZE];
+    unsigned int fits, i;
+    int ok = 1;
+
+    ctrl = sim_mmap(f, 4096, PROT_READ | PROT_WRITE, 0);
+    if (!ctrl && errno == ENODEV) {
+        printf("[SKIP] record ring (load with -p ring_pages=1)\n");
+        sim_close(f);
+        return;
+    }
+    CHECK(ctrl && ctrl->version == CHARDEV_RING_VERSION && ctrl->ctrl_size == 4096,
+          "mmap the ring control page");
+    if (!ctrl) {
+        sim_close(f);
+        return;
+    }
+    CHECK(sim_mmap(f, ctrl->data_size, PROT_READ | PROT_WRITE, 4096) == NULL &&
+          errno == EACCES, "ring data cannot be mapped writable");
+    CHECK(sim_mmap(f, ctrl->data_size, PROT_READ, 4096) != NULL && !sim_mmap_maywrite(f),
+          "mmap the ring data, for good read-only");
+    CHECK(sim_mmap(f, 2 * ctrl->data_size, PROT_READ, 4096) == NULL && errno == EINVAL,
+          "mapping past the ring fails");
+
+    /* Start from an empty ring whatever earlier tests wrote */
+    ctrl->tail = ctrl->head;
+
+    sim_pwrite(f, "ring record", 11, 0);
+    CHECK(ring_next(ctrl, &prev, rec, sizeof(rec)) == 11 && memcmp(rec, "ring record", 11) == 0,
+          "write appears in the ring");
+    CHECK(ring_next(ctrl, NULL, rec, sizeof(rec)) < 0, "one write, one record");
+
+    sim_pwrite(f, "tail", 8, BUFFER_SIZE - 4);
+    CHECK(ring_next(ctrl, &hdr, rec, sizeof(rec)) == 4 && hdr.seq == prev.seq + 1 &&
+          hdr.ktime_ns >= prev.ktime_ns && hdr.flags == CHARDEV_RECORD_F_SHORT,
+          "records are stamped with sequence, time and flags");
+
+    /* Fill with full-buffer records until one is dropped */
+    memset(buf, 'r', sizeof(buf));
+    fits = ctrl->data_size / CHARDEV_RING_RECORD_SIZE(BUFFER_SIZE);
+    for (i = 0; i <= fits; i++)
+        sim_pwrite(f, buf, sizeof(buf), 0);
+    CHECK(ctrl->dropped == 1, "full ring drops and counts");
+
+    /* Consume one, write again: the next record wraps around the end */
+    ring_next(ctrl, NULL, rec, sizeof(rec));
+    buf[0] = 'w';
+    buf[BUFFER_SIZE - 1] = 'W';
+    sim_pwrite(f, buf, sizeof(buf), 0);
+    for (i = 0; i < fits; i++)
+        ok &= ring_next(ctrl, &hdr, rec, sizeof(rec)) == BUFFER_SIZE;
+    CHECK(ok && rec[0] == 'w' && rec[BUFFER_SIZE - 1] == 'W', "wrapped record reads back");
+    CHECK(hdr.seq == prev.seq + fits + 3, "dropped record leaves a sequence gap");
+    CHECK(ctrl->tail == ctrl->head, "ring drained");
+
+    /* The driver publishes geometry and head but never takes them back */
+    {
+        struct chardev_ring_ctrl saved = *ctrl;
+
+        ctrl->ctrl_size = 1u << 30;
+        ctrl->data_size = 1u << 31;
+        ctrl->head += 1ull << 40;
+        ctrl->tail = saved.head;
+        CHECK(sim_pwrite(f, "safe", 4, 0) == 4 && ctrl->head == saved.head +
+                  CHARDEV_RING_RECORD_SIZE(4), "a scribbled control page is not trusted");
+        ctrl->ctrl_size = saved.ctrl_size;
+        ctrl->data_size = saved.data_size;
+        CHECK(ring_next(ctrl, NULL, rec, sizeof(rec)) == 4 && memcmp(rec, "safe", 4) == 0,
+              "the record still lands in the ring");
+    }
+    sim_close(f);
+}
+
+static void test_stats(void)
+{
+    const size_t v1 = offsetof(struct chardev_stats, tee_errors);
+    struct chardev_stats before, after;
+    struct sim_file *f = sim_open(0, O_RDWR);
+    char buf[sizeof(struct chardev_stats) + 1];
+    int flag = 7;
+
+    CHECK(sim_debugfs_read("chardev/chardev/stats", buf, sizeof(buf)) == sizeof(before),
+          "stats file holds one struct chardev_stats");
+    memcpy(&before, buf, sizeof(before));
+    CHECK(before.version == CHARDEV_STATS_VERSION && before.size == sizeof(before),
+          "stats are versioned and sized");
+
+    sim_ioctl(f, IOCTL_RESET, 0);
+    sim_ioctl(f, IOCTL_SET_FLAG, (unsigned long)&flag);
+    sim_pwrite(f, "counted", 7, 0);
+    sim_pread(f, buf, 7, 0);
+    sim_debugfs_read("chardev/chardev/stats", buf, sizeof(buf));
+    memcpy(&after, buf, sizeof(after));
+
+    CHECK(after.reads == before.reads + 1 && after.writes == before.writes + 1 &&
+          after.ioctls == before.ioctls + 2, "stats count operations");
+    CHECK(after.bytes_read == before.bytes_read + 7 &&
+          after.bytes_written == before.bytes_written + 7, "stats count bytes");
+    CHECK(after.buffer_size == 7 && after.flag == 7 && after.ktime_ns > before.ktime_ns,
+          "stats snapshot the instance");
+    CHECK(after.queue_delay.count == before.queue_delay.count + 1, "stats carry histograms");
+
+    CHECK(sim_ioctl(f, IOCTL_GET_STATS, (unsigned long)&before) == 0 &&
+          before.version == CHARDEV_STATS_VERSION && before.reads == after.reads &&
+          before.ioctls == after.ioctls && before.flag == 7,
+          "IOCTL_GET_STATS matches the stats file and is not counted");
+    CHECK(sim_ioctl(f, IOCTL_GET_STATS, 0) < 0 && errno == EFAULT,
+          "IOCTL_GET_STATS to a bad pointer gives EFAULT");
+
+    /* A binary built before tee_errors was appended keeps its ioctl number */
+    memset(&before, 0xff, sizeof(before));
+    CHECK(sim_ioctl(f, IOCTL_GET_STATS_SIZE(v1), (unsigned long)&before) == 0 &&
+          before.version == CHARDEV_STATS_VERSION && before.size == sizeof(before) &&
+          before.reads == after.reads && before.tee_errors == ~0ULL,
+          "an older struct chardev_stats gets its own fields and no more");
+    CHECK(sim_ioctl(f, IOCTL_GET_STATS_SIZE(v1 - 8), (unsigned long)&before) < 0 &&
+          errno == EINVAL, "a struct chardev_stats smaller than the first release is refused");
+    sim_close(f);
+}
+
+/* Wait up to a second for the watchdog to send a new uevent */
+static unsigned long wait_uevent(unsigned long seen, char *last, size_t size)
+{
+    unsigned long n = seen;
+    int i;
+
+    for (i = 0; i < 100 && n == seen; i++) {
+        usleep(10000);
+        n = sim_uevents(last, size);
+    }
+    return n;
+}
+
+static void test_slo(void)
+{
+    struct sim_file *f = sim_open(0, O_RDWR);
+    char buf[600], event[512];
+    unsigned long seen;
+
+    memset(buf, 's', sizeof(buf));
+    sim_ioctl(f, IOCTL_RESET, 0);
+    seen = sim_uevents(event, sizeof(event));
+
+    sim_set_param("slo_fill_pct=50");
+    sim_pwrite(f, buf, sizeof(buf), 0);
+    if (wait_uevent(seen, event, sizeof(event)) == seen) {
+        printf("[SKIP] SLO watchdog (load with -p slo_interval_ms=10)\n");
+        goto out;
+    }
+    CHECK(strstr(event, "change@chardev ") && strstr(event, "CHARDEV_SLO=breach") &&
+          strstr(event, "CHARDEV_SLO_REASON=fill") && strstr(event, "CHARDEV_FILL_PCT=58"),
+          "filling the buffer sends a breach uevent");
+
+    seen = sim_uevents(NULL, 0);
+    usleep(50000);
+    CHECK(sim_uevents(NULL, 0) == seen, "a standing breach is reported once");
+
+    sim_ioctl(f, IOCTL_RESET, 0);
+    seen = wait_uevent(seen, event, sizeof(event));
+    CHECK(strstr(event, "CHARDEV_SLO=ok") && strstr(event, "CHARDEV_SLO_REASON=none"),
+          "draining the buffer sends a recovery uevent");
+
+out:
+    sim_set_param("slo_fill_pct=0");
+    sim_close(f);
+}
+
+static void test_instances(void)
+{
+    unsigned int n = sim_num_devices();
+    struct sim_file *a, *b;
+    int size = -1;
+
+    if (n < 2) {
+        printf("[SKIP] instance isolation (load with -p num_devices=2)\n");
+        return;
+    }
+
+    a = sim_open(0, O_RDWR);
+    b = sim_open(n - 1, O_RDWR);
+    sim_ioctl(a, IOCTL_RESET, 0);
+    sim_ioctl(b, IOCTL_RESET, 0);
+    sim_pwrite(a, "instance zero", 13, 0);
+    CHECK(sim_ioctl(b, IOCTL_GET_SIZE, (unsigned long)&size) == 0 && size == 0,
+          "instances do not share data");
+    sim_close(a);
+    sim_close(b);
+    CHECK(sim_open(n, O_RDWR) == NULL && errno == ENXIO, "no instance beyond num_devices");
+}
+
+/* Value of "key: N" in a debugfs file, or -1 */
+static long long debugfs_value(const char *path, const char *key)
+{
+    char buf[512], *p;
+    long long value = -1;
+
+    if (sim_debugfs_read(path, buf, sizeof(buf)) < 0)
+        return -1;
+    p = strstr(buf, key);
+    if (p)
+        sscanf(p + strlen(key), ": %lld", &value);
+    return value;
+}
+
+static long long wal_value(const char *key)
+{
+    return debugfs_value("chardev/wal", key);
+}
+
+struct wal_writer {
+    pthread_t thread;
+    int id;
+};
+
+static void *wal_write_fn(void *arg)
+{
+    struct wal_writer *w = arg;
+    struct sim_file *f = sim_open(0, O_RDWR);
+    char c = 'A' + w->id;
+    int i;
+
+    for (i = 0; i < WAL_WRITES; i++)
+        sim_pwrite(f, &c, 1, w->id * WAL_WRITES + i);
+    sim_close(f);
+    return NULL;
+}
+
+/* Contents of instance 0 into @buf; returns the size */
+static int wal_contents(char *buf, int *flag)
+{
+    struct sim_file *f = sim_open(0, O_RDWR);
+    int size = -1;
+
+    sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&size);
+    sim_ioctl(f, IOCTL_GET_FLAG, (unsigned long)flag);
+    memset(buf, 0, BUFFER_SIZE);
+    sim_pread(f, buf, BUFFER_SIZE, 0);
+    sim_close(f);
+    return size;
+}
+
+static void test_wal(void)
+{
+    struct wal_writer writers[WAL_WRITERS];
+    char before[BUFFER_SIZE], after[BUFFER_SIZE], path[256], buf[512], *p;
+    struct chardev_batch_entry entry = { .buf = (unsigned long)"lost", .offset = BUFFER_SIZE - 4, .len = 4 };
+    struct chardev_batch batch = { .entries = (unsigned long)&entry, .count = 1 };
+    long long records, syncs;
+    int size, cur, flag = 9, i, fd;
+    struct sim_file *f;
+
+    if (sim_debugfs_read("chardev/wal", buf, sizeof(buf)) < 0) {
+        printf("[SKIP] write-ahead log (load with -p wal_path=FILE)\n");
+        return;
+    }
+    p = strstr(buf, "path: ");
+    sscanf(p + strlen("path: "), "%255s", path);
+
+    f = sim_open(0, O_RDWR);
+    sim_ioctl(f, IOCTL_RESET, 0);
+    sim_ioctl(f, IOCTL_SET_FLAG, (unsigned long)&flag);
+    sim_close(f);
+
+    records = wal_value("records");
+    syncs = wal_value("syncs");
+    for (i = 0; i < WAL_WRITERS; i++) {
+        writers[i].id = i;
+        pthread_create(&writers[i].thread, NULL, wal_write_fn, &writers[i]);
+    }
+    for (i = 0; i < WAL_WRITERS; i++)
+        pthread_join(writers[i].thread, NULL);
+    records = wal_value("records") - records;
+    syncs = wal_value("syncs") - syncs;
+    CHECK(records == WAL_WRITERS * WAL_WRITES, "every write is logged");
+    CHECK(syncs > 0 && syncs < records, "concurrent writers share fsyncs");
+    CHECK(wal_value("synced") == wal_value("size") && wal_value("error") == 0,
+          "everything acknowledged is synced");
+
+    size = wal_contents(before, &flag);
+    records = wal_value("records") + wal_value("replayed");
+    sim_unload();
+    CHECK(sim_load() == 0, "reload with the log");
+    CHECK(wal_value("replayed") == records, "reload replays every record");
+    CHECK(wal_contents(after, &flag) == size && flag == 9 &&
+          memcmp(before, after, BUFFER_SIZE) == 0, "contents and flag survive a reload");
+
+    /* A record cut off mid-write is dropped, and new ones follow the last good one */
+    sim_unload();
+    fd = open(path, O_WRONLY | O_APPEND);
+    CHECK(fd >= 0 && write(fd, "CWAL torn", 9) == 9, "tear the log");
+    if (fd >= 0)
+        close(fd);
+    CHECK(sim_load() == 0 && wal_value("replayed") == records && wal_value("size") > 0,
+          "replay stops at a torn record");
+    f = sim_open(0, O_RDWR);
+    sim_pwrite(f, "after", 5, 0);
+    sim_close(f);
+    sim_unload();
+    sim_load();
+    CHECK(wal_value("replayed") == records + 1 && wal_contents(after, &flag) == size &&
+          memcmp(after, "after", 5) == 0, "records after a torn tail are kept");
+
+    /* A batch entry the log refuses does not move the size past the log */
+    f = sim_open(0, O_RDWR);
+    sim_fail_kernel_write(0, ENOSPC);
+    CHECK(sim_ioctl(f, IOCTL_WRITE_BATCH, (unsigned long)&batch) < 0 && errno == ENOSPC &&
+          sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&cur) == 0 && cur == size,
+          "a batch entry the log refuses leaves the size alone");
+    sim_close(f);
+    sim_unload();
+    sim_load();
+    f = sim_open(0, O_RDWR);
+    CHECK(sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&cur) == 0 && cur == size,
+          "the refused entry is not there after a reload either");
+    sim_close(f);
+
+    /* A snapshot saved on unload holds the log, which then starts over */
+    sim_set_param("snapshot_path=chardev_sim_wal.snap");
+    sim_unload();
+    fd = open(path, O_RDONLY);
+    CHECK(fd >= 0 && lseek(fd, 0, SEEK_END) == 0, "the log is truncated once a snapshot holds it");
+    if (fd >= 0)
+        close(fd);
+    CHECK(sim_load() == 0 && wal_value("replayed") == 0 && wal_contents(after, &flag) == size &&
+          flag == 9 && memcmp(after, "after", 5) == 0, "the snapshot brings back what the log held");
+    sim_unload();
+    sim_set_param("snapshot_path=");
+    unlink("chardev_sim_wal.snap");
+    sim_load();
+}
+
+/* Offset of the first instance's data in a snapshot file */
+#define SNAPSHOT_DATA (sizeof(struct chardev_snapshot_header) + \
+                       sizeof(struct chardev_snapshot_instance) + 4)
+
+static long snapshot_ioctl(struct sim_file *f, unsigned int cmd, const char *path,
+                           unsigned int flags)
+{
+    struct chardev_snapshot_req req = { .path = (uintptr_t)path, .flags = flags };
+
+    return sim_ioctl(f, cmd, (unsigned long)&req);
+}
+
+static long long file_size(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) ? -1 : (long long)st.st_size;
+}
+
+static long long restore_value(const char *key)
+{
+    return debugfs_value("chardev/restore", key);
+}
+
+/* Reload from the snapshot at @path with or without the prefetcher */
+static void restore_reload(int prefetch)
+{
+    sim_set_param(prefetch ? "snapshot_prefetch=1" : "snapshot_prefetch=0");
+    sim_unload();
+    sim_load();
+}
+
+/*
+ * Instances are read in on first use, or by the prefetcher. Every instance
+ * is in the snapshot, so all of them start out pending.
+ */
+static void test_lazy_restore(const char *path)
+{
+    unsigned int n = sim_num_devices();
+    char buf[BUFFER_SIZE];
+    struct sim_file *f;
+    int i, size, fd;
+
+    if (wal_value("records") >= 0) {
+        printf("[SKIP] lazy restore (restored at once with wal_path set)\n");
+        return;
+    }
+
+    restore_reload(0);
+    CHECK(restore_value("pending") == n && restore_value("faulted") == 0,
+          "without the prefetcher every instance waits for its first use");
+    f = sim_open(0, O_RDWR);
+    CHECK(sim_pread(f, buf, 10, 0) == 10 && memcmp(buf, "warm state", 10) == 0,
+          "the first read brings in the data");
+    sim_close(f);
+    CHECK(restore_value("pending") == n - 1 && restore_value("faulted") == 1,
+          "only the instance used is read in");
+
+    restore_reload(1);
+    for (i = 0; i < 1000 && restore_value("pending") != 0; i++)
+        usleep(1000);
+    CHECK(restore_value("pending") == 0 &&
+          restore_value("prefetched") + restore_value("faulted") == n,
+          "the prefetcher reads in the rest");
+    f = sim_open(0, O_RDWR);
+    CHECK(sim_pread(f, buf, 10, 0) == 10 && memcmp(buf, "warm state", 10) == 0,
+          "prefetched contents are intact");
+    sim_close(f);
+
+    /* A bad instance found late comes back empty rather than half restored */
+    sim_unload();
+    fd = open(path, O_RDWR);
+    buf[0] = 0;
+    if (fd >= 0 && pread(fd, buf, 1, SNAPSHOT_DATA) == 1)
+        buf[0] ^= 0x55;
+    CHECK(fd >= 0 && pwrite(fd, buf, 1, SNAPSHOT_DATA) == 1, "damage the saved instance");
+    if (fd >= 0)
+        close(fd);
+    sim_set_param("snapshot_prefetch=0");
+    sim_load();
+    f = sim_open(0, O_RDWR);
+    CHECK(sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&size) == 0 && size == 0 &&
+          sim_pread(f, buf, 10, 0) == 0, "a damaged instance comes back empty");
+    sim_close(f);
+    sim_set_param("snapshot_prefetch=1");
+}
+
+static void test_snapshot(void)
+{
+    const char *path = "chardev_sim.snap";
+    char text[1000], buf[BUFFER_SIZE];
+    struct sim_file *f = sim_open(0, O_RDWR);
+    long long raw;
+    int flag = 5, size, fd;
+    size_t i;
+
+    for (i = 0; i < sizeof(text); i++)
+        text[i] = "snapshot "[i % 9];
+    sim_ioctl(f, IOCTL_RESET, 0);
+    sim_pwrite(f, text, sizeof(text), 0);
+    sim_ioctl(f, IOCTL_SET_FLAG, (unsigned long)&flag);
+
+    CHECK(snapshot_ioctl(f, IOCTL_SAVE, path, 0) == 0, "IOCTL_SAVE");
+    raw = file_size(path);
+    CHECK(raw >= (long long)sizeof(text), "uncompressed snapshot holds the data");
+    CHECK(snapshot_ioctl(f, IOCTL_SAVE, path, CHARDEV_SNAPSHOT_LZ4) == 0 &&
+          file_size(path) < raw / 2, "LZ4 snapshot is smaller");
+
+    sim_ioctl(f, IOCTL_RESET, 0);
+    CHECK(snapshot_ioctl(f, IOCTL_LOAD, path, 0) == 0, "IOCTL_LOAD");
+    sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&size);
+    sim_ioctl(f, IOCTL_GET_FLAG, (unsigned long)&flag);
+    CHECK(size == sizeof(text) && flag == 5 && sim_pread(f, buf, sizeof(buf), 0) == size &&
+          memcmp(buf, text, sizeof(text)) == 0, "load restores contents and flag");
+
+    CHECK(snapshot_ioctl(f, IOCTL_SAVE, path, 0x80) < 0 && errno == EINVAL,
+          "unknown snapshot flag gives EINVAL");
+    CHECK(snapshot_ioctl(f, IOCTL_LOAD, "chardev_sim.missing", 0) < 0 && errno == ENOENT,
+          "missing snapshot gives ENOENT");
+    CHECK(snapshot_ioctl(f, IOCTL_LOAD, NULL, 0) < 0 && errno == EFAULT,
+          "bad path pointer gives EFAULT");
+
+    /* Flip a byte of the first instance's data, just past the two headers */
+    sim_ioctl(f, IOCTL_RESET, 0);
+    fd = open(path, O_RDWR);
+    buf[0] = 0;
+    if (fd >= 0 && pread(fd, buf, 1, SNAPSHOT_DATA) == 1)
+        buf[0] ^= 0x55;
+    CHECK(fd >= 0 && pwrite(fd, buf, 1, SNAPSHOT_DATA) == 1, "damage the snapshot");
+    if (fd >= 0)
+        close(fd);
+    CHECK(snapshot_ioctl(f, IOCTL_LOAD, path, 0) < 0 &&
+          (errno == EBADMSG || errno == EINVAL) &&
+          sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&size) == 0 && size == 0,
+          "a damaged snapshot is refused and changes nothing");
+
+    /* Saved on unload, restored on load */
+    sim_pwrite(f, "warm state", 10, 0);
+    sim_close(f);
+    sim_set_param("snapshot_path=chardev_sim.snap");
+    sim_unload();
+    sim_load();
+    f = sim_open(0, O_RDWR);
+    CHECK(sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&size) == 0 && size == 10 &&
+          sim_pread(f, buf, 10, 0) == 10 && memcmp(buf, "warm state", 10) == 0,
+          "snapshot_path survives a reload");
+    sim_close(f);
+
+    test_lazy_restore(path);
+    sim_set_param("snapshot_path=");
+    unlink(path);
+}
+
+static long set_mirror(struct sim_file *f, unsigned int standby, unsigned int mode)
+{
+    struct chardev_mirror_req req = { .standby = standby, .mode = mode };
+
+    return sim_ioctl(f, IOCTL_SET_MIRROR, (unsigned long)&req);
+}
+
+/* The whole buffers of two instances match */
+static int same_contents(struct sim_file *a, struct sim_file *b)
+{
+    static char x[BUFFER_SIZE], y[BUFFER_SIZE];
+    int xs = -1, ys = -2, xf = 0, yf = 1;
+
+    sim_ioctl(a, IOCTL_GET_SIZE, (unsigned long)&xs);
+    sim_ioctl(b, IOCTL_GET_SIZE, (unsigned long)&ys);
+    sim_ioctl(a, IOCTL_GET_FLAG, (unsigned long)&xf);
+    sim_ioctl(b, IOCTL_GET_FLAG, (unsigned long)&yf);
+    return xs == ys && xf == yf && sim_pread(a, x, sizeof(x), 0) == xs &&
+           sim_pread(b, y, sizeof(y), 0) == ys && memcmp(x, y, xs) == 0;
+}
+
+static void test_mirror(void)
+{
+    unsigned int n = sim_num_devices();
+    struct chardev_mirror_status st;
+    struct sim_file *p, *s;
+    char buf[32];
+    int i, flag = 11;
+
+    if (n < 2) {
+        printf("[SKIP] mirroring (load with -p num_devices=2)\n");
+        return;
+    }
+
+    p = sim_open(0, O_RDWR);
+    s = sim_open(1, O_RDWR);
+    sim_ioctl(p, IOCTL_RESET, 0);
+    sim_ioctl(s, IOCTL_RESET, 0);
+    sim_pwrite(p, "before pairing", 14, 0);
+    sim_pwrite(s, "stale", 5, 100);
+
+    CHECK(set_mirror(p, 1, CHARDEV_MIRROR_SYNC) == 0, "IOCTL_SET_MIRROR sync");
+    CHECK(same_contents(p, s), "the standby starts as a copy");
+    sim_pwrite(p, "replicated", 10, 20);
+    sim_ioctl(p, IOCTL_SET_FLAG, (unsigned long)&flag);
+    CHECK(same_contents(p, s), "a synchronous standby has every change on return");
+    CHECK(sim_pwrite(s, "x", 1, 0) < 0 && errno == EROFS &&
+          sim_ioctl(s, IOCTL_RESET, 0) < 0 && errno == EROFS,
+          "the standby refuses changes of its own");
+
+    CHECK(sim_ioctl(s, IOCTL_GET_MIRROR, (unsigned long)&st) == 0 && st.primary == 0 &&
+          st.standby == -1 && st.mode == CHARDEV_MIRROR_SYNC, "IOCTL_GET_MIRROR on the standby");
+    CHECK(sim_ioctl(p, IOCTL_GET_MIRROR, (unsigned long)&st) == 0 && st.primary == -1 &&
+          st.standby == 1 && st.queued == 2 && st.applied == 2 && st.pending == 0,
+          "IOCTL_GET_MIRROR on the primary counts the changes");
+
+    CHECK(set_mirror(p, 1, CHARDEV_MIRROR_ASYNC) < 0 && errno == EBUSY &&
+          set_mirror(s, 0, CHARDEV_MIRROR_SYNC) < 0 && errno == EBUSY,
+          "pairs do not overlap");
+    CHECK(set_mirror(p, 0, CHARDEV_MIRROR_SYNC) < 0 && errno == EINVAL &&
+          set_mirror(p, n, CHARDEV_MIRROR_SYNC) < 0 && errno == EINVAL &&
+          set_mirror(p, 1, 7) < 0 && errno == EINVAL, "bad pairings give EINVAL");
+    CHECK(sim_ioctl(p, IOCTL_PROMOTE, 0) < 0 && errno == EINVAL,
+          "only a standby can be promoted");
+
+    CHECK(set_mirror(p, 1, CHARDEV_MIRROR_OFF) == 0 && sim_pwrite(s, "own", 3, 0) == 3,
+          "a standby let go takes changes again");
+
+    /* Asynchronous: many changes, then the thread catches up */
+    CHECK(set_mirror(p, 1, CHARDEV_MIRROR_ASYNC) == 0, "IOCTL_SET_MIRROR async");
+    for (i = 0; i < 500; i++) {
+        snprintf(buf, sizeof(buf), "change %04d", i);
+        sim_pwrite(p, buf, 11, (i * 11) % (BUFFER_SIZE - 11));
+    }
+    for (i = 0; i < 1000; i++) {
+        sim_ioctl(p, IOCTL_GET_MIRROR, (unsigned long)&st);
+        if (st.pending == 0)
+            break;
+        usleep(1000);
+    }
+    CHECK(st.pending == 0 && st.applied == st.queued && st.queued == 500 &&
+          st.pending_bytes == 0 && st.lag_ns == 0, "the mirror thread catches up");
+    CHECK(st.max_lag_ns > 0, "replication lag is measured");
+    CHECK(same_contents(p, s), "an asynchronous standby converges");
+
+    /* Failover: promote straight after a burst */
+    for (i = 0; i < 200; i++)
+        sim_pwrite(p, "burst", 5, i * 5);
+    CHECK(sim_ioctl(s, IOCTL_PROMOTE, 0) == 0, "IOCTL_PROMOTE");
+    CHECK(same_contents(p, s), "the promoted standby has every change sent");
+    CHECK(sim_ioctl(s, IOCTL_GET_MIRROR, (unsigned long)&st) == 0 && st.primary == -1 &&
+          st.mode == CHARDEV_MIRROR_OFF && sim_pwrite(s, "mine", 4, 0) == 4,
+          "the promoted standby stands alone");
+
+    /* Unloading with a pair still running lets the standby catch up first */
+    set_mirror(p, 1, CHARDEV_MIRROR_ASYNC);
+    sim_pwrite(p, "last", 4, 0);
+    sim_close(p);
+    sim_close(s);
+    sim_unload();
+    CHECK(sim_load() == 0, "unload with a mirror running");
+}
+
+static long set_tee(struct sim_file *f, unsigned long long sinks)
+{
+    struct chardev_tee tee = { .sinks = sinks };
+
+    return sim_ioctl(f, IOCTL_SET_TEE, (unsigned long)&tee);
+}
+
+/* Instance 0 fans out to every other one */
+static void test_tee(void)
+{
+    unsigned int n = sim_num_devices();
+    struct chardev_batch_entry entry = { .buf = (unsigned long)"batched", .offset = 40, .len = 7 };
+    struct chardev_batch batch = { .entries = (unsigned long)&entry, .count = 1 };
+    struct chardev_stats before, after;
+    unsigned long long sinks;
+    struct chardev_tee tee;
+    struct sim_file *src, *sink;
+    char buf[64];
+    unsigned int i;
+    int ok;
+
+    if (n < 2) {
+        printf("[SKIP] tee (load with -p num_devices=2)\n");
+        return;
+    }
+
+    sinks = ((1ULL << n) - 1) & ~1ULL;
+    src = sim_open(0, O_RDWR);
+    sim_ioctl(src, IOCTL_RESET, 0);
+    for (i = 1; i < n; i++) {
+        sink = sim_open(i, O_RDWR);
+        sim_ioctl(sink, IOCTL_RESET, 0);
+        sim_close(sink);
+    }
+
+    CHECK(set_tee(src, sinks) == 0, "IOCTL_SET_TEE");
+    CHECK(sim_ioctl(src, IOCTL_GET_TEE, (unsigned long)&tee) == 0 && tee.sinks == sinks,
+          "IOCTL_GET_TEE");
+
+    sink = sim_open(n - 1, O_RDWR);
+    sim_ioctl(sink, IOCTL_GET_STATS, (unsigned long)&before);
+    sim_close(sink);
+
+    sim_pwrite(src, "fanned out", 10, 20);
+    sim_ioctl(src, IOCTL_WRITE_BATCH, (unsigned long)&batch);
+    for (ok = 1, i = 1; i < n; i++) {
+        sink = sim_open(i, O_RDWR);
+        memset(buf, 0, sizeof(buf));
+        ok &= sim_pread(sink, buf, sizeof(buf), 0) == 47 &&
+              memcmp(buf + 20, "fanned out", 10) == 0 && memcmp(buf + 40, "batched", 7) == 0;
+        sim_close(sink);
+    }
+    CHECK(ok, "writes and batch entries reach every sink");
+
+    sink = sim_open(n - 1, O_RDWR);
+    sim_ioctl(sink, IOCTL_GET_STATS, (unsigned long)&after);
+    CHECK(after.writes == before.writes + 2 && after.bytes_written == before.bytes_written + 17,
+          "sinks count the writes they got");
+    CHECK(set_tee(sink, 1) < 0 && errno == EBUSY, "a sink cannot tee back");
+    CHECK(set_mirror(sink, 0, CHARDEV_MIRROR_SYNC) < 0 && errno == EBUSY,
+          "a source cannot become a standby");
+    CHECK(set_mirror(src, n - 1, CHARDEV_MIRROR_SYNC) < 0 && errno == EBUSY,
+          "a sink cannot become a standby");
+    sim_close(sink);
+
+    /* Source, sink, then the sink's standby: three instance locks nested */
+    if (n >= 3) {
+        sink = sim_open(1, O_RDWR);
+        CHECK(set_tee(src, 2) == 0 && set_mirror(sink, 2, CHARDEV_MIRROR_SYNC) == 0,
+              "a sink can mirror to a standby");
+        sim_pwrite(src, "three deep", 10, 0);
+        sim_close(sink);
+        sink = sim_open(2, O_RDWR);
+        CHECK(sim_pread(sink, buf, 10, 0) == 10 && memcmp(buf, "three deep", 10) == 0,
+              "the sink's standby gets the write");
+        sim_close(sink);
+        CHECK(set_tee(src, 4) < 0 && errno == EBUSY, "a standby cannot become a sink");
+        sink = sim_open(1, O_RDWR);
+        set_mirror(sink, 2, CHARDEV_MIRROR_OFF);
+        sim_close(sink);
+        set_tee(src, sinks);
+    }
+    CHECK(set_tee(src, 1) < 0 && errno == EINVAL &&
+          set_tee(src, 1ULL << n) < 0 && errno == EINVAL, "bad sinks give EINVAL");
+
+    CHECK(set_tee(src, 0) == 0, "IOCTL_SET_TEE with no sinks");
+    sim_pwrite(src, "alone", 5, 0);
+    sink = sim_open(1, O_RDWR);
+    CHECK(sim_pread(sink, buf, 5, 0) == 5 && memcmp(buf, "alone", 5) != 0,
+          "untee'd writes stay in the source");
+    sim_close(sink);
+
+    /* A sink that cannot log its copy is left out; the source write stands */
+    if (sim_debugfs_read("chardev/wal", buf, sizeof(buf)) < 0) {
+        sim_close(src);
+        return;
+    }
+    set_tee(src, 2);
+    sim_ioctl(src, IOCTL_GET_STATS, (unsigned long)&before);
+    sim_fail_kernel_write(1, ENOSPC);
+    CHECK(sim_pwrite(src, "sticky", 6, 60) == 6, "a failed sink copy does not fail the write");
+    sim_ioctl(src, IOCTL_GET_STATS, (unsigned long)&after);
+    CHECK(sim_ioctl(src, IOCTL_GET_TEE, (unsigned long)&tee) == 0 && tee.sinks == 2 &&
+          tee.failed == 2 && after.tee_errors == before.tee_errors + 1 &&
+          after.writes == before.writes + 1 && after.bytes_written == before.bytes_written + 6,
+          "the failed sink is counted and left out");
+    CHECK(set_tee(src, 2) == 0 && sim_ioctl(src, IOCTL_GET_TEE, (unsigned long)&tee) == 0 &&
+          tee.failed == 0, "setting the tee again brings the sink back");
+    sim_close(src);
+
+    /* The log refuses everything after a failure until it is reopened */
+    sim_unload();
+    CHECK(sim_load() == 0, "reload after a failed sink copy");
+    src = sim_open(0, O_RDWR);
+    CHECK(sim_pread(src, buf, 6, 60) == 6 && memcmp(buf, "sticky", 6) == 0,
+          "the source's write was logged before the sink failed");
+    sim_close(src);
+}
+
+/* Hammer one instance from several threads; meant for the TSan build */
+static void *stress_fn(void *arg)
+{
+    struct sim_file *f = sim_open(0, O_RDWR);
+    char buf[128];
+    long id = (long)arg;
+    int i, value;
+
+    memset(buf, 'a' + id, sizeof(buf));
+    for (i = 0; i < STRESS_ITERATIONS; i++) {
+        switch ((i + id) % 4) {
+            case 0:
+                sim_pwrite(f, buf, sizeof(buf), (i * 64) % BUFFER_SIZE);
+                break;
+            case 1:
+                sim_pread(f, buf, sizeof(buf), (i * 32) % BUFFER_SIZE);
+                break;
+            case 2:
+                sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&value);
+                break;
+            default:
+                if (i % 1000 == 0)
+                    sim_ioctl(f, IOCTL_RESET, 0);
+                else
+                    sim_ioctl(f, IOCTL_SET_FLAG, (unsigned long)&i);
+                break;
+        }
+    }
+
+    sim_close(f);
+    return NULL;
+}
+
+/* Ops counted by all stats snapshots of instance 0 */
+static unsigned long long stats_ops(const struct chardev_stats *st)
+{
+    return st->reads + st->writes + st->ioctls;
+}
+
+/* Poll IOCTL_GET_STATS while the stress threads run */
+struct stats_poller {
+    atomic_int stop;
+    unsigned long snapshots;
+    unsigned long bad;
+};
+
+static void *stats_poll_fn(void *arg)
+{
+    struct stats_poller *p = arg;
+    struct sim_file *f = sim_open(0, O_RDONLY);
+    struct chardev_stats st;
+    unsigned long long last = 0, buckets;
+    int i;
+
+    while (!atomic_load(&p->stop)) {
+        if (sim_ioctl(f, IOCTL_GET_STATS, (unsigned long)&st) < 0) {
+            p->bad++;
+            continue;
+        }
+        for (buckets = 0, i = 0; i < CHARDEV_HIST_BUCKETS; i++)
+            buckets += st.queue_delay.buckets[i];
+        if (stats_ops(&st) < last || buckets != st.queue_delay.count)
+            p->bad++;
+        last = stats_ops(&st);
+        p->snapshots++;
+    }
+
+    sim_close(f);
+    return NULL;
+}
+
+static void test_concurrency(void)
+{
+    pthread_t threads[STRESS_THREADS], poll_thread;
+    struct stats_poller poller = { .stop = 0 };
+    struct chardev_stats before, after;
+    long i;
+    int size;
+    struct sim_file *f;
+
+    f = sim_open(0, O_RDWR);
+    sim_ioctl(f, IOCTL_GET_STATS, (unsigned long)&before);
+
+    pthread_create(&poll_thread, NULL, stats_poll_fn, &poller);
+    for (i = 0; i < STRESS_THREADS; i++)
+        pthread_create(&threads[i], NULL, stress_fn, (void *)i);
+    for (i = 0; i < STRESS_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    atomic_store(&poller.stop, 1);
+    pthread_join(poll_thread, NULL);
+
+    CHECK(sim_ioctl(f, IOCTL_GET_SIZE, (unsigned long)&size) == 0 &&
+          size >= 0 && size <= BUFFER_SIZE, "state consistent after concurrent access");
+    CHECK(poller.snapshots > 0 && poller.bad == 0,
+          "stats snapshots taken under load are monotonic and consistent");
+    sim_ioctl(f, IOCTL_GET_STATS, (unsigned long)&after);
+    CHECK(stats_ops(&after) - stats_ops(&before) ==
+          (unsigned long long)STRESS_THREADS * STRESS_ITERATIONS + 1,
+          "per-CPU counters add up to every operation");
+    sim_close(f);
+}
+
+static int run_tests(void)
+{
+    test_open_close();
+    test_write_read();
+    test_ioctl_reset();
+    test_ioctl_get_size();
+    test_ioctl_flag();
+    test_multiple_operations();
+    test_edge_cases();
+    test_selftest_bench();
+    test_write_batch();
+    test_tracepoints();
+    test_queue_delay();
+    test_lock_stats();
+    test_fdinfo();
+    test_ring();
+    test_stats();
+    test_slo();
+    test_instances();
+    test_wal();
+    test_snapshot();
+    test_mirror();
+    test_tee();
+    test_concurrency();
+
+    printf("\n%d failure(s)\n", failures);
+    return failures ? 1 : 0;
+}
+
+/*
+ * Throughput benchmark straight into the file operations (no syscalls)
+ */
+struct sim_worker {
+    pthread_t thread;
+    unsigned int minor;
+    int is_writer;
+    size_t io_size;
+    atomic_int *stop;
+    unsigned long long ops;
+    unsigned long long bytes;
+};
+
+static void *bench_fn(void *arg)
+{
+    struct sim_worker *w = arg;
+    struct sim_file *f = sim_open(w->minor, O_RDWR);
+    char *buf = malloc(w->io_size);
+    ssize_t ret;
+
+    if (!f || !buf) {
+        free(buf);
+        if (f)
+            sim_close(f);
+        return NULL;
+    }
+    memset(buf, 'S', w->io_size);
+
+    while (!atomic_load_explicit(w->stop, memory_order_relaxed)) {
+        if (w->is_writer)
+            ret = sim_pwrite(f, buf, w->io_size, 0);
+        else
+            ret = sim_pread(f, buf, w->io_size, 0);
+        if (ret < 0)
+            break;
+        w->ops++;
+        w->bytes += ret;
+    }
+
+    sim_close(f);
+    free(buf);
+    return NULL;
+}
+
+static double tv_sec(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int run_bench(int argc, char *argv[])
+{
+    struct sim_worker workers[SIM_MAX_THREADS];
+    int readers = 1, writers = 1, nthreads, opt, i;
+    unsigned int ndev = sim_num_devices();
+    unsigned long long ops = 0, bytes = 0;
+    struct timespec t0, t1, sleep_ts;
+    struct rusage ru0, ru1;
+    size_t io_size = 64;
+    double seconds = 1.0, elapsed;
+    atomic_int stop = 0;
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "r:w:s:t:")) != -1) {
+        switch (opt) {
+            case 'r':
+                readers = atoi(optarg);
+                break;
+            case 'w':
+                writers = atoi(optarg);
+                break;
+            case 's':
+                io_size = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: chardev_sim bench [-r N] [-w N] [-s SIZE] [-t SECS]\n");
+                return 1;
+        }
+    }
+
+    nthreads = readers + writers;
+    if (nthreads < 1 || nthreads > SIM_MAX_THREADS || io_size == 0 || seconds <= 0) {
+        fprintf(stderr, "chardev_sim: invalid benchmark parameters\n");
+        return 1;
+    }
+
+    memset(workers, 0, sizeof(workers));
+    getrusage(RUSAGE_SELF, &ru0);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (i = 0; i < nthreads; i++) {
+        workers[i].minor = i % ndev;
+        workers[i].is_writer = i < writers;
+        workers[i].io_size = io_size;
+        workers[i].stop = &stop;
+        pthread_create(&workers[i].thread, NULL, bench_fn, &workers[i]);
+    }
+
+    sleep_ts.tv_sec = (time_t)seconds;
+    sleep_ts.tv_nsec = (long)((seconds - sleep_ts.tv_sec) * 1e9);
+    nanosleep(&sleep_ts, NULL);
+    atomic_store(&stop, 1);
+
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        ops += workers[i].ops;
+        bytes += workers[i].bytes;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    getrusage(RUSAGE_SELF, &ru1);
+    elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("readers,writers,devices,io_size,seconds,ops_per_sec,mb_per_sec,cpu_pct\n");
+    printf("%d,%d,%u,%zu,%.3f,%.1f,%.3f,%.1f\n", readers, writers, ndev, io_size,
+           elapsed, ops / elapsed, bytes / elapsed / 1e6,
+           100.0 * (tv_sec(ru1.ru_utime) - tv_sec(ru0.ru_utime) +
+                    tv_sec(ru1.ru_stime) - tv_sec(ru0.ru_stime)) / elapsed);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-v] [-T] [-p param=value]... test\n"
+            "       %s [-v] [-T] [-p param=value]... kunit\n"
+            "       %s [-v] [-T] [-p param=value]... bench [-r N] [-w N] [-s SIZE] [-t SECS]\n",
+            prog, prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt, ret;
+
+    /* Stop at the subcommand so its options are left alone */
+    while ((opt = getopt(argc, argv, "+vTp:")) != -1) {
+        switch (opt) {
+            case 'v':
+                sim_verbose = 1;
+                break;
+            case 'T':
+                sim_tracing = 1;
+                break;
+            case 'p':
+                ret = sim_set_param(optarg);
+                if (ret < 0) {
+                    fprintf(stderr, "chardev_sim: bad parameter '%s': %s\n",
+                            optarg, strerror(-ret));
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ret = sim_load();
+    if (ret < 0) {
+        fprintf(stderr, "chardev_sim: module init failed: %s\n", strerror(-ret));
+        return 1;
+    }
+
+    if (strcmp(argv[optind], "test") == 0) {
+        ret = run_tests();
+    } else if (strcmp(argv[optind], "kunit") == 0) {
+        ret = sim_kunit_run_all() ? 1 : 0;
+    } else if (strcmp(argv[optind], "bench") == 0) {
+        ret = run_bench(argc - optind, argv + optind);
+    } else {
+        usage(argv[0]);
+        ret = 1;
+    }
+
+    sim_unload();
+    return ret;
+}
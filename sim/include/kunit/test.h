@@ -0,0 +1,87 @@
+/*
+ * Userspace shim: the subset of KUnit used by chardev_kunit.c
+ *
+ * Suites register themselves at startup; "chardev_sim kunit" runs them and
+ * prints KTAP-style results. Assertions end the test case by returning
+ * from it, so they may only be used directly in the case function.
+ */
+#ifndef _SIM_KUNIT_TEST_H
+#define _SIM_KUNIT_TEST_H
+
+#include <stdio.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+
+#define KUNIT_MAX_ALLOCS 64
+
+struct kunit {
+    const char *name;
+    void *priv;
+    int failed;
+    void *allocs[KUNIT_MAX_ALLOCS];
+    int num_allocs;
+};
+
+struct kunit_case {
+    void (*run_case)(struct kunit *test);
+    const char *name;
+};
+
+struct kunit_suite {
+    const char *name;
+    int (*init)(struct kunit *test);
+    void (*exit)(struct kunit *test);
+    struct kunit_case *test_cases;
+};
+
+#define KUNIT_CASE(fn) { .run_case = fn, .name = #fn }
+
+void sim_kunit_register(struct kunit_suite *suite);
+int sim_kunit_run_all(void);
+void *kunit_kzalloc(struct kunit *test, size_t size, gfp_t gfp);
+void sim_kunit_fail(struct kunit *test, const char *file, int line, const char *expr);
+
+#define kunit_test_suites(...)                                              \
+    static void __attribute__((constructor)) __sim_kunit_register(void)     \
+    {                                                                       \
+        struct kunit_suite *suites[] = { __VA_ARGS__ };                     \
+        size_t i;                                                           \
+        for (i = 0; i < ARRAY_SIZE(suites); i++)                            \
+            sim_kunit_register(suites[i]);                                  \
+    }
+#define kunit_test_suite(suite) kunit_test_suites(&suite)
+
+#define kunit_info(test, fmt, ...) printf("    # %s: " fmt, (test)->name, ##__VA_ARGS__)
+
+#define KUNIT_EXPECT_TRUE(test, cond)                                       \
+    do {                                                                    \
+        if (!(cond))                                                        \
+            sim_kunit_fail(test, __FILE__, __LINE__, #cond);                \
+    } while (0)
+
+#define KUNIT_EXPECT_FALSE(test, cond) KUNIT_EXPECT_TRUE(test, !(cond))
+#define KUNIT_EXPECT_EQ(test, a, b) KUNIT_EXPECT_TRUE(test, (a) == (b))
+#define KUNIT_EXPECT_NE(test, a, b) KUNIT_EXPECT_TRUE(test, (a) != (b))
+#define KUNIT_EXPECT_LT(test, a, b) KUNIT_EXPECT_TRUE(test, (a) < (b))
+#define KUNIT_EXPECT_LE(test, a, b) KUNIT_EXPECT_TRUE(test, (a) <= (b))
+#define KUNIT_EXPECT_GT(test, a, b) KUNIT_EXPECT_TRUE(test, (a) > (b))
+#define KUNIT_EXPECT_GE(test, a, b) KUNIT_EXPECT_TRUE(test, (a) >= (b))
+#define KUNIT_EXPECT_NULL(test, p) KUNIT_EXPECT_TRUE(test, (p) == NULL)
+#define KUNIT_EXPECT_NOT_NULL(test, p) KUNIT_EXPECT_TRUE(test, (p) != NULL)
+#define KUNIT_EXPECT_MEMEQ(test, a, b, n) KUNIT_EXPECT_TRUE(test, memcmp(a, b, n) == 0)
+
+#define KUNIT_ASSERT_TRUE(test, cond)                                       \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            sim_kunit_fail(test, __FILE__, __LINE__, #cond);                \
+            return;                                                         \
+        }                                                                   \
+    } while (0)
+
+#define KUNIT_ASSERT_EQ(test, a, b) KUNIT_ASSERT_TRUE(test, (a) == (b))
+#define KUNIT_ASSERT_GT(test, a, b) KUNIT_ASSERT_TRUE(test, (a) > (b))
+#define KUNIT_ASSERT_GE(test, a, b) KUNIT_ASSERT_TRUE(test, (a) >= (b))
+#define KUNIT_ASSERT_NOT_NULL(test, p) KUNIT_ASSERT_TRUE(test, (p) != NULL)
+#define KUNIT_ASSERT_NOT_ERR_OR_NULL(test, p) KUNIT_ASSERT_TRUE(test, !IS_ERR_OR_NULL(p))
+
+#endif /* _SIM_KUNIT_TEST_H */
@@ -0,0 +1,18 @@
+/*
+ * Userspace shim: atomic_t on the compiler's atomic builtins
+ */
+#ifndef _SIM_LINUX_ATOMIC_H
+#define _SIM_LINUX_ATOMIC_H
+
+typedef struct {
+    int counter;
+} atomic_t;
+
+#define ATOMIC_INIT(i) { (i) }
+
+#define atomic_read(v)      __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_set(v, i)    __atomic_store_n(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_inc(v)       ((void)__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+#define atomic_dec(v)       ((void)__atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST))
+
+#endif /* _SIM_LINUX_ATOMIC_H */
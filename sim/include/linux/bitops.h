@@ -0,0 +1,18 @@
+/*
+ * Userspace shim: bit operations
+ */
+#ifndef _SIM_LINUX_BITOPS_H
+#define _SIM_LINUX_BITOPS_H
+
+#include <linux/kernel.h>
+
+#define BIT(nr) (1UL << (nr))
+#define BIT_ULL(nr) (1ULL << (nr))
+
+/* Position of the most significant set bit, 1-based; 0 for 0 */
+static inline int fls64(u64 x)
+{
+    return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+#endif /* _SIM_LINUX_BITOPS_H */
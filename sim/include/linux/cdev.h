@@ -0,0 +1,23 @@
+/*
+ * Userspace shim: character devices
+ *
+ * cdev_add() records the device in the simulator's table so the harness
+ * can open it by minor number.
+ */
+#ifndef _SIM_LINUX_CDEV_H
+#define _SIM_LINUX_CDEV_H
+
+#include <linux/fs.h>
+
+struct cdev {
+    struct module *owner;
+    const struct file_operations *ops;
+    dev_t dev;
+    unsigned int count;
+};
+
+void cdev_init(struct cdev *cdev, const struct file_operations *fops);
+int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count);
+void cdev_del(struct cdev *cdev);
+
+#endif /* _SIM_LINUX_CDEV_H */
@@ -0,0 +1,22 @@
+/*
+ * Userspace shim: CRC32 (little-endian, polynomial 0xedb88320)
+ */
+#ifndef _SIM_LINUX_CRC32_H
+#define _SIM_LINUX_CRC32_H
+
+#include <linux/kernel.h>
+
+/* Bit at a time: slow, but only the result matters here */
+static inline u32 crc32_le(u32 crc, const unsigned char *p, size_t len)
+{
+    int i;
+
+    while (len--) {
+        crc ^= *p++;
+        for (i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return crc;
+}
+
+#endif /* _SIM_LINUX_CRC32_H */
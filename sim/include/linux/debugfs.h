@@ -0,0 +1,30 @@
+/*
+ * Userspace shim: debugfs
+ *
+ * Files live in a table inside the harness, addressed by their path below
+ * the debugfs root ("chardev/chardev/queue_delay"); sim_debugfs_read() and
+ * sim_debugfs_write() open them and go through their file_operations.
+ */
+#ifndef _SIM_LINUX_DEBUGFS_H
+#define _SIM_LINUX_DEBUGFS_H
+
+#include <linux/kernel.h>
+#include <linux/fs.h>
+
+struct dentry;
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, umode_t mode, struct dentry *parent,
+                                   void *data, const struct file_operations *fops);
+void debugfs_remove_recursive(struct dentry *dentry);
+
+/* The size only shows in stat(), which the harness has no use for */
+static inline void debugfs_create_file_size(const char *name, umode_t mode,
+                                            struct dentry *parent, void *data,
+                                            const struct file_operations *fops,
+                                            loff_t file_size)
+{
+    debugfs_create_file(name, mode, parent, data, fops);
+}
+
+#endif /* _SIM_LINUX_DEBUGFS_H */
@@ -0,0 +1,39 @@
+/*
+ * Userspace shim: device classes and device nodes
+ */
+#ifndef _SIM_LINUX_DEVICE_H
+#define _SIM_LINUX_DEVICE_H
+
+#include <linux/fs.h>
+#include <linux/kobject.h>
+
+struct class {
+    const char *name;
+};
+
+struct device {
+    struct kobject kobj;
+    dev_t devt;
+    char name[64];
+    void *driver_data;
+};
+
+struct class *class_create(const char *name);
+void class_destroy(struct class *cls);
+
+struct device *device_create(struct class *cls, struct device *parent, dev_t devt,
+                             void *drvdata, const char *fmt, ...)
+    __attribute__((format(printf, 5, 6)));
+void device_destroy(struct class *cls, dev_t devt);
+
+static inline const char *dev_name(const struct device *dev)
+{
+    return dev->name;
+}
+
+static inline void *dev_get_drvdata(const struct device *dev)
+{
+    return dev->driver_data;
+}
+
+#endif /* _SIM_LINUX_DEVICE_H */
@@ -0,0 +1,93 @@
+/*
+ * Userspace shim: files, inodes, file_operations, device numbers and the
+ * in-kernel file API, which goes straight to a host file descriptor
+ */
+#ifndef _SIM_LINUX_FS_H
+#define _SIM_LINUX_FS_H
+
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/kernel.h>
+#include <linux/ioctl.h>
+
+typedef unsigned int fmode_t;
+
+#define MINORBITS   20
+#define MINORMASK   ((1U << MINORBITS) - 1)
+#define MAJOR(dev)  ((unsigned int)((dev) >> MINORBITS))
+#define MINOR(dev)  ((unsigned int)((dev) & MINORMASK))
+#define MKDEV(ma, mi) (((ma) << MINORBITS) | (mi))
+
+#define FMODE_READ  0x1
+#define FMODE_WRITE 0x2
+
+#ifndef O_LARGEFILE
+#define O_LARGEFILE 0
+#endif
+
+typedef void *fl_owner_t;
+
+struct module;
+struct cdev;
+struct file;
+struct seq_file;
+struct vm_area_struct;
+
+struct inode {
+    dev_t i_rdev;
+    struct cdev *i_cdev;
+    void *i_private;
+};
+
+static inline unsigned int iminor(const struct inode *inode)
+{
+    return MINOR(inode->i_rdev);
+}
+
+struct path {
+    int sim_fd;
+};
+
+struct file {
+    void *private_data;
+    struct path f_path;
+    loff_t f_pos;
+    unsigned int f_flags;
+    fmode_t f_mode;
+    struct inode *f_inode;
+    const struct file_operations *f_op;
+};
+
+static inline struct inode *file_inode(const struct file *file)
+{
+    return file->f_inode;
+}
+
+struct file_operations {
+    struct module *owner;
+    loff_t (*llseek)(struct file *, loff_t, int);
+    ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+    ssize_t (*write)(struct file *, const char __user *, size_t, loff_t *);
+    long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+    int (*mmap)(struct file *, struct vm_area_struct *);
+    int (*open)(struct inode *, struct file *);
+    int (*release)(struct inode *, struct file *);
+    void (*show_fdinfo)(struct seq_file *, struct file *);
+};
+
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos,
+                                const void *from, size_t available);
+loff_t default_llseek(struct file *file, loff_t offset, int whence);
+
+struct file *filp_open(const char *filename, int flags, umode_t mode);
+int filp_close(struct file *filp, fl_owner_t id);
+ssize_t kernel_read(struct file *file, void *buf, size_t count, loff_t *pos);
+ssize_t kernel_write(struct file *file, const void *buf, size_t count, loff_t *pos);
+int vfs_fsync(struct file *file, int datasync);
+int vfs_truncate(const struct path *path, loff_t length);
+
+int alloc_chrdev_region(dev_t *dev, unsigned int baseminor, unsigned int count,
+                        const char *name);
+void unregister_chrdev_region(dev_t from, unsigned int count);
+
+#endif /* _SIM_LINUX_FS_H */
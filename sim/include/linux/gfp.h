@@ -0,0 +1,28 @@
+/*
+ * Userspace shim: page allocator
+ *
+ * A struct page is only ever handled by pointer, so a page-sized heap block
+ * stands in for both the descriptor and the memory behind it.
+ */
+#ifndef _SIM_LINUX_GFP_H
+#define _SIM_LINUX_GFP_H
+
+#include <stdlib.h>
+#include <linux/slab.h>
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE  (1UL << PAGE_SHIFT)
+
+struct page;
+
+static inline struct page *alloc_page(gfp_t flags)
+{
+    return (struct page *)malloc(PAGE_SIZE);
+}
+
+static inline void __free_page(struct page *page)
+{
+    free(page);
+}
+
+#endif /* _SIM_LINUX_GFP_H */
@@ -0,0 +1,23 @@
+/*
+ * Userspace shim: static keys
+ *
+ * No code patching here: a key is a flag read on every branch, which is
+ * enough to exercise both sides of it.
+ */
+#ifndef _SIM_LINUX_JUMP_LABEL_H
+#define _SIM_LINUX_JUMP_LABEL_H
+
+#include <linux/kernel.h>
+
+struct static_key_false {
+    int enabled;
+};
+
+#define DEFINE_STATIC_KEY_FALSE(name) struct static_key_false name = { 0 }
+
+#define static_key_enabled(key)      __atomic_load_n(&(key)->enabled, __ATOMIC_RELAXED)
+#define static_branch_unlikely(key)  unlikely(static_key_enabled(key))
+#define static_branch_enable(key)    __atomic_store_n(&(key)->enabled, 1, __ATOMIC_RELAXED)
+#define static_branch_disable(key)   __atomic_store_n(&(key)->enabled, 0, __ATOMIC_RELAXED)
+
+#endif /* _SIM_LINUX_JUMP_LABEL_H */
@@ -0,0 +1,98 @@
+/*
+ * Userspace shim: core kernel helpers (types, min/max, container_of, printk)
+ */
+#ifndef _SIM_LINUX_KERNEL_H
+#define _SIM_LINUX_KERNEL_H
+
+#include <errno.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <linux/types.h>
+#include <linux/stringify.h>
+#include <linux/err.h>
+
+#define ERESTARTSYS 512
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef long long s64;
+typedef unsigned short umode_t;
+
+#define __init
+#define __exit
+#define __user
+#define __must_check
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define min(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a < _b ? _a : _b; })
+#define max(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a > _b ? _a : _b; })
+#define min_t(type, a, b) min((type)(a), (type)(b))
+#define max_t(type, a, b) max((type)(a), (type)(b))
+
+#define U32_MAX ((u32)~0U)
+#define U64_MAX ((u64)~0ULL)
+#define NSEC_PER_USEC 1000ULL
+
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define ALIGN(x, a) (((x) + (a) - 1) & ~((__typeof__(x))(a) - 1))
+
+#define u64_to_user_ptr(x) ((void __user *)(uintptr_t)(x))
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+#define barrier() __asm__ __volatile__("" ::: "memory")
+
+/* Relaxed atomics rather than volatile, so TSan sees them as intended races */
+#define READ_ONCE(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+#define smp_load_acquire(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/* Parse "1"/"0", "y"/"n", "on"/"off" from a user buffer */
+static inline int kstrtobool_from_user(const char __user *s, size_t count, bool *res)
+{
+    char buf[4] = { 0 };
+
+    memcpy(buf, s, min(count, sizeof(buf) - 1));
+    switch (buf[0]) {
+        case '1': case 'y': case 'Y':
+            *res = true;
+            return 0;
+        case '0': case 'n': case 'N':
+            *res = false;
+            return 0;
+        case 'o': case 'O':
+            if (buf[1] == 'n' || buf[1] == 'N') {
+                *res = true;
+                return 0;
+            }
+            if (buf[1] == 'f' || buf[1] == 'F') {
+                *res = false;
+                return 0;
+            }
+            break;
+    }
+    return -EINVAL;
+}
+
+/* Kernel messages are dropped unless the harness asks for them */
+extern int sim_verbose;
+int sim_printk(const char *level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define pr_info(fmt, ...)  sim_printk("info", fmt, ##__VA_ARGS__)
+#define pr_warn(fmt, ...)  sim_printk("warn", fmt, ##__VA_ARGS__)
+#define pr_err(fmt, ...)   sim_printk("err", fmt, ##__VA_ARGS__)
+#define pr_debug(fmt, ...) do { } while (0)
+
+#endif /* _SIM_LINUX_KERNEL_H */
@@ -0,0 +1,22 @@
+/*
+ * Userspace shim: kobjects, only as far as uevents need them
+ *
+ * kobject_uevent_env() keeps the latest event for the harness (see
+ * sim_uevents()) and prints it with -v, in udevadm monitor style.
+ */
+#ifndef _SIM_LINUX_KOBJECT_H
+#define _SIM_LINUX_KOBJECT_H
+
+enum kobject_action {
+    KOBJ_ADD,
+    KOBJ_REMOVE,
+    KOBJ_CHANGE,
+};
+
+struct kobject {
+    const char *name;
+};
+
+int kobject_uevent_env(struct kobject *kobj, enum kobject_action action, char *envp[]);
+
+#endif /* _SIM_LINUX_KOBJECT_H */
@@ -0,0 +1,20 @@
+/*
+ * Userspace shim: kernel threads on top of pthreads
+ *
+ * kthread_stop() wakes a thread sleeping in wait_event*(),
+ * as wake_up_process() does in the kernel, then joins it.
+ */
+#ifndef _SIM_LINUX_KTHREAD_H
+#define _SIM_LINUX_KTHREAD_H
+
+#include <stdbool.h>
+#include <linux/err.h>
+
+struct task_struct;
+
+struct task_struct *kthread_run(int (*threadfn)(void *data), void *data,
+                                const char *namefmt, ...);
+int kthread_stop(struct task_struct *k);
+bool kthread_should_stop(void);
+
+#endif /* _SIM_LINUX_KTHREAD_H */
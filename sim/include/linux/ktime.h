@@ -0,0 +1,39 @@
+/*
+ * Userspace shim: kernel time keeping on CLOCK_MONOTONIC (and CLOCK_REALTIME)
+ */
+#ifndef _SIM_LINUX_KTIME_H
+#define _SIM_LINUX_KTIME_H
+
+#include <time.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+
+typedef s64 ktime_t;
+
+static inline u64 ktime_get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline u64 ktime_get_real_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline ktime_t ktime_get(void)
+{
+    return (ktime_t)ktime_get_ns();
+}
+
+static inline s64 ktime_to_ns(ktime_t kt)
+{
+    return kt;
+}
+
+#endif /* _SIM_LINUX_KTIME_H */
@@ -0,0 +1,65 @@
+/*
+ * Userspace shim: the doubly linked lists of <linux/list.h> the driver uses
+ */
+#ifndef _SIM_LINUX_LIST_H
+#define _SIM_LINUX_LIST_H
+
+#include <stdbool.h>
+#include <linux/kernel.h>
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *entry, struct list_head *head)
+{
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+static inline bool list_empty(const struct list_head *head)
+{
+    return head->next == head;
+}
+
+/* Move every entry of @list to the end of @head and empty @list */
+static inline void list_splice_tail_init(struct list_head *list, struct list_head *head)
+{
+    if (list_empty(list))
+        return;
+    list->next->prev = head->prev;
+    head->prev->next = list->next;
+    list->prev->next = head;
+    head->prev = list->prev;
+    INIT_LIST_HEAD(list);
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(head, type, member) list_entry((head)->next, type, member)
+
+#define list_for_each_entry_safe(pos, n, head, member)                          \
+    for (pos = list_first_entry(head, __typeof__(*pos), member),                \
+         n = list_entry(pos->member.next, __typeof__(*pos), member);            \
+         &pos->member != (head);                                                \
+         pos = n, n = list_entry(n->member.next, __typeof__(*n), member))
+
+#endif /* _SIM_LINUX_LIST_H */
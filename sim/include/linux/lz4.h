@@ -0,0 +1,21 @@
+/*
+ * Userspace shim: LZ4 block compression, as in lib/lz4
+ *
+ * Same block format and calling conventions as the kernel's; implemented
+ * in sim/sim_lz4.c so the simulation needs no liblz4.
+ */
+#ifndef _SIM_LINUX_LZ4_H
+#define _SIM_LINUX_LZ4_H
+
+#define LZ4_MEM_COMPRESS        (1 << 14)
+#define LZ4_COMPRESSBOUND(isize) ((isize) + ((isize) / 255) + 16)
+
+/* Bytes written to @dest, 0 if they do not fit in @maxOutputSize */
+int LZ4_compress_default(const char *source, char *dest, int inputSize,
+                         int maxOutputSize, void *wrkmem);
+
+/* Bytes decompressed, negative if @source is malformed or too big for @dest */
+int LZ4_decompress_safe(const char *source, char *dest, int compressedSize,
+                        int maxDecompressedSize);
+
+#endif /* _SIM_LINUX_LZ4_H */
@@ -0,0 +1,19 @@
+/*
+ * Userspace shim: 64-bit division helpers
+ */
+#ifndef _SIM_LINUX_MATH64_H
+#define _SIM_LINUX_MATH64_H
+
+#include <linux/kernel.h>
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+    return dividend / divisor;
+}
+
+#endif /* _SIM_LINUX_MATH64_H */
@@ -0,0 +1,70 @@
+/*
+ * Userspace shim: user page pinning and mmap
+ *
+ * User memory is ordinary process memory in the simulation, so pinning only
+ * checks the address the way uaccess.h does and hands back no pages.
+ * Mapping driver memory hands out its address directly: sim_mmap() reads
+ * it back from the vma.
+ */
+#ifndef _SIM_LINUX_MM_H
+#define _SIM_LINUX_MM_H
+
+#include <linux/kernel.h>
+#include <linux/gfp.h>
+#include <linux/vmalloc.h>
+
+#define FOLL_WRITE 0x01
+
+#define VM_READ     0x01
+#define VM_WRITE    0x02
+#define VM_MAYWRITE 0x20
+
+#define offset_in_page(p) ((unsigned long)(p) & (PAGE_SIZE - 1))
+
+static inline int pin_user_pages_fast(unsigned long start, int nr_pages,
+                                      unsigned int gup_flags, struct page **pages)
+{
+    int i;
+
+    if (!start)
+        return -EFAULT;
+    for (i = 0; i < nr_pages; i++)
+        pages[i] = NULL;
+    return nr_pages;
+}
+
+static inline void unpin_user_pages(struct page **pages, unsigned long npages)
+{
+}
+
+struct vm_area_struct {
+    unsigned long vm_start;
+    unsigned long vm_end;
+    unsigned long vm_pgoff;
+    unsigned long vm_flags;
+    void *sim_addr;             /* what the mapping shows, set by the remap */
+};
+
+static inline void vm_flags_clear(struct vm_area_struct *vma, unsigned long flags)
+{
+    vma->vm_flags &= ~flags;
+}
+
+static inline unsigned long vma_pages(const struct vm_area_struct *vma)
+{
+    return (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+}
+
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr,
+                                      unsigned long pgoff)
+{
+    unsigned long size = vma->vm_end - vma->vm_start;
+
+    if ((pgoff << PAGE_SHIFT) + size > sim_vmalloc_size(addr))
+        return -EINVAL;
+
+    vma->sim_addr = (char *)addr + (pgoff << PAGE_SHIFT);
+    return 0;
+}
+
+#endif /* _SIM_LINUX_MM_H */
@@ -0,0 +1,28 @@
+/*
+ * Userspace shim: module boilerplate
+ *
+ * module_init()/module_exit() publish the driver's entry points so the
+ * harness can "load" and "unload" it; the metadata macros vanish.
+ */
+#ifndef _SIM_LINUX_MODULE_H
+#define _SIM_LINUX_MODULE_H
+
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+
+struct module;
+
+#define THIS_MODULE ((struct module *)0)
+
+#define module_init(fn) int (*sim_module_init)(void) = fn
+#define module_exit(fn) void (*sim_module_exit)(void) = fn
+
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_VERSION(x)
+
+extern int (*sim_module_init)(void);
+extern void (*sim_module_exit)(void);
+
+#endif /* _SIM_LINUX_MODULE_H */
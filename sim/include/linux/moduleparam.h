@@ -0,0 +1,22 @@
+/*
+ * Userspace shim: module parameters
+ *
+ * Each module_param() registers itself at startup so the harness can set
+ * it by name ("num_devices=4") before calling the init function.
+ */
+#ifndef _SIM_LINUX_MODULEPARAM_H
+#define _SIM_LINUX_MODULEPARAM_H
+
+#include <linux/stringify.h>
+
+void sim_register_param(const char *name, const char *type, void *value);
+
+#define module_param(name, type, perm)                                  \
+    static void __attribute__((constructor)) __sim_param_##name(void)  \
+    {                                                                   \
+        sim_register_param(#name, #type, &name);                        \
+    }
+
+#define MODULE_PARM_DESC(name, desc)
+
+#endif /* _SIM_LINUX_MODULEPARAM_H */
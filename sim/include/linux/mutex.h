@@ -0,0 +1,70 @@
+/*
+ * Userspace shim: mutexes on top of pthreads
+ *
+ * Like lockdep, every mutex_init() site is one lock class, and each thread
+ * keeps the mutexes it holds. Taking a mutex of a class the thread already
+ * holds at the same subclass is reported as recursive locking and aborts
+ * (sim_kernel.c), so nesting two instance locks needs mutex_lock_nested().
+ */
+#ifndef _SIM_LINUX_MUTEX_H
+#define _SIM_LINUX_MUTEX_H
+
+#include <pthread.h>
+
+#define SINGLE_DEPTH_NESTING 1
+
+struct mutex {
+    pthread_mutex_t m;
+    const void *key;            /* lock class: its mutex_init() site, NULL for its own */
+};
+
+#define DEFINE_MUTEX(name) struct mutex name = { PTHREAD_MUTEX_INITIALIZER, NULL }
+
+void sim_lock_acquire(struct mutex *lock, unsigned int subclass, const char *file, int line);
+void sim_lock_release(struct mutex *lock);
+
+static inline void sim_mutex_init(struct mutex *lock, const void *key)
+{
+    pthread_mutex_init(&lock->m, NULL);
+    lock->key = key;
+}
+
+#define mutex_init(lock)                                    \
+    do {                                                    \
+        static const char __key;                            \
+        sim_mutex_init((lock), &__key);                     \
+    } while (0)
+
+static inline void mutex_destroy(struct mutex *lock)
+{
+    pthread_mutex_destroy(&lock->m);
+}
+
+static inline void sim_mutex_lock(struct mutex *lock, unsigned int subclass,
+                                  const char *file, int line)
+{
+    sim_lock_acquire(lock, subclass, file, line);
+    pthread_mutex_lock(&lock->m);
+}
+
+#define mutex_lock(lock)                sim_mutex_lock(lock, 0, __FILE__, __LINE__)
+#define mutex_lock_nested(lock, sub)    sim_mutex_lock(lock, sub, __FILE__, __LINE__)
+
+/* There are no signals to interrupt the wait in the simulation */
+#define mutex_lock_interruptible(lock)  (sim_mutex_lock(lock, 0, __FILE__, __LINE__), 0)
+
+static inline int mutex_trylock(struct mutex *lock)
+{
+    if (pthread_mutex_trylock(&lock->m))
+        return 0;
+    sim_lock_acquire(lock, 0, NULL, 0);
+    return 1;
+}
+
+static inline void mutex_unlock(struct mutex *lock)
+{
+    sim_lock_release(lock);
+    pthread_mutex_unlock(&lock->m);
+}
+
+#endif /* _SIM_LINUX_MUTEX_H */
@@ -0,0 +1,30 @@
+/*
+ * Userspace shim: per-CPU data
+ *
+ * A per-CPU object is an array of SIM_NR_CPUS copies. Each thread is given
+ * a "CPU" round-robin the first time it asks, so several threads share
+ * each copy as several tasks share a CPU in the kernel.
+ */
+#ifndef _SIM_LINUX_PERCPU_H
+#define _SIM_LINUX_PERCPU_H
+
+#include <stdlib.h>
+#include <linux/kernel.h>
+#include <linux/preempt.h>
+
+#define SIM_NR_CPUS 4
+
+#define __percpu
+
+unsigned int sim_this_cpu(void);
+
+#define alloc_percpu(type)      ((type *)calloc(SIM_NR_CPUS, sizeof(type)))
+#define free_percpu(ptr)        free(ptr)
+#define per_cpu_ptr(ptr, cpu)   ((ptr) + (cpu))
+#define this_cpu_ptr(ptr)       per_cpu_ptr(ptr, sim_this_cpu())
+#define get_cpu_ptr(ptr)        ({ preempt_disable(); this_cpu_ptr(ptr); })
+#define put_cpu_ptr(ptr)        do { (void)(ptr); preempt_enable(); } while (0)
+
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < SIM_NR_CPUS; (cpu)++)
+
+#endif /* _SIM_LINUX_PERCPU_H */
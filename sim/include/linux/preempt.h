@@ -0,0 +1,12 @@
+/*
+ * Userspace shim: preemption control, which a process cannot have
+ */
+#ifndef _SIM_LINUX_PREEMPT_H
+#define _SIM_LINUX_PREEMPT_H
+
+#include <linux/kernel.h>
+
+#define preempt_disable()   barrier()
+#define preempt_enable()    barrier()
+
+#endif /* _SIM_LINUX_PREEMPT_H */
@@ -0,0 +1,18 @@
+/*
+ * Userspace shim: voluntary preemption points
+ *
+ * cond_resched() gives up the CPU as the kernel would when another task
+ * is waiting for it.
+ */
+#ifndef _SIM_LINUX_SCHED_H
+#define _SIM_LINUX_SCHED_H
+
+#include <sched.h>
+
+static inline int cond_resched(void)
+{
+    sched_yield();
+    return 0;
+}
+
+#endif /* _SIM_LINUX_SCHED_H */
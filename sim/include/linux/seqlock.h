@@ -0,0 +1,28 @@
+/*
+ * Userspace shim: sequence counters
+ *
+ * A reader racing a writer is exactly what a seqcount allows and what TSan
+ * reports, so here the write side holds a mutex and a read section takes
+ * it too; readers then never need to retry. Callers' retry loops and the
+ * consistency they promise are kept.
+ */
+#ifndef _SIM_LINUX_SEQLOCK_H
+#define _SIM_LINUX_SEQLOCK_H
+
+#include <pthread.h>
+#include <linux/kernel.h>
+
+typedef struct {
+    pthread_mutex_t lock;
+} seqcount_t;
+
+#define seqcount_init(s)            pthread_mutex_init(&(s)->lock, NULL)
+#define write_seqcount_begin(s)     pthread_mutex_lock(&(s)->lock)
+#define write_seqcount_end(s)       pthread_mutex_unlock(&(s)->lock)
+/* Readers may hold a const seqcount_t, as in the kernel */
+#define read_seqcount_begin(s) \
+    ({ pthread_mutex_lock((pthread_mutex_t *)&(s)->lock); 0U; })
+#define read_seqcount_retry(s, start) \
+    ({ (void)(start); pthread_mutex_unlock((pthread_mutex_t *)&(s)->lock); 0; })
+
+#endif /* _SIM_LINUX_SEQLOCK_H */
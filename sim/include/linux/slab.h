@@ -0,0 +1,42 @@
+/*
+ * Userspace shim: kmalloc family on top of libc
+ */
+#ifndef _SIM_LINUX_SLAB_H
+#define _SIM_LINUX_SLAB_H
+
+#include <stdlib.h>
+#include <linux/kernel.h>
+
+typedef unsigned int gfp_t;
+
+#define GFP_KERNEL 0u
+#define GFP_ATOMIC 1u
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+    return malloc(size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+    return calloc(1, size);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags)
+{
+    return calloc(n, size);
+}
+
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t flags)
+{
+    if (size && n > SIZE_MAX / size)
+        return NULL;
+    return malloc(n * size);
+}
+
+static inline void kfree(const void *ptr)
+{
+    free((void *)ptr);
+}
+
+#endif /* _SIM_LINUX_SLAB_H */
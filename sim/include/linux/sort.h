@@ -0,0 +1,20 @@
+/*
+ * Userspace shim: sort() on top of qsort()
+ */
+#ifndef _SIM_LINUX_SORT_H
+#define _SIM_LINUX_SORT_H
+
+#include <stdlib.h>
+#include <linux/kernel.h>
+
+typedef int (*cmp_func_t)(const void *a, const void *b);
+typedef void (*swap_func_t)(void *a, void *b, int size);
+
+/* A swap function only matters for speed in the kernel; qsort has its own */
+static inline void sort(void *base, size_t num, size_t size, cmp_func_t cmp_func,
+                        swap_func_t swap_func)
+{
+    qsort(base, num, size, cmp_func);
+}
+
+#endif /* _SIM_LINUX_SORT_H */
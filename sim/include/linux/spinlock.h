@@ -0,0 +1,30 @@
+/*
+ * Userspace shim: spinlocks on top of pthread mutexes
+ */
+#ifndef _SIM_LINUX_SPINLOCK_H
+#define _SIM_LINUX_SPINLOCK_H
+
+#include <pthread.h>
+
+typedef struct {
+    pthread_mutex_t m;
+} spinlock_t;
+
+#define DEFINE_SPINLOCK(name) spinlock_t name = { PTHREAD_MUTEX_INITIALIZER }
+
+static inline void spin_lock_init(spinlock_t *lock)
+{
+    pthread_mutex_init(&lock->m, NULL);
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+    pthread_mutex_lock(&lock->m);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+    pthread_mutex_unlock(&lock->m);
+}
+
+#endif /* _SIM_LINUX_SPINLOCK_H */
@@ -0,0 +1,30 @@
+/*
+ * Userspace shim: string helpers beyond libc
+ */
+#ifndef _SIM_LINUX_STRING_H
+#define _SIM_LINUX_STRING_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <linux/kernel.h>
+
+/* Copy a NUL-terminated user string of at most @n bytes into a kmalloc'd one */
+static inline char *strndup_user(const char __user *s, long n)
+{
+    size_t len;
+    char *p;
+
+    if (!s)
+        return ERR_PTR(-EFAULT);
+    len = strnlen(s, n);
+    if (len == (size_t)n)
+        return ERR_PTR(-EINVAL);
+
+    p = malloc(len + 1);
+    if (!p)
+        return ERR_PTR(-ENOMEM);
+    memcpy(p, s, len + 1);
+    return p;
+}
+
+#endif /* _SIM_LINUX_STRING_H */
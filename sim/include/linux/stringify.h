@@ -0,0 +1,10 @@
+/*
+ * Userspace shim: __stringify
+ */
+#ifndef _SIM_LINUX_STRINGIFY_H
+#define _SIM_LINUX_STRINGIFY_H
+
+#define __stringify_1(x...) #x
+#define __stringify(x...)   __stringify_1(x)
+
+#endif /* _SIM_LINUX_STRINGIFY_H */
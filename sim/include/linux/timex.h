@@ -0,0 +1,18 @@
+/*
+ * Userspace shim: cycle counter
+ */
+#ifndef _SIM_LINUX_TIMEX_H
+#define _SIM_LINUX_TIMEX_H
+
+typedef unsigned long long cycles_t;
+
+static inline cycles_t get_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+#endif /* _SIM_LINUX_TIMEX_H */
@@ -0,0 +1,45 @@
+/*
+ * Userspace shim: tracepoints
+ *
+ * Each event becomes an inline trace_<name>() that fills the event's entry
+ * struct with TP_fast_assign and hands the TP_printk output to sim_trace(),
+ * which counts it and, when tracing is on, prints it the way trace_pipe
+ * shows it.
+ */
+#ifndef _SIM_LINUX_TRACEPOINT_H
+#define _SIM_LINUX_TRACEPOINT_H
+
+#include <linux/kernel.h>
+
+void sim_trace(const char *event, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define TP_PROTO(args...)          args
+#define TP_ARGS(args...)           args
+#define TP_STRUCT__entry(args...)  args
+#define TP_fast_assign(args...)    args
+#define TP_printk(fmt, args...)    fmt, args
+#define __field(type, item)        type item;
+
+#define DECLARE_EVENT_CLASS(class, proto, args, tstruct, assign, print)     \
+    struct sim_trace_entry_##class { tstruct };                             \
+    static inline void sim_trace_class_##class(const char *event, proto)    \
+    {                                                                       \
+        struct sim_trace_entry_##class __e, *__entry = &__e;                \
+        assign;                                                             \
+        sim_trace(event, print);                                            \
+    }
+
+#define DEFINE_EVENT(class, name, proto, args)                              \
+    static inline void trace_##name(proto)                                  \
+    {                                                                       \
+        sim_trace_class_##class(#name, args);                               \
+    }
+
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print)              \
+    DECLARE_EVENT_CLASS(name, PARAMS(proto), PARAMS(args),                  \
+                        PARAMS(tstruct), PARAMS(assign), PARAMS(print))     \
+    DEFINE_EVENT(name, name, PARAMS(proto), PARAMS(args))
+
+#define PARAMS(args...) args
+
+#endif /* _SIM_LINUX_TRACEPOINT_H */
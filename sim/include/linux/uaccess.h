@@ -0,0 +1,37 @@
+/*
+ * Userspace shim: user copies
+ *
+ * "User" pointers are ordinary pointers in the simulation. A NULL source or
+ * destination stands in for a bad address so -EFAULT paths can be tested.
+ */
+#ifndef _SIM_LINUX_UACCESS_H
+#define _SIM_LINUX_UACCESS_H
+
+#include <linux/kernel.h>
+
+static inline unsigned long __must_check
+copy_to_user(void __user *to, const void *from, unsigned long n)
+{
+    if (!to)
+        return n;
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long __must_check
+copy_from_user(void *to, const void __user *from, unsigned long n)
+{
+    if (!from)
+        return n;
+    memcpy(to, from, n);
+    return 0;
+}
+
+#define put_user(x, ptr) \
+    ({ __typeof__(*(ptr)) _v = (x); copy_to_user((ptr), &_v, sizeof(_v)) ? -EFAULT : 0; })
+
+#define get_user(x, ptr) \
+    ({ __typeof__(*(ptr)) _v; int _r = copy_from_user(&_v, (ptr), sizeof(_v)) ? -EFAULT : 0; \
+       if (!_r) (x) = _v; _r; })
+
+#endif /* _SIM_LINUX_UACCESS_H */
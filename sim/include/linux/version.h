@@ -0,0 +1,13 @@
+/*
+ * Userspace shim: the kernel version the simulation stands in for
+ *
+ * Recent enough for the current APIs (one-argument class_create(),
+ * vm_flags_clear()); the older branches are built against real headers.
+ */
+#ifndef _SIM_LINUX_VERSION_H
+#define _SIM_LINUX_VERSION_H
+
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + ((c) > 255 ? 255 : (c)))
+#define LINUX_VERSION_CODE      KERNEL_VERSION(6, 8, 0)
+
+#endif /* _SIM_LINUX_VERSION_H */
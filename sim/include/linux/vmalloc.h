@@ -0,0 +1,49 @@
+/*
+ * Userspace shim: vmalloc
+ *
+ * vmalloc_user() memory is page aligned and zeroed. A hidden page in
+ * front of each block records its size so remap_vmalloc_range() can check
+ * the requested range the way the kernel does.
+ */
+#ifndef _SIM_LINUX_VMALLOC_H
+#define _SIM_LINUX_VMALLOC_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <linux/gfp.h>
+
+static inline void *vmalloc_user(unsigned long size)
+{
+    unsigned long len = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    char *base = aligned_alloc(PAGE_SIZE, len + PAGE_SIZE);
+
+    if (!base)
+        return NULL;
+    memset(base, 0, len + PAGE_SIZE);
+    *(unsigned long *)base = len;
+    return base + PAGE_SIZE;
+}
+
+/* Zeroed as well: vmalloc_user() with the same bookkeeping */
+static inline void *vmalloc(unsigned long size)
+{
+    return vmalloc_user(size);
+}
+
+static inline void *vzalloc(unsigned long size)
+{
+    return vmalloc_user(size);
+}
+
+static inline unsigned long sim_vmalloc_size(const void *addr)
+{
+    return *(const unsigned long *)((const char *)addr - PAGE_SIZE);
+}
+
+static inline void vfree(const void *addr)
+{
+    if (addr)
+        free((char *)addr - PAGE_SIZE);
+}
+
+#endif /* _SIM_LINUX_VMALLOC_H */
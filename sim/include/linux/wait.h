@@ -0,0 +1,82 @@
+/*
+ * Userspace shim: wait queues on top of pthread condition variables
+ *
+ * Interruptible and uninterruptible sleepers wait on separate condition
+ * variables, so wake_up_interruptible() reaches only the former, as in
+ * the kernel. An uninterruptible sleeper that nobody wakes for
+ * SIM_HUNG_TASK_SECS is reported and aborts, like the hung task detector.
+ */
+#ifndef _SIM_LINUX_WAIT_H
+#define _SIM_LINUX_WAIT_H
+
+#include <pthread.h>
+
+#define SIM_HUNG_TASK_SECS  30
+
+typedef struct wait_queue_head {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            /* TASK_INTERRUPTIBLE sleepers */
+    pthread_cond_t ucond;           /* TASK_UNINTERRUPTIBLE sleepers */
+} wait_queue_head_t;
+
+#define DECLARE_WAIT_QUEUE_HEAD(name)                                   \
+    wait_queue_head_t name = { PTHREAD_MUTEX_INITIALIZER,               \
+                               PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER }
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq)
+{
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+    pthread_cond_init(&wq->ucond, NULL);
+}
+
+static inline void wake_up_interruptible(wait_queue_head_t *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+static inline void wake_up(wait_queue_head_t *wq)
+{
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_cond_broadcast(&wq->ucond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+#define wake_up_all(wq)             wake_up(wq)
+#define wake_up_interruptible_all(wq) wake_up_interruptible(wq)
+
+/* Tell kthread_stop() which queue a kernel thread sleeps on (sim_kernel.c) */
+void sim_wait_begin(wait_queue_head_t *wq);
+void sim_wait_end(void);
+/* One uninterruptible sleep, with wq->lock held; aborts if never woken */
+void sim_wait_uninterruptible(wait_queue_head_t *wq);
+
+/*
+ * The condition is re-checked under the queue lock and wakers broadcast
+ * under the same lock, so a wakeup between check and sleep is not lost.
+ */
+#define wait_event_interruptible(wq, condition)             \
+    ({                                                      \
+        sim_wait_begin(&(wq));                              \
+        pthread_mutex_lock(&(wq).lock);                     \
+        while (!(condition))                                \
+            pthread_cond_wait(&(wq).cond, &(wq).lock);      \
+        pthread_mutex_unlock(&(wq).lock);                   \
+        sim_wait_end();                                     \
+        0;                                                  \
+    })
+
+#define wait_event(wq, condition)                           \
+    do {                                                    \
+        sim_wait_begin(&(wq));                              \
+        pthread_mutex_lock(&(wq).lock);                     \
+        while (!(condition))                                \
+            sim_wait_uninterruptible(&(wq));                \
+        pthread_mutex_unlock(&(wq).lock);                   \
+        sim_wait_end();                                     \
+    } while (0)
+
+#endif /* _SIM_LINUX_WAIT_H */
@@ -0,0 +1,52 @@
+/*
+ * Userspace shim: delayed work on the system workqueue
+ *
+ * Each delayed_work gets its own thread the first time it is scheduled;
+ * the thread sleeps until the work is due and runs it. Jiffies are
+ * milliseconds (HZ=1000).
+ */
+#ifndef _SIM_LINUX_WORKQUEUE_H
+#define _SIM_LINUX_WORKQUEUE_H
+
+#include <pthread.h>
+#include <linux/kernel.h>
+
+#define HZ 1000
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+    work_func_t func;
+};
+
+struct delayed_work {
+    struct work_struct work;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool started;
+    bool pending;
+    bool stop;
+    u64 due_ns;
+};
+
+#define INIT_DELAYED_WORK(dw, fn)                       \
+    do {                                                \
+        memset((dw), 0, sizeof(*(dw)));                 \
+        (dw)->work.func = (fn);                         \
+        pthread_mutex_init(&(dw)->lock, NULL);          \
+        pthread_cond_init(&(dw)->cond, NULL);           \
+    } while (0)
+
+#define to_delayed_work(w) container_of(w, struct delayed_work, work)
+
+static inline unsigned long msecs_to_jiffies(unsigned int ms)
+{
+    return ms;
+}
+
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay);
+bool cancel_delayed_work_sync(struct delayed_work *dwork);
+
+#endif /* _SIM_LINUX_WORKQUEUE_H */
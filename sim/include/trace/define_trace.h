@@ -0,0 +1,5 @@
+/*
+ * Userspace shim: trace event instantiation
+ *
+ * Nothing to generate; linux/tracepoint.h already defines the events inline.
+ */
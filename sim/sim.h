@@ -0,0 +1,77 @@
+/*
+ * Userspace simulation of the chardev driver: harness interface
+ *
+ * chardev.c is compiled unchanged against the shim headers in sim/include.
+ * These calls stand in for the VFS: they load the "module", open a device
+ * instance by minor number and dispatch to its file_operations.
+ */
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct sim_file;
+
+/* Print the driver's pr_info() messages (errors are always shown) */
+extern int sim_verbose;
+
+/* Print the driver's tracepoints to stderr in trace_pipe format */
+extern int sim_tracing;
+
+/* Tracepoint hits so far, whether or not they were printed */
+unsigned long sim_trace_events(void);
+
+/* Set a module parameter ("name=value") before sim_load() */
+int sim_set_param(const char *assignment);
+
+/* Let @after more kernel_write() calls through, then fail one with -@err */
+void sim_fail_kernel_write(int after, int err);
+
+/* Run the driver's module_init / module_exit */
+int sim_load(void);
+void sim_unload(void);
+
+/* Number of device instances registered by the driver */
+unsigned int sim_num_devices(void);
+
+struct sim_file *sim_open(unsigned int minor, int flags);
+int sim_close(struct sim_file *file);
+
+/* read()/write() use and advance the file position, pread()/pwrite() do not */
+ssize_t sim_read(struct sim_file *file, void *buf, size_t count);
+ssize_t sim_write(struct sim_file *file, const void *buf, size_t count);
+ssize_t sim_pread(struct sim_file *file, void *buf, size_t count, loff_t offset);
+ssize_t sim_pwrite(struct sim_file *file, const void *buf, size_t count, loff_t offset);
+loff_t sim_lseek(struct sim_file *file, loff_t offset, int whence);
+long sim_ioctl(struct sim_file *file, unsigned int cmd, unsigned long arg);
+
+/* What /proc/<pid>/fdinfo/<fd> shows for the file's show_fdinfo part */
+ssize_t sim_fdinfo(struct sim_file *file, char *buf, size_t size);
+
+/*
+ * mmap() of @length bytes at @offset; PROT_* in @prot. Returns the driver
+ * memory itself, or NULL with errno set. Nothing to unmap.
+ */
+void *sim_mmap(struct sim_file *file, size_t length, int prot, loff_t offset);
+
+/* Whether the last mapping of @file could be mprotect()ed PROT_WRITE later */
+int sim_mmap_maywrite(struct sim_file *file);
+
+/*
+ * Read a debugfs file into @buf (NUL-terminated) or write @len bytes to
+ * one; @path is relative to the debugfs root. -1 with errno on failure.
+ */
+ssize_t sim_debugfs_read(const char *path, char *buf, size_t size);
+ssize_t sim_debugfs_write(const char *path, const char *buf, size_t len);
+
+/*
+ * uevents sent so far; the latest is copied to @last as
+ * "change@<device> KEY=value ..." when @last is not NULL
+ */
+unsigned long sim_uevents(char *last, size_t size);
+
+/* Run the KUnit suites built into the driver; returns the failure count */
+int sim_kunit_run_all(void);
+
+#endif /* _SIM_H */
@@ -0,0 +1,1117 @@
+/*
+ * Userspace simulation of the chardev driver: kernel runtime
+ *
+ * Implements the out-of-line parts of the shim headers (device numbers,
+ * cdev and device registration, module parameters, printk, tracepoints,
+ * seq_file, debugfs, delayed work, kernel threads, uevents and files
+ * opened with filp_open()) and the VFS-like entry
+ * points declared in sim.h.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include <linux/debugfs.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/device.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/tracepoint.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include "sim.h"
+
+#define SIM_MAJOR       240
+#define SIM_MAX_MINORS  256
+#define SIM_MAX_PARAMS  32
+#define SIM_MAX_DENTRIES 512
+
+/* What a flush to stable storage costs, so concurrent syncs overlap as on a disk */
+#define SIM_FSYNC_US    20
+
+struct sim_param {
+    const char *name;
+    const char *type;
+    void *value;
+};
+
+struct sim_file {
+    struct inode inode;
+    struct file file;
+    unsigned long vm_flags;     /* of the last mapping */
+};
+
+/* A debugfs directory or file; the path is relative to the debugfs root */
+struct dentry {
+    char path[128];
+    const struct file_operations *fops;
+    void *data;
+    bool used;
+};
+
+int sim_verbose;
+int sim_tracing;
+
+static atomic_ulong trace_events;
+
+static struct sim_param params[SIM_MAX_PARAMS];
+static int num_params;
+
+/* Registered character devices and device nodes, indexed by minor */
+static struct cdev *cdevs[SIM_MAX_MINORS];
+static struct device *devices[SIM_MAX_MINORS];
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char last_uevent[512];
+static unsigned long uevent_count;
+static pthread_mutex_t uevent_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct dentry dentries[SIM_MAX_DENTRIES];
+static pthread_mutex_t debugfs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int sim_printk(const char *level, const char *fmt, ...)
+{
+    va_list ap;
+    int ret;
+
+    if (!sim_verbose && strcmp(level, "err") != 0)
+        return 0;
+
+    va_start(ap, fmt);
+    ret = vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+/*
+ * Tracepoints: one trace_pipe style line per event on stderr
+ */
+void sim_trace(const char *event, const char *fmt, ...)
+{
+    char line[256];
+    struct timespec ts;
+    va_list ap;
+
+    atomic_fetch_add(&trace_events, 1);
+    if (!sim_tracing)
+        return;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    fprintf(stderr, "%16s-%-7d [000] ..... %5ld.%06ld: %s: %s\n", "chardev_sim",
+            (int)getpid(), (long)ts.tv_sec, ts.tv_nsec / 1000, event, line);
+}
+
+unsigned long sim_trace_events(void)
+{
+    return atomic_load(&trace_events);
+}
+
+/*
+ * Module parameters
+ */
+void sim_register_param(const char *name, const char *type, void *value)
+{
+    if (num_params == SIM_MAX_PARAMS) {
+        fprintf(stderr, "sim: too many module parameters\n");
+        abort();
+    }
+
+    params[num_params].name = name;
+    params[num_params].type = type;
+    params[num_params].value = value;
+    num_params++;
+}
+
+int sim_set_param(const char *assignment)
+{
+    const char *eq = strchr(assignment, '=');
+    struct sim_param *p = NULL;
+    char *end;
+    int i;
+
+    if (!eq)
+        return -EINVAL;
+
+    for (i = 0; i < num_params; i++) {
+        if (strlen(params[i].name) == (size_t)(eq - assignment) &&
+            strncmp(params[i].name, assignment, eq - assignment) == 0)
+            p = &params[i];
+    }
+    if (!p)
+        return -ENOENT;
+
+    if (strcmp(p->type, "charp") == 0) {
+        *(const char **)p->value = eq + 1;
+        return 0;
+    }
+
+    errno = 0;
+    /* 0644 parameters may be changed while the module runs */
+    if (strcmp(p->type, "uint") == 0)
+        __atomic_store_n((unsigned int *)p->value, strtoul(eq + 1, &end, 0), __ATOMIC_RELAXED);
+    else if (strcmp(p->type, "int") == 0)
+        *(int *)p->value = strtol(eq + 1, &end, 0);
+    else if (strcmp(p->type, "ulong") == 0)
+        *(unsigned long *)p->value = strtoul(eq + 1, &end, 0);
+    else if (strcmp(p->type, "bool") == 0)
+        *(bool *)p->value = strtoul(eq + 1, &end, 0) != 0;
+    else
+        return -EINVAL;
+
+    return (errno || end == eq + 1 || *end) ? -EINVAL : 0;
+}
+
+/*
+ * Device numbers, classes and nodes
+ */
+int alloc_chrdev_region(dev_t *dev, unsigned int baseminor, unsigned int count,
+                        const char *name)
+{
+    if (baseminor + count > SIM_MAX_MINORS)
+        return -EBUSY;
+
+    *dev = MKDEV(SIM_MAJOR, baseminor);
+    return 0;
+}
+
+void unregister_chrdev_region(dev_t from, unsigned int count)
+{
+}
+
+void cdev_init(struct cdev *cdev, const struct file_operations *fops)
+{
+    memset(cdev, 0, sizeof(*cdev));
+    cdev->ops = fops;
+}
+
+int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count)
+{
+    unsigned int i;
+
+    if (MINOR(dev) + count > SIM_MAX_MINORS)
+        return -EINVAL;
+
+    pthread_mutex_lock(&table_lock);
+    for (i = 0; i < count; i++)
+        cdevs[MINOR(dev) + i] = cdev;
+    pthread_mutex_unlock(&table_lock);
+
+    cdev->dev = dev;
+    cdev->count = count;
+    return 0;
+}
+
+void cdev_del(struct cdev *cdev)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&table_lock);
+    for (i = 0; i < cdev->count; i++)
+        cdevs[MINOR(cdev->dev) + i] = NULL;
+    pthread_mutex_unlock(&table_lock);
+}
+
+struct class *class_create(const char *name)
+{
+    struct class *cls = calloc(1, sizeof(*cls));
+
+    if (!cls)
+        return ERR_PTR(-ENOMEM);
+
+    cls->name = name;
+    return cls;
+}
+
+void class_destroy(struct class *cls)
+{
+    free(cls);
+}
+
+struct device *device_create(struct class *cls, struct device *parent, dev_t devt,
+                             void *drvdata, const char *fmt, ...)
+{
+    struct device *dev;
+    va_list ap;
+
+    if (MINOR(devt) >= SIM_MAX_MINORS)
+        return ERR_PTR(-EINVAL);
+
+    dev = calloc(1, sizeof(*dev));
+    if (!dev)
+        return ERR_PTR(-ENOMEM);
+
+    dev->devt = devt;
+    dev->driver_data = drvdata;
+    va_start(ap, fmt);
+    vsnprintf(dev->name, sizeof(dev->name), fmt, ap);
+    va_end(ap);
+    dev->kobj.name = dev->name;
+
+    pthread_mutex_lock(&table_lock);
+    devices[MINOR(devt)] = dev;
+    pthread_mutex_unlock(&table_lock);
+
+    if (sim_verbose)
+        fprintf(stderr, "sim: created /dev/%s (minor %u)\n", dev->name, MINOR(devt));
+    return dev;
+}
+
+void device_destroy(struct class *cls, dev_t devt)
+{
+    struct device *dev;
+
+    pthread_mutex_lock(&table_lock);
+    dev = devices[MINOR(devt)];
+    devices[MINOR(devt)] = NULL;
+    pthread_mutex_unlock(&table_lock);
+
+    free(dev);
+}
+
+/*
+ * uevents
+ */
+int kobject_uevent_env(struct kobject *kobj, enum kobject_action action, char *envp[])
+{
+    static const char * const actions[] = { "add", "remove", "change" };
+    char event[sizeof(last_uevent)];
+    size_t len;
+    int i;
+
+    len = snprintf(event, sizeof(event), "%s@%s", actions[action], kobj->name);
+    for (i = 0; envp && envp[i] && len < sizeof(event); i++)
+        len += snprintf(event + len, sizeof(event) - len, " %s", envp[i]);
+
+    pthread_mutex_lock(&uevent_lock);
+    memcpy(last_uevent, event, sizeof(event));
+    uevent_count++;
+    pthread_mutex_unlock(&uevent_lock);
+
+    if (sim_verbose)
+        fprintf(stderr, "sim: uevent %s\n", event);
+    return 0;
+}
+
+unsigned long sim_uevents(char *last, size_t size)
+{
+    unsigned long count;
+
+    pthread_mutex_lock(&uevent_lock);
+    count = uevent_count;
+    if (last && size) {
+        strncpy(last, last_uevent, size - 1);
+        last[size - 1] = '\0';
+    }
+    pthread_mutex_unlock(&uevent_lock);
+    return count;
+}
+
+/*
+ * Delayed work: one thread per work item, sleeping until it is due
+ */
+static void *delayed_work_thread(void *arg)
+{
+    struct delayed_work *dw = arg;
+    struct timespec ts;
+    u64 now;
+
+    pthread_mutex_lock(&dw->lock);
+    while (!dw->stop) {
+        now = ktime_get_ns();
+        if (!dw->pending) {
+            pthread_cond_wait(&dw->cond, &dw->lock);
+        } else if (now < dw->due_ns) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += (dw->due_ns - now) / 1000000000ULL;
+            ts.tv_nsec += (dw->due_ns - now) % 1000000000ULL;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&dw->cond, &dw->lock, &ts);
+        } else {
+            dw->pending = false;
+            pthread_mutex_unlock(&dw->lock);
+            dw->work.func(&dw->work);
+            pthread_mutex_lock(&dw->lock);
+        }
+    }
+    pthread_mutex_unlock(&dw->lock);
+    return NULL;
+}
+
+bool schedule_delayed_work(struct delayed_work *dw, unsigned long delay)
+{
+    bool queued = false;
+
+    pthread_mutex_lock(&dw->lock);
+    if (!dw->pending && !dw->stop) {
+        dw->pending = true;
+        dw->due_ns = ktime_get_ns() + (u64)delay * (1000000000ULL / HZ);
+        queued = true;
+        if (!dw->started && pthread_create(&dw->thread, NULL, delayed_work_thread, dw) == 0)
+            dw->started = true;
+        pthread_cond_signal(&dw->cond);
+    }
+    pthread_mutex_unlock(&dw->lock);
+    return queued;
+}
+
+/* Waits for a running callback; work it reschedules is dropped */
+bool cancel_delayed_work_sync(struct delayed_work *dw)
+{
+    bool pending;
+
+    pthread_mutex_lock(&dw->lock);
+    pending = dw->pending;
+    dw->stop = true;
+    pthread_cond_signal(&dw->cond);
+    pthread_mutex_unlock(&dw->lock);
+
+    if (dw->started)
+        pthread_join(dw->thread, NULL);
+
+    pthread_mutex_lock(&dw->lock);
+    dw->started = false;
+    dw->pending = false;
+    dw->stop = false;
+    pthread_mutex_unlock(&dw->lock);
+    return pending;
+}
+
+/*
+ * Lock validation: the mutexes each thread holds, with the subclass they
+ * were taken at. Trylocks are recorded but not checked, as they cannot
+ * wait.
+ */
+#define SIM_MAX_HELD_LOCKS 16
+
+struct sim_held_lock {
+    struct mutex *lock;
+    unsigned int subclass;
+    const char *file;
+    int line;
+};
+
+static __thread struct sim_held_lock held_locks[SIM_MAX_HELD_LOCKS];
+static __thread int nr_held_locks;
+
+static const void *lock_class(const struct mutex *lock)
+{
+    return lock->key ? lock->key : lock;
+}
+
+void sim_lock_acquire(struct mutex *lock, unsigned int subclass, const char *file, int line)
+{
+    struct sim_held_lock *h;
+    int i;
+
+    for (i = 0; file && i < nr_held_locks; i++) {
+        h = &held_locks[i];
+        if (lock_class(h->lock) != lock_class(lock) || h->subclass != subclass)
+            continue;
+        fprintf(stderr, "sim: possible recursive locking detected\n"
+                "  trying to acquire a lock at %s:%d (subclass %u)\n"
+                "  already holding one of its class from %s:%d\n",
+                file, line, subclass, h->file ? h->file : "trylock", h->line);
+        abort();
+    }
+    if (nr_held_locks == SIM_MAX_HELD_LOCKS) {
+        fprintf(stderr, "sim: more than %d locks held\n", SIM_MAX_HELD_LOCKS);
+        abort();
+    }
+
+    h = &held_locks[nr_held_locks++];
+    h->lock = lock;
+    h->subclass = subclass;
+    h->file = file;
+    h->line = line;
+}
+
+void sim_lock_release(struct mutex *lock)
+{
+    int i;
+
+    for (i = nr_held_locks - 1; i >= 0; i--) {
+        if (held_locks[i].lock != lock)
+            continue;
+        memmove(&held_locks[i], &held_locks[i + 1],
+                (nr_held_locks - i - 1) * sizeof(held_locks[0]));
+        nr_held_locks--;
+        return;
+    }
+    fprintf(stderr, "sim: releasing a lock this thread does not hold\n");
+    abort();
+}
+
+/*
+ * Kernel threads: a pthread each. The thread notes the wait queue it
+ * sleeps on, so kthread_stop() can wake it there.
+ */
+struct task_struct {
+    pthread_t thread;
+    int (*threadfn)(void *data);
+    void *data;
+    int ret;
+    atomic_bool stop;
+    _Atomic(wait_queue_head_t *) sleeping_on;
+};
+
+static __thread struct task_struct *sim_current;
+
+static void *kthread_main(void *arg)
+{
+    struct task_struct *k = arg;
+
+    sim_current = k;
+    k->ret = k->threadfn(k->data);
+    return NULL;
+}
+
+struct task_struct *kthread_run(int (*threadfn)(void *data), void *data,
+                                const char *namefmt, ...)
+{
+    struct task_struct *k = calloc(1, sizeof(*k));
+
+    if (!k)
+        return ERR_PTR(-ENOMEM);
+    k->threadfn = threadfn;
+    k->data = data;
+    if (pthread_create(&k->thread, NULL, kthread_main, k)) {
+        free(k);
+        return ERR_PTR(-EAGAIN);
+    }
+    return k;
+}
+
+bool kthread_should_stop(void)
+{
+    return sim_current && atomic_load(&sim_current->stop);
+}
+
+/*
+ * Either the thread sees the stop flag when it checks its condition, or
+ * we see the queue it is about to sleep on and wake it under its lock.
+ */
+int kthread_stop(struct task_struct *k)
+{
+    wait_queue_head_t *wq;
+    int ret;
+
+    atomic_store(&k->stop, true);
+    wq = atomic_load(&k->sleeping_on);
+    if (wq)
+        wake_up_all(wq);
+
+    pthread_join(k->thread, NULL);
+    ret = k->ret;
+    free(k);
+    return ret;
+}
+
+void sim_wait_begin(wait_queue_head_t *wq)
+{
+    if (sim_current)
+        atomic_store(&sim_current->sleeping_on, wq);
+}
+
+void sim_wait_end(void)
+{
+    if (sim_current)
+        atomic_store(&sim_current->sleeping_on, NULL);
+}
+
+void sim_wait_uninterruptible(wait_queue_head_t *wq)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += SIM_HUNG_TASK_SECS;
+    if (pthread_cond_timedwait(&wq->ucond, &wq->lock, &ts) == ETIMEDOUT) {
+        fprintf(stderr, "sim: task blocked in wait_event() for more than %d seconds\n",
+                SIM_HUNG_TASK_SECS);
+        abort();
+    }
+}
+
+/*
+ * seq_file: the whole show output is produced on the first read
+ */
+int seq_printf(struct seq_file *m, const char *fmt, ...)
+{
+    va_list ap;
+    size_t need;
+    char *buf;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return len;
+
+    need = m->count + len + 1;
+    if (need > m->size) {
+        buf = realloc(m->buf, need * 2);
+        if (!buf)
+            return -ENOMEM;
+        m->buf = buf;
+        m->size = need * 2;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(m->buf + m->count, len + 1, fmt, ap);
+    va_end(ap);
+    m->count += len;
+    return 0;
+}
+
+void seq_puts(struct seq_file *m, const char *s)
+{
+    seq_printf(m, "%s", s);
+}
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *), void *data)
+{
+    struct seq_file *m = calloc(1, sizeof(*m));
+
+    if (!m)
+        return -ENOMEM;
+
+    m->show = show;
+    m->private = data;
+    file->private_data = m;
+    return 0;
+}
+
+int single_release(struct inode *inode, struct file *file)
+{
+    struct seq_file *m = file->private_data;
+
+    free(m->buf);
+    free(m);
+    return 0;
+}
+
+ssize_t seq_read(struct file *file, char __user *buf, size_t size, loff_t *ppos)
+{
+    struct seq_file *m = file->private_data;
+    int ret;
+
+    if (!m->filled) {
+        ret = m->show(m, NULL);
+        if (ret < 0)
+            return ret;
+        m->filled = true;
+    }
+
+    if (*ppos >= m->count)
+        return 0;
+
+    size = min(size, m->count - (size_t)*ppos);
+    memcpy(buf, m->buf + *ppos, size);
+    *ppos += size;
+    return size;
+}
+
+loff_t seq_lseek(struct file *file, loff_t offset, int whence)
+{
+    if (whence != SEEK_SET || offset < 0)
+        return -EINVAL;
+
+    file->f_pos = offset;
+    return offset;
+}
+
+/*
+ * Per-CPU data: threads are handed CPUs round-robin
+ */
+unsigned int sim_this_cpu(void)
+{
+    static atomic_uint next_cpu;
+    static __thread int cpu = -1;
+
+    if (cpu < 0)
+        cpu = atomic_fetch_add(&next_cpu, 1) % SIM_NR_CPUS;
+    return cpu;
+}
+
+/*
+ * Plain buffers behind a file
+ */
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos,
+                                const void *from, size_t available)
+{
+    loff_t pos = *ppos;
+
+    if (pos < 0)
+        return -EINVAL;
+    if ((size_t)pos >= available || !count)
+        return 0;
+    if (count > available - pos)
+        count = available - pos;
+    if (copy_to_user(to, (const char *)from + pos, count))
+        return -EFAULT;
+    *ppos = pos + count;
+    return count;
+}
+
+loff_t default_llseek(struct file *file, loff_t offset, int whence)
+{
+    if (whence != SEEK_SET || offset < 0)
+        return -EINVAL;
+
+    file->f_pos = offset;
+    return offset;
+}
+
+/*
+ * Files the driver opens itself, backed by host files
+ */
+struct file *filp_open(const char *filename, int flags, umode_t mode)
+{
+    struct file *file = calloc(1, sizeof(*file));
+    int fd;
+
+    if (!file)
+        return ERR_PTR(-ENOMEM);
+
+    fd = open(filename, flags | O_CLOEXEC, mode);
+    if (fd < 0) {
+        free(file);
+        return ERR_PTR(-errno);
+    }
+
+    file->f_path.sim_fd = fd;
+    file->f_flags = flags;
+    return file;
+}
+
+int filp_close(struct file *filp, fl_owner_t id)
+{
+    int ret = close(filp->f_path.sim_fd) ? -errno : 0;
+
+    free(filp);
+    return ret;
+}
+
+ssize_t kernel_read(struct file *file, void *buf, size_t count, loff_t *pos)
+{
+    ssize_t n = pread(file->f_path.sim_fd, buf, count, *pos);
+
+    if (n < 0)
+        return -errno;
+    *pos += n;
+    return n;
+}
+
+static atomic_int kernel_write_fail_after = -1;
+static atomic_int kernel_write_fail_err;
+
+void sim_fail_kernel_write(int after, int err)
+{
+    atomic_store(&kernel_write_fail_err, err);
+    atomic_store(&kernel_write_fail_after, after);
+}
+
+ssize_t kernel_write(struct file *file, const void *buf, size_t count, loff_t *pos)
+{
+    int after = atomic_load(&kernel_write_fail_after);
+    ssize_t n;
+
+    /* Count down to the injected failure, which happens once */
+    while (after >= 0 &&
+           !atomic_compare_exchange_weak(&kernel_write_fail_after, &after, after - 1))
+        ;
+    if (after == 0)
+        return -atomic_load(&kernel_write_fail_err);
+
+    n = pwrite(file->f_path.sim_fd, buf, count, *pos);
+
+    if (n < 0)
+        return -errno;
+    *pos += n;
+    return n;
+}
+
+int vfs_fsync(struct file *file, int datasync)
+{
+    int ret = datasync ? fdatasync(file->f_path.sim_fd) : fsync(file->f_path.sim_fd);
+
+    if (ret)
+        return -errno;
+    usleep(SIM_FSYNC_US);
+    return 0;
+}
+
+int vfs_truncate(const struct path *path, loff_t length)
+{
+    return ftruncate(path->sim_fd, length) ? -errno : 0;
+}
+
+/*
+ * debugfs
+ */
+static struct dentry *debugfs_add(const char *name, struct dentry *parent,
+                                  const struct file_operations *fops, void *data)
+{
+    struct dentry *d = NULL;
+    char path[sizeof(d->path)];
+    int i, len;
+
+    /* As in the kernel, a failed parent quietly fails its children */
+    if (IS_ERR(parent))
+        return parent;
+
+    if (parent)
+        len = snprintf(path, sizeof(path), "%s/%s", parent->path, name);
+    else
+        len = snprintf(path, sizeof(path), "%s", name);
+    if (len >= (int)sizeof(path))
+        return ERR_PTR(-ENAMETOOLONG);
+
+    pthread_mutex_lock(&debugfs_lock);
+    for (i = 0; i < SIM_MAX_DENTRIES && !d; i++) {
+        if (!dentries[i].used)
+            d = &dentries[i];
+    }
+    if (d) {
+        memcpy(d->path, path, sizeof(path));
+        d->fops = fops;
+        d->data = data;
+        d->used = true;
+    }
+    pthread_mutex_unlock(&debugfs_lock);
+
+    return d ? d : ERR_PTR(-ENOMEM);
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+    return debugfs_add(name, parent, NULL, NULL);
+}
+
+struct dentry *debugfs_create_file(const char *name, umode_t mode, struct dentry *parent,
+                                   void *data, const struct file_operations *fops)
+{
+    return debugfs_add(name, parent, fops, data);
+}
+
+void debugfs_remove_recursive(struct dentry *dentry)
+{
+    char prefix[sizeof(dentry->path) + 1];
+    size_t len;
+    int i;
+
+    if (IS_ERR_OR_NULL(dentry))
+        return;
+
+    snprintf(prefix, sizeof(prefix), "%s/", dentry->path);
+    len = strlen(prefix);
+
+    pthread_mutex_lock(&debugfs_lock);
+    for (i = 0; i < SIM_MAX_DENTRIES; i++) {
+        if (dentries[i].used && &dentries[i] != dentry &&
+            strncmp(dentries[i].path, prefix, len) == 0)
+            dentries[i].used = false;
+    }
+    dentry->used = false;
+    pthread_mutex_unlock(&debugfs_lock);
+}
+
+/*
+ * Module load/unload
+ */
+int sim_load(void)
+{
+    return sim_module_init();
+}
+
+void sim_unload(void)
+{
+    sim_module_exit();
+}
+
+unsigned int sim_num_devices(void)
+{
+    unsigned int i, count = 0;
+
+    pthread_mutex_lock(&table_lock);
+    for (i = 0; i < SIM_MAX_MINORS; i++) {
+        if (cdevs[i] && devices[i])
+            count++;
+    }
+    pthread_mutex_unlock(&table_lock);
+
+    return count;
+}
+
+/*
+ * VFS stand-ins: like the system calls they return -1 and set errno
+ */
+static long sim_ret(long ret)
+{
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+    return ret;
+}
+
+struct sim_file *sim_open(unsigned int minor, int flags)
+{
+    struct sim_file *f;
+    struct cdev *cdev;
+    int ret;
+
+    pthread_mutex_lock(&table_lock);
+    cdev = minor < SIM_MAX_MINORS ? cdevs[minor] : NULL;
+    pthread_mutex_unlock(&table_lock);
+
+    if (!cdev) {
+        errno = ENXIO;
+        return NULL;
+    }
+
+    f = calloc(1, sizeof(*f));
+    if (!f) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    f->inode.i_rdev = MKDEV(SIM_MAJOR, minor);
+    f->inode.i_cdev = cdev;
+    f->file.f_inode = &f->inode;
+    f->file.f_op = cdev->ops;
+    f->file.f_flags = flags;
+    if ((flags & O_ACCMODE) != O_WRONLY)
+        f->file.f_mode |= FMODE_READ;
+    if ((flags & O_ACCMODE) != O_RDONLY)
+        f->file.f_mode |= FMODE_WRITE;
+
+    if (f->file.f_op->open) {
+        ret = f->file.f_op->open(&f->inode, &f->file);
+        if (ret < 0) {
+            free(f);
+            errno = -ret;
+            return NULL;
+        }
+    }
+
+    return f;
+}
+
+int sim_close(struct sim_file *f)
+{
+    int ret = 0;
+
+    if (f->file.f_op->release)
+        ret = f->file.f_op->release(&f->inode, &f->file);
+
+    free(f);
+    return sim_ret(ret);
+}
+
+ssize_t sim_pread(struct sim_file *f, void *buf, size_t count, loff_t offset)
+{
+    if (!(f->file.f_mode & FMODE_READ) || !f->file.f_op->read)
+        return sim_ret(-EBADF);
+
+    return sim_ret(f->file.f_op->read(&f->file, buf, count, &offset));
+}
+
+ssize_t sim_pwrite(struct sim_file *f, const void *buf, size_t count, loff_t offset)
+{
+    if (!(f->file.f_mode & FMODE_WRITE) || !f->file.f_op->write)
+        return sim_ret(-EBADF);
+
+    return sim_ret(f->file.f_op->write(&f->file, buf, count, &offset));
+}
+
+ssize_t sim_read(struct sim_file *f, void *buf, size_t count)
+{
+    if (!(f->file.f_mode & FMODE_READ) || !f->file.f_op->read)
+        return sim_ret(-EBADF);
+
+    return sim_ret(f->file.f_op->read(&f->file, buf, count, &f->file.f_pos));
+}
+
+ssize_t sim_write(struct sim_file *f, const void *buf, size_t count)
+{
+    if (!(f->file.f_mode & FMODE_WRITE) || !f->file.f_op->write)
+        return sim_ret(-EBADF);
+
+    return sim_ret(f->file.f_op->write(&f->file, buf, count, &f->file.f_pos));
+}
+
+/* Without an llseek method the file is not seekable, as in the kernel */
+loff_t sim_lseek(struct sim_file *f, loff_t offset, int whence)
+{
+    if (!f->file.f_op->llseek)
+        return sim_ret(-ESPIPE);
+
+    return sim_ret(f->file.f_op->llseek(&f->file, offset, whence));
+}
+
+long sim_ioctl(struct sim_file *f, unsigned int cmd, unsigned long arg)
+{
+    if (!f->file.f_op->unlocked_ioctl)
+        return sim_ret(-ENOTTY);
+
+    return sim_ret(f->file.f_op->unlocked_ioctl(&f->file, cmd, arg));
+}
+
+ssize_t sim_fdinfo(struct sim_file *f, char *buf, size_t size)
+{
+    struct seq_file m = { 0 };
+    size_t len;
+
+    if (size == 0)
+        return sim_ret(-EINVAL);
+
+    buf[0] = '\0';
+    if (!f->file.f_op->show_fdinfo)
+        return 0;
+
+    f->file.f_op->show_fdinfo(&m, &f->file);
+    len = min(m.count, size - 1);
+    if (len)
+        memcpy(buf, m.buf, len);
+    buf[len] = '\0';
+    free(m.buf);
+    return len;
+}
+
+void *sim_mmap(struct sim_file *f, size_t length, int prot, loff_t offset)
+{
+    struct vm_area_struct vma = {
+        .vm_start = 0,
+        .vm_end = (length + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1),
+        .vm_pgoff = offset >> PAGE_SHIFT,
+    };
+    int ret;
+
+    if (!f->file.f_op->mmap) {
+        errno = ENODEV;
+        return NULL;
+    }
+    if (length == 0 || offset_in_page(offset)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (prot & PROT_READ)
+        vma.vm_flags |= VM_READ;
+    if (prot & PROT_WRITE)
+        vma.vm_flags |= VM_WRITE;
+    /* A shared mapping of a file open for writing may become writable */
+    if (f->file.f_mode & FMODE_WRITE)
+        vma.vm_flags |= VM_MAYWRITE;
+
+    ret = f->file.f_op->mmap(&f->file, &vma);
+    if (ret < 0) {
+        errno = -ret;
+        return NULL;
+    }
+    f->vm_flags = vma.vm_flags;
+    return vma.sim_addr;
+}
+
+int sim_mmap_maywrite(struct sim_file *f)
+{
+    return !!(f->vm_flags & VM_MAYWRITE);
+}
+
+/*
+ * debugfs files, opened as the VFS would with the dentry's data in i_private
+ */
+static int debugfs_open(const char *path, struct sim_file *f)
+{
+    struct dentry *d = NULL;
+    int i;
+
+    pthread_mutex_lock(&debugfs_lock);
+    for (i = 0; i < SIM_MAX_DENTRIES && !d; i++) {
+        if (dentries[i].used && dentries[i].fops && strcmp(dentries[i].path, path) == 0)
+            d = &dentries[i];
+    }
+    pthread_mutex_unlock(&debugfs_lock);
+
+    if (!d)
+        return -ENOENT;
+
+    memset(f, 0, sizeof(*f));
+    f->inode.i_private = d->data;
+    f->file.f_inode = &f->inode;
+    f->file.f_op = d->fops;
+    f->file.private_data = d->data;
+    return d->fops->open ? d->fops->open(&f->inode, &f->file) : 0;
+}
+
+static void debugfs_release(struct sim_file *f)
+{
+    if (f->file.f_op->release)
+        f->file.f_op->release(&f->inode, &f->file);
+}
+
+ssize_t sim_debugfs_read(const char *path, char *buf, size_t size)
+{
+    struct sim_file f;
+    ssize_t ret;
+    size_t done = 0;
+    int err;
+
+    if (size == 0)
+        return sim_ret(-EINVAL);
+
+    err = debugfs_open(path, &f);
+    if (err < 0)
+        return sim_ret(err);
+
+    if (!f.file.f_op->read) {
+        debugfs_release(&f);
+        return sim_ret(-EINVAL);
+    }
+
+    while (done < size - 1) {
+        ret = f.file.f_op->read(&f.file, buf + done, size - 1 - done, &f.file.f_pos);
+        if (ret <= 0)
+            break;
+        done += ret;
+    }
+    buf[done] = '\0';
+
+    debugfs_release(&f);
+    return done;
+}
+
+ssize_t sim_debugfs_write(const char *path, const char *buf, size_t len)
+{
+    struct sim_file f;
+    ssize_t ret;
+    int err;
+
+    err = debugfs_open(path, &f);
+    if (err < 0)
+        return sim_ret(err);
+
+    ret = f.file.f_op->write ? f.file.f_op->write(&f.file, buf, len, &f.file.f_pos) : -EINVAL;
+    debugfs_release(&f);
+    return sim_ret(ret);
+}
@@ -0,0 +1,93 @@
+/*
+ * Userspace simulation of the chardev driver: KUnit runner
+ *
+ * Runs the suites from chardev_kunit.c against the shim in
+ * sim/include/kunit/test.h and prints KTAP-style results.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <kunit/test.h>
+#include "sim.h"
+
+#define SIM_MAX_SUITES 16
+
+static struct kunit_suite *suites[SIM_MAX_SUITES];
+static int num_suites;
+
+void sim_kunit_register(struct kunit_suite *suite)
+{
+    if (num_suites == SIM_MAX_SUITES) {
+        fprintf(stderr, "sim: too many KUnit suites\n");
+        abort();
+    }
+
+    suites[num_suites++] = suite;
+}
+
+void *kunit_kzalloc(struct kunit *test, size_t size, gfp_t gfp)
+{
+    void *ptr;
+
+    if (test->num_allocs == KUNIT_MAX_ALLOCS)
+        return NULL;
+
+    ptr = kzalloc(size, gfp);
+    if (ptr)
+        test->allocs[test->num_allocs++] = ptr;
+    return ptr;
+}
+
+void sim_kunit_fail(struct kunit *test, const char *file, int line, const char *expr)
+{
+    printf("    # %s: EXPECTATION FAILED at %s:%d\n    Expected %s\n",
+           test->name, file, line, expr);
+    test->failed = 1;
+}
+
+static int run_case(struct kunit_suite *suite, struct kunit_case *tc, int index)
+{
+    struct kunit test;
+    int i, ret = 0;
+
+    memset(&test, 0, sizeof(test));
+    test.name = tc->name;
+
+    if (suite->init)
+        ret = suite->init(&test);
+    if (ret) {
+        printf("    # %s: initialization failed: %d\n", tc->name, ret);
+        test.failed = 1;
+    } else {
+        tc->run_case(&test);
+        if (suite->exit)
+            suite->exit(&test);
+    }
+
+    for (i = 0; i < test.num_allocs; i++)
+        kfree(test.allocs[i]);
+
+    printf("    %s %d %s\n", test.failed ? "not ok" : "ok", index, tc->name);
+    return test.failed;
+}
+
+int sim_kunit_run_all(void)
+{
+    struct kunit_case *tc;
+    int s, n, failed, total_failed = 0;
+
+    printf("KTAP version 1\n1..%d\n", num_suites);
+    for (s = 0; s < num_suites; s++) {
+        for (n = 0; suites[s]->test_cases[n].run_case; n++)
+            ;
+        printf("    KTAP version 1\n    # Subtest: %s\n    1..%d\n", suites[s]->name, n);
+
+        failed = 0;
+        for (tc = suites[s]->test_cases, n = 1; tc->run_case; tc++, n++)
+            failed += run_case(suites[s], tc, n);
+
+        printf("%s %d %s\n", failed ? "not ok" : "ok", s + 1, suites[s]->name);
+        total_failed += failed;
+    }
+
+    return total_failed;
+}
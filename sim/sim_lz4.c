@@ -0,0 +1,163 @@
+/*
+ * Userspace simulation of the chardev driver: LZ4 block format
+ *
+ * A greedy single-hash compressor and a bounds-checked decompressor. They
+ * trade ratio and speed for brevity but read and write the same blocks as
+ * lib/lz4 and liblz4, so snapshots move between the simulation and the
+ * kernel.
+ */
+#include <linux/kernel.h>
+#include <linux/lz4.h>
+
+#define LZ4_HASH_LOG    12
+#define LZ4_MIN_MATCH   4
+#define LZ4_MFLIMIT     12      /* the last match starts this far from the end, */
+#define LZ4_LASTLITERALS 5      /* and ends at least this far */
+#define LZ4_MAX_OFFSET  65535
+
+static u32 lz4_hash(const u8 *p)
+{
+    u32 v;
+
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static u8 *lz4_put_len(u8 *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+/* One sequence: literals, then a match unless @mlen is 0 (the last one) */
+static u8 *lz4_sequence(u8 *op, const u8 *oend, const u8 *lit, size_t litlen,
+                        size_t offset, size_t mlen)
+{
+    u8 *token;
+
+    if ((size_t)(oend - op) < 1 + litlen / 255 + 1 + litlen + 2 + mlen / 255 + 1)
+        return NULL;
+
+    token = op++;
+    *token = (litlen >= 15 ? 15 : litlen) << 4;
+    if (litlen >= 15)
+        op = lz4_put_len(op, litlen - 15);
+    memcpy(op, lit, litlen);
+    op += litlen;
+
+    if (mlen) {
+        *op++ = offset;
+        *op++ = offset >> 8;
+        mlen -= LZ4_MIN_MATCH;
+        *token |= mlen >= 15 ? 15 : mlen;
+        if (mlen >= 15)
+            op = lz4_put_len(op, mlen - 15);
+    }
+    return op;
+}
+
+int LZ4_compress_default(const char *source, char *dest, int inputSize,
+                         int maxOutputSize, void *wrkmem)
+{
+    const u8 *src = (const u8 *)source, *ip = src, *anchor = src, *ref;
+    const u8 *iend = src + inputSize;
+    u8 *op = (u8 *)dest, *oend = op + maxOutputSize;
+    u32 *table = wrkmem;
+    size_t mlen;
+    u32 h;
+
+    if (inputSize < 0 || maxOutputSize < 0)
+        return 0;
+
+    memset(table, 0, sizeof(*table) << LZ4_HASH_LOG);
+    while (inputSize > LZ4_MFLIMIT && ip <= iend - LZ4_MFLIMIT) {
+        h = lz4_hash(ip);
+        ref = src + table[h];
+        table[h] = ip - src;
+        if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || memcmp(ref, ip, LZ4_MIN_MATCH)) {
+            ip++;
+            continue;
+        }
+
+        mlen = LZ4_MIN_MATCH;
+        while (ip + mlen < iend - LZ4_LASTLITERALS && ref[mlen] == ip[mlen])
+            mlen++;
+
+        op = lz4_sequence(op, oend, anchor, ip - anchor, ip - ref, mlen);
+        if (!op)
+            return 0;
+        ip += mlen;
+        anchor = ip;
+    }
+
+    op = lz4_sequence(op, oend, anchor, iend - anchor, 0, 0);
+    return op ? op - (u8 *)dest : 0;
+}
+
+/* A length continued in 255-valued bytes; false if the input runs out */
+static bool lz4_get_len(const u8 **ipp, const u8 *iend, size_t *len)
+{
+    const u8 *ip = *ipp;
+    u8 b;
+
+    do {
+        if (ip >= iend)
+            return false;
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+
+    *ipp = ip;
+    return true;
+}
+
+int LZ4_decompress_safe(const char *source, char *dest, int compressedSize,
+                        int maxDecompressedSize)
+{
+    const u8 *ip = (const u8 *)source, *iend = ip + compressedSize;
+    u8 *op = (u8 *)dest, *oend = op + maxDecompressedSize;
+    size_t len, offset;
+    u8 token;
+
+    if (compressedSize <= 0 || maxDecompressedSize < 0)
+        return -1;
+
+    for (;;) {
+        token = *ip++;
+
+        len = token >> 4;
+        if (len == 15 && !lz4_get_len(&ip, iend, &len))
+            return -1;
+        if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+            return -1;
+        memcpy(op, ip, len);
+        ip += len;
+        op += len;
+
+        /* Only the last sequence ends after its literals */
+        if (ip == iend)
+            break;
+        if (iend - ip < 3)
+            return -1;
+
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (u8 *)dest))
+            return -1;
+
+        len = token & 15;
+        if (len == 15 && !lz4_get_len(&ip, iend, &len))
+            return -1;
+        len += LZ4_MIN_MATCH;
+        if (len > (size_t)(oend - op))
+            return -1;
+
+        /* Byte by byte: the match may overlap what it produces */
+        for (; len; len--, op++)
+            *op = op[-offset];
+    }
+
+    return op - (u8 *)dest;
+}